@@ -0,0 +1,208 @@
+//  MeCab -- Yet Another Part-of-Speech and Morphological Analyzer
+//
+//
+//  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
+//  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <deque>
+#include <fstream>
+#include "mecab.h"
+#include "aho_corasick.h"
+#include "file.h"
+#include "utils.h"
+
+namespace MeCab {
+namespace {
+
+const unsigned int AhoCorasickMagicID = 0x6f6861e3u;
+const unsigned int AHO_CORASICK_VERSION = 2;
+
+// magic, version, size, lexsize and the fingerprint of the double array
+const size_t kHeaderSize = 4 * sizeof(unsigned int) + sizeof(uint64_t);
+
+size_t file_size(size_t size) {
+  return kHeaderSize + size * (2 * sizeof(unsigned int) +
+                               sizeof(unsigned short));
+}
+
+// the links are valid only for the very double array they were built on
+uint64_t double_array_fingerprint(const Dictionary &dic) {
+  return fingerprint(static_cast<const char *>(dic.double_array().array()),
+                     dic.double_array().size() *
+                     dic.double_array().unit_size());
+}
+}  // namespace
+
+AhoCorasick::AhoCorasick(macab_io_file_t *io)
+    : io_(io), handle_(0), unit_(0), fail_(0), output_(0), depth_(0),
+      size_(0) {}
+
+bool AhoCorasick::open(const char *filename, const Dictionary &dic) {
+  close();
+  const char *mapped(nullptr);
+  size_t length(0);
+  CHECK_FALSE(handle_ = io_->open(filename, "r", &length, (void**)&mapped))
+      << "no such file or directory: " << filename;
+  CHECK_FALSE(length >= kHeaderSize) << "file is broken: " << filename;
+
+  map_ = mapped ? IMMap::create((char*)mapped, length) :
+      IMMap::create(io_, handle_, length);
+
+  unsigned int magic;
+  unsigned int version;
+  unsigned int size;
+  unsigned int lexsize;
+  uint64_t dafp;
+  map_->read(&magic, sizeof(unsigned int));
+  map_->read(&version, sizeof(unsigned int));
+  map_->read(&size, sizeof(unsigned int));
+  map_->read(&lexsize, sizeof(unsigned int));
+  map_->read(&dafp, sizeof(uint64_t));
+
+  CHECK_FALSE((magic ^ AhoCorasickMagicID) == length &&
+              file_size(size) == length)
+      << "file is broken: " << filename;
+  CHECK_FALSE(version == AHO_CORASICK_VERSION)
+      << "incompatible version: " << version;
+  CHECK_FALSE(size == dic.double_array().size() && lexsize == dic.size() &&
+              dafp == double_array_fingerprint(dic))
+      << filename << " is not built from " << dic.filename()
+      << ". run mecab-dict-index --aho-corasick again";
+
+  size_ = size;
+  unit_ = reinterpret_cast<const Unit *>(dic.double_array().array());
+  fail_ = reinterpret_cast<const unsigned int *>(
+      map_->data(sizeof(unsigned int) * size_));
+  *map_ += static_cast<int>(sizeof(unsigned int) * size_);
+  output_ = reinterpret_cast<const unsigned int *>(
+      map_->data(sizeof(unsigned int) * size_));
+  *map_ += static_cast<int>(sizeof(unsigned int) * size_);
+  depth_ = reinterpret_cast<const unsigned short *>(
+      map_->data(sizeof(unsigned short) * size_));
+
+  return true;
+}
+
+void AhoCorasick::close() {
+  if (handle_ && io_ != nullptr && io_->close != nullptr) {
+    io_->close(handle_);
+  }
+  handle_ = 0;
+  map_.reset();
+  unit_ = 0;
+  size_ = 0;
+}
+
+void AhoCorasick::scan(const char *begin, const char *end,
+                       SentenceMatches *matches) const {
+  const size_t len = end - begin;
+  matches->found.clear();
+
+  unsigned int s = 0;
+  for (size_t i = 0; i < len; ++i) {
+    const unsigned char c = static_cast<unsigned char>(begin[i]);
+    unsigned int t = next(s, c);
+    while (!t && s) {
+      s = fail_[s];
+      t = next(s, c);
+    }
+    s = t;
+    // the words ending at i, longest first
+    for (unsigned int w = value(s) >= 0 ? s : output_[s]; w;
+         w = output_[w]) {
+      Dictionary::result_type r;
+      r.value = value(w);
+      r.length = depth_[w];
+      matches->found.push_back(
+          std::make_pair(static_cast<unsigned int>(i + 1 - r.length), r));
+    }
+  }
+
+  // bucketed by the beginning; the words of a bucket were found in the
+  // order of their ends, i.e. shortest first.
+  matches->begin.assign(len + 2, 0);
+  for (size_t i = 0; i < matches->found.size(); ++i) {
+    ++matches->begin[matches->found[i].first + 2];
+  }
+  for (size_t i = 2; i < matches->begin.size(); ++i) {
+    matches->begin[i] += matches->begin[i - 1];
+  }
+  matches->match.resize(matches->found.size());
+  for (size_t i = 0; i < matches->found.size(); ++i) {
+    matches->match[matches->begin[matches->found[i].first + 1]++] =
+        matches->found[i].second;
+  }
+
+  matches->sentence = begin;
+  matches->size = len;
+}
+
+bool AhoCorasick::compile(const char *sysdic, const char *output) {
+  Dictionary dic(mecab_default_io());
+  CHECK_DIE(dic.open(sysdic)) << dic.what();
+  CHECK_DIE(dic.double_array().unit_size() == sizeof(Unit))
+      << "unexpected unit size of the double array";
+
+  AhoCorasick index(mecab_default_io());
+  index.size_ = dic.double_array().size();
+  index.unit_ = reinterpret_cast<const Unit *>(dic.double_array().array());
+  const size_t size = index.size_;
+
+  std::vector<unsigned int> fail(size, 0);
+  std::vector<unsigned int> out(size, 0);
+  std::vector<unsigned short> depth(size, 0);
+
+  // breadth first, so that the links of shorter states are ready. The
+  // children of a state are found by the check of the 256 units after
+  // its base, which the double array keeps in range.
+  std::deque<unsigned int> queue(1, 0);
+  while (!queue.empty()) {
+    const unsigned int s = queue.front();
+    queue.pop_front();
+    for (unsigned int c = 0; c < 256; ++c) {
+      const unsigned int t = index.next(s, static_cast<unsigned char>(c));
+      if (!t) {
+        continue;
+      }
+      CHECK_DIE(depth[s] < 0xffff) << "too long word in " << sysdic;
+      depth[t] = depth[s] + 1;
+      unsigned int f = 0;
+      if (s) {
+        for (unsigned int u = fail[s]; ; u = fail[u]) {
+          f = index.next(u, static_cast<unsigned char>(c));
+          if (f || !u) {
+            break;
+          }
+        }
+      }
+      fail[t] = f;
+      out[t] = index.value(f) >= 0 ? f : out[f];
+      queue.push_back(t);
+    }
+  }
+  index.unit_ = 0;
+
+  std::ofstream ofs(WPATH(output), std::ios::binary|std::ios::out);
+  CHECK_DIE(ofs) << "permission denied: " << output;
+
+  const unsigned int magic =
+      static_cast<unsigned int>(file_size(size)) ^ AhoCorasickMagicID;
+  const unsigned int version = AHO_CORASICK_VERSION;
+  const unsigned int usize = static_cast<unsigned int>(size);
+  const unsigned int lexsize = static_cast<unsigned int>(dic.size());
+  const uint64_t dafp = double_array_fingerprint(dic);
+  ofs.write(reinterpret_cast<const char *>(&magic), sizeof(unsigned int));
+  ofs.write(reinterpret_cast<const char *>(&version), sizeof(unsigned int));
+  ofs.write(reinterpret_cast<const char *>(&usize), sizeof(unsigned int));
+  ofs.write(reinterpret_cast<const char *>(&lexsize), sizeof(unsigned int));
+  ofs.write(reinterpret_cast<const char *>(&dafp), sizeof(uint64_t));
+  ofs.write(reinterpret_cast<const char *>(&fail[0]),
+            sizeof(unsigned int) * size);
+  ofs.write(reinterpret_cast<const char *>(&out[0]),
+            sizeof(unsigned int) * size);
+  ofs.write(reinterpret_cast<const char *>(&depth[0]),
+            sizeof(unsigned short) * size);
+  CHECK_DIE(ofs) << "cannot write: " << output;
+
+  return true;
+}
+}
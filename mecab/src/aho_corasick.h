@@ -0,0 +1,81 @@
+//  MeCab -- Yet Another Part-of-Speech and Morphological Analyzer
+//
+//
+//  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
+//  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#ifndef MECAB_AHO_CORASICK_H_
+#define MECAB_AHO_CORASICK_H_
+
+#include <vector>
+#include "mecab.h"
+#include "common.h"
+#include "file.h"
+#include "dictionary.h"
+
+namespace MeCab {
+
+// The dictionary matches of a whole sentence. The matches beginning at
+// byte i of |sentence| are match[begin[i]] .. match[begin[i + 1] - 1],
+// shortest first, as commonPrefixSearch() returns them.
+struct SentenceMatches {
+  const char *sentence;  // 0 unless the sentence has been scanned
+  size_t size;
+  std::vector<unsigned int> begin;
+  std::vector<Dictionary::result_type> match;
+  std::vector<std::pair<unsigned int, Dictionary::result_type> > found;
+
+  SentenceMatches() : sentence(0), size(0) {}
+};
+
+// Failure and output links over the double array of sys.dic, saved as
+// AHO_CORASICK_FILE by mecab-dict-index --aho-corasick. scan() finds all
+// the words of the dictionary in a sentence in one pass, instead of a
+// commonPrefixSearch() from the root at every position.
+class AhoCorasick {
+ public:
+  bool open(const char *filename, const Dictionary &dic);
+  void close();
+
+  void scan(const char *begin, const char *end,
+            SentenceMatches *matches) const;
+
+  static bool compile(const char *sysdic, const char *output);
+
+  const char *what() { return what_.str(); }
+
+  explicit AhoCorasick(macab_io_file_t *io);
+  virtual ~AhoCorasick() { this->close(); }
+
+ private:
+  // the layout of a unit of Darts::DoubleArray
+  struct Unit {
+    int          base;
+    unsigned int check;
+  };
+
+  // the state reached from |s| by |c|, or 0
+  unsigned int next(unsigned int s, unsigned char c) const {
+    const int b = unit_[s].base;
+    const unsigned int p = b + c + 1;
+    return unit_[p].check == static_cast<unsigned int>(b) ? p : 0;
+  }
+
+  // the value of the word ending at |s|, or -1
+  int value(unsigned int s) const {
+    const unsigned int b = unit_[s].base;
+    return (unit_[b].check == b && unit_[b].base < 0) ?
+        -unit_[b].base - 1 : -1;
+  }
+
+  macab_io_file_t      *io_;
+  file_handle_t         handle_;
+  IMMap::Ptr            map_;
+  const Unit           *unit_;
+  const unsigned int   *fail_;    // longest proper suffix state
+  const unsigned int   *output_;  // longest proper suffix word, or 0
+  const unsigned short *depth_;   // bytes from the root
+  size_t                size_;
+  whatlog               what_;
+};
+}
+#endif  // MECAB_AHO_CORASICK_H_
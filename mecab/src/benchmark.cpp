@@ -0,0 +1,679 @@
+//  MeCab -- Yet Another Part-of-Speech and Morphological Analyzer
+//
+//
+//  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
+//  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include "mecab.h"
+#include "common.h"
+#include "file.h"
+#include "char_property.h"
+#include "connector.h"
+#include "dictionary.h"
+#include "param.h"
+#include "stream_wrapper.h"
+#include "string_buffer.h"
+#include "tokenizer.h"
+#include "utils.h"
+#include "viterbi.h"
+#include "writer.h"
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#include <io.h>
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#define MECAB_DUP _dup
+#define MECAB_DUP2 _dup2
+#define MECAB_FILENO _fileno
+#define MECAB_CLOSE _close
+#else
+#include <unistd.h>
+#define MECAB_DUP dup
+#define MECAB_DUP2 dup2
+#define MECAB_FILENO fileno
+#define MECAB_CLOSE close
+#endif
+
+namespace MeCab {
+
+// Sends what is printed to stdout, e.g. progress_bar(), to stderr while
+// alive, so that the JSON written to stdout stays parsable.
+class StdoutToStderr {
+ public:
+  StdoutToStderr() {
+    std::cout.flush();
+    std::fflush(stdout);
+    fd_ = MECAB_DUP(MECAB_FILENO(stdout));
+    MECAB_DUP2(MECAB_FILENO(stderr), MECAB_FILENO(stdout));
+  }
+
+  ~StdoutToStderr() {
+    std::cout.flush();
+    std::fflush(stdout);
+    MECAB_DUP2(fd_, MECAB_FILENO(stdout));
+    MECAB_CLOSE(fd_);
+  }
+
+ private:
+  int fd_;
+};
+
+// Microbenchmarks of the analysis steps on a dictionary and a corpus.
+// Every benchmark makes passes over the corpus until --min-time has
+// elapsed and reports ns/op, bytes/op and, for the per-sentence ones,
+// sentences/s as JSON. bytes/op is the input consumed by an op, or the
+// output produced for the Writer benchmarks. The connector benchmarks
+// also report the resident bytes their matrix layout takes.
+class Benchmark {
+ public:
+  static int run(int argc, char **argv) {
+    static const MeCab::Option long_options[] = {
+      { "dicdir",   'd',  0,   "DIR",  "set DIR as a system dicdir" },
+      { "rcfile",   'r',  0,   "FILE", "use FILE as a resource file" },
+      { "workdir",  'w',  ".", "DIR",
+        "build the other matrix layout in DIR (default \".\")" },
+      { "min-time", 't',  "0.5", "FLOAT",
+        "run each benchmark for FLOAT seconds at least (default 0.5)" },
+      { "filter",   'b',  0,   "STR",
+        "run only the benchmarks whose names contain STR" },
+      { "output",   'o',  0,   "FILE", "set the output filename" },
+      { "version",  'v',  0,   0,    "show the version and exit"   },
+      { "help",     'h',  0,   0,    "show this help and exit."   },
+      { 0, 0, 0, 0 }
+    };
+
+    Param param(mecab_default_io());
+
+    if (!param.open(argc, argv, long_options)) {
+      std::cout << param.what() << "\n\n" <<  COPYRIGHT
+                << "\ntry '--help' for more information." << std::endl;
+      return -1;
+    }
+
+    if (!param.help_version()) {
+      return 0;
+    }
+
+    std::vector<std::string> files = param.rest_args();
+    if (files.empty()) {
+      files.push_back("-");
+    }
+
+    std::string output = param.get<std::string>("output");
+    if (output.empty()) output = "-";
+
+    CHECK_DIE(load_dictionary_resource(&param)) << param.what();
+
+    Benchmark bench(&param);
+    for (size_t i = 0; i < files.size(); ++i) {
+      istream_wrapper ifs(files[i].c_str());
+      CHECK_DIE(*ifs) << "no such file or directory: " << files[i];
+      bench.read(&*ifs);
+    }
+    CHECK_DIE(!bench.sentence_.empty()) << "no sentences are given";
+
+    ostream_wrapper ofs(output.c_str());
+    CHECK_DIE(*ofs) << "permission denied: " << output;
+    bench.runAll(&*ofs);
+
+    return 0;
+  }
+
+ private:
+  struct Counter {
+    size_t ops;
+    size_t bytes;
+    size_t sentences;
+  };
+
+  typedef void (Benchmark::*Function)(Counter *);
+
+  Param *param_;
+  std::string filter_;
+  double min_time_;
+  std::shared_ptr<Viterbi> viterbi_;
+  const Tokenizer<Node, Path> *tokenizer_;
+  const Dictionary *sysdic_;
+  const CharProperty *property_;
+  std::shared_ptr<Connector> matrix_;  // the other layout of matrix.bin
+  std::string matrix_file_;
+  const Connector *dense_;
+  const Connector *compressed_;
+  std::string dense_file_;
+  std::string compressed_file_;
+  size_t dense_rss_;       // resident bytes of each layout
+  size_t compressed_rss_;  // while the transitions are looked up
+  std::shared_ptr<Lattice> lattice_;
+  std::vector<std::shared_ptr<Lattice> > parsed_;  // for Writer
+  std::vector<std::shared_ptr<Writer> > writer_;
+  std::vector<std::string> writer_name_;
+  size_t writer_index_;
+  std::shared_ptr<Model> model_;
+  std::shared_ptr<Tagger> tagger_;
+  std::vector<std::string> sentence_;
+  std::vector<std::vector<size_t> > offset_;  // character boundaries
+  std::string long_sentence_;  // the sentences joined, up to 64KB
+  std::vector<size_t> long_offset_;
+  std::string run_sentence_;   // one run of the same character type
+  std::vector<size_t> run_offset_;
+  std::vector<std::pair<unsigned short, unsigned short> > transition_;
+  size_t bytes_;
+  volatile size_t sink_;  // keeps the results of the benchmarks alive
+  bool first_;
+
+  explicit Benchmark(Param *param)
+      : param_(param), min_time_(0.0), tokenizer_(0), sysdic_(0),
+        property_(0), dense_(0), compressed_(0), dense_rss_(0),
+        compressed_rss_(0),
+        writer_index_(0), bytes_(0), sink_(0), first_(true) {
+    filter_ = param_->get<std::string>("filter");
+    min_time_ = param_->get<double>("min-time");
+  }
+
+  ~Benchmark() {
+    matrix_.reset();
+    if (!matrix_file_.empty()) {
+      std::remove(matrix_file_.c_str());
+    }
+  }
+
+  // Resident set size of the process, or 0 where it is not known.
+  static size_t residentSize() {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                              sizeof(counters))) {
+      return 0;
+    }
+    return counters.WorkingSetSize;
+#else
+    std::ifstream ifs("/proc/self/statm");
+    size_t size = 0;
+    size_t resident = 0;
+    if (!(ifs >> size >> resident)) {
+      return 0;
+    }
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+  }
+
+  // The growth of the resident set while the transitions are looked up
+  // in a fresh copy of the matrix in |filename|, i.e. the pages of the
+  // layout they touch. A file is opened only once at a time, hence the
+  // copy.
+  size_t matrixResidentSize(const std::string &filename) {
+    const std::string copy = create_filename(
+        param_->get<std::string>("workdir"), "mecab-bench-rss.bin");
+    {
+      std::ifstream ifs(WPATH(filename.c_str()), std::ios::binary);
+      std::ofstream ofs(WPATH(copy.c_str()), std::ios::binary);
+      CHECK_DIE(ifs && ofs) << "cannot copy " << filename << " to " << copy;
+      ofs << ifs.rdbuf();
+    }
+
+    size_t growth = 0;
+    {
+      Connector connector(mecab_default_io());
+      CHECK_DIE(connector.open(copy.c_str())) << connector.what();
+      const size_t before = residentSize();
+      Counter c = { 0, 0, 0 };
+      cost(&connector, &c);
+      const size_t after = residentSize();
+      if (before && after > before) {
+        growth = after - before;
+      }
+    }
+    std::remove(copy.c_str());
+    return growth;
+  }
+
+  // matrix.bin is benchmarked in its own layout, and matrix.def is
+  // compiled into the other one in workdir. Compacted context ids are
+  // not reproduced from matrix.def, so such a matrix is only compared
+  // with itself.
+  void openMatrix() {
+    const std::string dicdir = param_->get<std::string>("dicdir");
+    const std::string def = create_filename(dicdir, MATRIX_DEF_FILE);
+    const Connector *connector = viterbi_->connector();
+    if (connector->is_compressed()) {
+      compressed_ = connector;
+      compressed_file_ = create_filename(dicdir, MATRIX_FILE);
+    } else {
+      dense_ = connector;
+      dense_file_ = create_filename(dicdir, MATRIX_FILE);
+    }
+
+    if (!file_exists(def.c_str()) ||
+        file_exists(create_filename(dicdir, CONTEXT_ID_MAP_FILE).c_str())) {
+      return;
+    }
+
+    matrix_file_ = create_filename(param_->get<std::string>("workdir"),
+                                   "mecab-bench-matrix.bin");
+    Connector::compile(def.c_str(), matrix_file_.c_str(), !compressed_);
+    matrix_.reset(new Connector(mecab_default_io()));
+    CHECK_DIE(matrix_->open(matrix_file_.c_str())) << matrix_->what();
+    if (!compressed_) {
+      // compile() keeps the dense layout when it is smaller
+      if (matrix_->is_compressed()) {
+        compressed_ = matrix_.get();
+        compressed_file_ = matrix_file_;
+      }
+    } else {
+      dense_ = matrix_.get();
+      dense_file_ = matrix_file_;
+    }
+  }
+
+  // Reads raw sentences, one per line, or a tagged corpus whose
+  // sentences end with EOS.
+  void read(std::istream *is) {
+    std::array<char, BUF_SIZE> buf;
+    char *col[2];
+    std::string str;
+    while (is->getline(buf.data(), buf.size())) {
+      if (std::strcmp(buf.data(), "EOS") == 0) {
+        if (!str.empty()) {
+          sentence_.push_back(str);
+        }
+        str.clear();
+      } else if (std::strchr(buf.data(), '\t')) {
+        tokenize(buf.data(), "\t", col, 2);
+        str += col[0];
+      } else if (buf[0] != '\0') {
+        sentence_.push_back(buf.data());
+      }
+    }
+  }
+
+  // Opens the analyzer, splits the sentences into characters and
+  // collects the transitions the Viterbi search costs, i.e. the work of
+  // connect(). Messages printed here go to stderr, so that the JSON can
+  // be written to stdout.
+  void prepare() {
+    StdoutToStderr redirect;
+    viterbi_.reset(new Viterbi(mecab_default_io()));
+    CHECK_DIE(viterbi_->open(*param_)) << viterbi_->what();
+    tokenizer_ = viterbi_->tokenizer();
+    sysdic_ = tokenizer_->system_dictionary();
+    property_ = tokenizer_->property();
+    openMatrix();
+
+    const size_t kMaxTransitions = 1 << 22;
+    const size_t kMaxParsed = 1000;
+    const size_t kMaxLongSentence = 65536;
+    lattice_.reset(createLattice());
+    offset_.resize(sentence_.size());
+    for (size_t i = 0; i < sentence_.size(); ++i) {
+      const char *begin = sentence_[i].c_str();
+      const char *end = begin + sentence_[i].size();
+      size_t mblen = 0;
+      for (const char *p = begin; p < end; p += mblen) {
+        offset_[i].push_back(p - begin);
+        property_->getCharInfo(p, end, &mblen);
+      }
+      bytes_ += sentence_[i].size();
+
+      std::shared_ptr<Lattice> lattice(createLattice());
+      lattice->set_sentence(begin);
+      CHECK_DIE(viterbi_->analyze(lattice.get())) << lattice->what();
+      for (size_t pos = 0; pos <= lattice->size(); ++pos) {
+        for (Node *rnode = lattice->begin_nodes(pos); rnode;
+             rnode = rnode->bnext) {
+          for (Node *lnode = lattice->end_nodes(pos); lnode;
+               lnode = lnode->enext) {
+            if (transition_.size() < kMaxTransitions) {
+              transition_.push_back(std::make_pair(lnode->rcAttr,
+                                                   rnode->lcAttr));
+            }
+          }
+        }
+      }
+      if (parsed_.size() < kMaxParsed) {
+        parsed_.push_back(lattice);
+      }
+      if (long_sentence_.size() + sentence_[i].size() < kMaxLongSentence) {
+        for (size_t j = 0; j < offset_[i].size(); ++j) {
+          long_offset_.push_back(long_sentence_.size() + offset_[i][j]);
+        }
+        long_sentence_ += sentence_[i];
+      }
+    }
+
+    if (dense_) {
+      dense_rss_ = matrixResidentSize(dense_file_);
+    }
+    if (compressed_) {
+      compressed_rss_ = matrixResidentSize(compressed_file_);
+    }
+
+    // 'a' is a single byte in the charsets other than UTF-16
+    const int charset = decode_charset(sysdic_->charset());
+    if (charset != UTF16 && charset != UTF16LE && charset != UTF16BE) {
+      const size_t kRunSize = 4096;
+      run_sentence_.assign(kRunSize, 'a');
+      for (size_t i = 0; i < kRunSize; ++i) {
+        run_offset_.push_back(i);
+      }
+    }
+
+    // the defaults of the mecab command, unless the dicrc sets them
+    static const char *kFormat[][2] = {
+      { "node-format", "%m\\t%H\\n" },
+      { "unk-format",  "%m\\t%H\\n" },
+      { "eos-format",  "EOS\\n" }
+    };
+    for (size_t i = 0; i < sizeof(kFormat) / sizeof(kFormat[0]); ++i) {
+      if (param_->get<std::string>(kFormat[i][0]).empty()) {
+        param_->set(kFormat[i][0], kFormat[i][1]);
+      }
+    }
+
+    // the empty style is the default one, i.e. the lattice format
+    static const char *kStyle[] = { "", "wakati", "dump", "json" };
+    for (size_t i = 0; i < sizeof(kStyle) / sizeof(kStyle[0]); ++i) {
+      param_->set("output-format-type", kStyle[i]);
+      std::shared_ptr<Writer> writer(new Writer);
+      if (writer->open(*param_)) {
+        writer_.push_back(writer);
+        writer_name_.push_back(*kStyle[i] ? kStyle[i] : "lattice");
+      }
+    }
+    param_->set("output-format-type", kStyle[0]);
+  }
+
+  // The files of a dictionary can be opened only once at a time, so the
+  // analyzer is closed before the Model opens them again.
+  void prepareTagger() {
+    StdoutToStderr redirect;
+    parsed_.clear();
+    lattice_.reset();
+    matrix_.reset();
+    viterbi_.reset();
+    tokenizer_ = 0;
+    sysdic_ = 0;
+    property_ = 0;
+    dense_ = compressed_ = 0;
+
+    std::string arg = "-d " + param_->get<std::string>("dicdir");
+    const std::string rcfile = param_->get<std::string>("rcfile");
+    if (!rcfile.empty()) {
+      arg += " -r " + rcfile;
+    }
+    model_.reset(createModel(arg.c_str()));
+    CHECK_DIE(model_.get()) << getLastError();
+    tagger_.reset(model_->createTagger());
+    lattice_.reset(model_->createLattice());
+  }
+
+  bool selected(const std::string &name) const {
+    return filter_.empty() || name.find(filter_) != std::string::npos;
+  }
+
+  void measure(std::ostream *os, const std::string &name, Function f,
+               size_t rss = 0) {
+    if (!selected(name)) {
+      return;
+    }
+
+    Counter warmup = { 0, 0, 0 };
+    (this->*f)(&warmup);
+
+    Counter c = { 0, 0, 0 };
+    size_t iterations = 0;
+    double elapsed = 0.0;
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    do {
+      (this->*f)(&c);
+      ++iterations;
+      elapsed = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < min_time_);
+
+    const double ops = static_cast<double>(std::max<size_t>(c.ops, 1));
+    *os << (first_ ? "\n" : ",\n")
+        << "    {\"name\": \"" << name << "\""
+        << ", \"iterations\": " << iterations
+        << ", \"ops\": " << c.ops
+        << ", \"ns_per_op\": " << elapsed * 1e9 / ops
+        << ", \"bytes_per_op\": " << c.bytes / ops;
+    if (c.sentences) {
+      *os << ", \"sentences_per_sec\": " << c.sentences / elapsed;
+    }
+    if (rss) {
+      *os << ", \"rss_bytes\": " << rss;
+    }
+    *os << "}" << std::flush;
+    first_ = false;
+  }
+
+  void runAll(std::ostream *os) {
+    prepare();
+
+    std::string dicdir = param_->get<std::string>("dicdir");
+    replace_string(&dicdir, "\\", "\\\\");
+    replace_string(&dicdir, "\"", "\\\"");
+    *os << "{\n"
+        << "  \"dicdir\": \"" << dicdir << "\",\n"
+        << "  \"charset\": \"" << sysdic_->charset() << "\",\n"
+        << "  \"lexicon_size\": " << sysdic_->size() << ",\n"
+        << "  \"left_size\": " << sysdic_->lsize() << ",\n"
+        << "  \"right_size\": " << sysdic_->rsize() << ",\n"
+        << "  \"sentences\": " << sentence_.size() << ",\n"
+        << "  \"bytes\": " << bytes_ << ",\n"
+        << "  \"benchmarks\": [";
+
+    measure(os, "darts.commonPrefixSearch", &Benchmark::commonPrefixSearch);
+    measure(os, "char_property.seekToOtherType",
+            &Benchmark::seekToOtherType);
+    measure(os, "tokenizer.lookup", &Benchmark::lookup);
+    measure(os, "tokenizer.lookup.long", &Benchmark::lookupLong);
+    measure(os, "tokenizer.lookup.classify", &Benchmark::classifyLookup);
+    measure(os, "tokenizer.lookup.classify.long",
+            &Benchmark::classifyLookupLong);
+    if (!run_sentence_.empty()) {
+      measure(os, "tokenizer.lookup.run", &Benchmark::lookupRun);
+      measure(os, "tokenizer.lookup.classify.run",
+              &Benchmark::classifyLookupRun);
+    }
+    if (tokenizer_->has_scanner()) {
+      measure(os, "tokenizer.lookup.scan", &Benchmark::scanLookup);
+      measure(os, "tokenizer.lookup.scan.long", &Benchmark::scanLookupLong);
+    }
+    if (dense_) {
+      measure(os, "connector.cost.dense", &Benchmark::denseCost,
+              dense_rss_);
+    }
+    if (compressed_) {
+      measure(os, "connector.cost.compressed", &Benchmark::compressedCost,
+              compressed_rss_);
+    }
+    measure(os, "viterbi.analyze", &Benchmark::analyze);
+    measure(os, "viterbi.forwardbackward", &Benchmark::forwardbackward);
+    measure(os, "nbest_generator.next", &Benchmark::nbest);
+    if (!writer_.empty()) {
+      measure(os, "writer.writeNode", &Benchmark::writeNode);
+    }
+    for (writer_index_ = 0; writer_index_ < writer_.size(); ++writer_index_) {
+      measure(os, "writer.write." + writer_name_[writer_index_],
+              &Benchmark::write);
+    }
+
+    if (selected("tagger.parse")) {
+      prepareTagger();
+      measure(os, "tagger.parse", &Benchmark::parse);
+    }
+
+    *os << "\n  ]\n}" << std::endl;
+  }
+
+  void commonPrefixSearch(Counter *c) {
+    std::array<Dictionary::result_type, 512> result;
+    for (size_t i = 0; i < sentence_.size(); ++i) {
+      const char *begin = sentence_[i].c_str();
+      const size_t size = sentence_[i].size();
+      for (size_t j = 0; j < offset_[i].size(); ++j) {
+        sink_ += sysdic_->commonPrefixSearch(begin + offset_[i][j],
+                                             size - offset_[i][j],
+                                             result.data(), result.size());
+      }
+      c->ops += offset_[i].size();
+      c->bytes += size;
+    }
+  }
+
+  void seekToOtherType(Counter *c) {
+    for (size_t i = 0; i < sentence_.size(); ++i) {
+      const char *begin = sentence_[i].c_str();
+      const char *end = begin + sentence_[i].size();
+      for (size_t j = 0; j < offset_[i].size(); ++j) {
+        size_t mblen = 0;
+        size_t clen = 0;
+        CharInfo fail;
+        const char *p = begin + offset_[i][j];
+        const CharInfo cinfo = property_->getCharInfo(p, end, &mblen);
+        sink_ += property_->seekToOtherType(p, end, cinfo,
+                                            &fail, &mblen, &clen) - p;
+      }
+      c->ops += offset_[i].size();
+      c->bytes += sentence_[i].size();
+    }
+  }
+
+  enum { kClassify = 1, kScan = 2 };
+
+  // looks up every character of |sentence|, after classifying its
+  // characters and the Aho-Corasick scan as |flags| requests.
+  void lookup(const std::string &sentence, const std::vector<size_t> &offset,
+              int flags, Counter *c) {
+    Lattice *lattice = lattice_.get();
+    const char *begin = sentence.c_str();
+    const char *end = begin + sentence.size();
+    lattice->set_sentence(begin);
+    if (flags & kClassify) {
+      tokenizer_->classify(begin, end, lattice->allocator());
+    }
+    if (flags & kScan) {
+      tokenizer_->scan(begin, end, lattice->allocator());
+    }
+    for (size_t j = 0; j < offset.size(); ++j) {
+      sink_ += tokenizer_->lookup<false>(begin + offset[j], end,
+                                         lattice->allocator(),
+                                         lattice)->length;
+    }
+    c->ops += offset.size();
+    c->bytes += sentence.size();
+  }
+
+  void lookup(Counter *c, int flags) {
+    for (size_t i = 0; i < sentence_.size(); ++i) {
+      lookup(sentence_[i], offset_[i], flags, c);
+    }
+  }
+
+  void lookup(Counter *c) { lookup(c, 0); }
+  void classifyLookup(Counter *c) { lookup(c, kClassify); }
+  void scanLookup(Counter *c) { lookup(c, kClassify | kScan); }
+
+  void lookupLong(Counter *c) {
+    lookup(long_sentence_, long_offset_, 0, c);
+  }
+
+  void classifyLookupLong(Counter *c) {
+    lookup(long_sentence_, long_offset_, kClassify, c);
+  }
+
+  void scanLookupLong(Counter *c) {
+    lookup(long_sentence_, long_offset_, kClassify | kScan, c);
+  }
+
+  void lookupRun(Counter *c) {
+    lookup(run_sentence_, run_offset_, 0, c);
+  }
+
+  void classifyLookupRun(Counter *c) {
+    lookup(run_sentence_, run_offset_, kClassify, c);
+  }
+
+  void cost(const Connector *connector, Counter *c) {
+    for (size_t i = 0; i < transition_.size(); ++i) {
+      sink_ += connector->transition_cost(transition_[i].first,
+                                          transition_[i].second);
+    }
+    c->ops += transition_.size();
+  }
+
+  void denseCost(Counter *c) { cost(dense_, c); }
+  void compressedCost(Counter *c) { cost(compressed_, c); }
+
+  void analyze(Counter *c, int request_type, size_t nbest) {
+    Lattice *lattice = lattice_.get();
+    for (size_t i = 0; i < sentence_.size(); ++i) {
+      lattice->set_sentence(sentence_[i].c_str());
+      lattice->set_request_type(request_type);
+      CHECK_DIE(viterbi_->analyze(lattice)) << lattice->what();
+      for (size_t n = 1; n < nbest && lattice->next(); ++n) {}
+      sink_ += lattice->eos_node()->cost;
+      c->bytes += sentence_[i].size();
+    }
+    c->ops += sentence_.size();
+    c->sentences += sentence_.size();
+  }
+
+  void analyze(Counter *c) { analyze(c, MECAB_ONE_BEST, 1); }
+  void forwardbackward(Counter *c) { analyze(c, MECAB_MARGINAL_PROB, 1); }
+  void nbest(Counter *c) { analyze(c, MECAB_NBEST, 10); }
+
+  // formats every node with the node-format interpreter (%m\t%H\n)
+  void writeNode(Counter *c) {
+    StringBuffer os;
+    const Writer *writer = writer_[0].get();
+    for (size_t i = 0; i < parsed_.size(); ++i) {
+      Lattice *lattice = parsed_[i].get();
+      for (const Node *node = lattice->bos_node()->next;
+           node->next; node = node->next) {
+        os.clear();
+        CHECK_DIE(writer->writeNode(lattice, "%m\t%H\n", node, &os));
+        c->bytes += os.size();
+        ++c->ops;
+      }
+    }
+  }
+
+  void write(Counter *c) {
+    StringBuffer os;
+    const Writer *writer = writer_[writer_index_].get();
+    for (size_t i = 0; i < parsed_.size(); ++i) {
+      os.clear();
+      CHECK_DIE(writer->write(parsed_[i].get(), &os));
+      c->bytes += os.size();
+    }
+    c->ops += parsed_.size();
+    c->sentences += parsed_.size();
+  }
+
+  void parse(Counter *c) {
+    Lattice *lattice = lattice_.get();
+    for (size_t i = 0; i < sentence_.size(); ++i) {
+      lattice->set_sentence(sentence_[i].c_str());
+      CHECK_DIE(tagger_->parse(lattice)) << lattice->what();
+      c->bytes += sentence_[i].size();
+    }
+    c->ops += sentence_.size();
+    c->sentences += sentence_.size();
+  }
+};
+}
+
+// exports
+int mecab_bench(int argc, char **argv) {
+  return MeCab::Benchmark::run(argc, argv);
+}
@@ -0,0 +1,58 @@
+//  MeCab -- Yet Another Part-of-Speech and Morphological Analyzer
+//
+//
+//  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
+//  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#ifndef MECAB_BUDGET_H_
+#define MECAB_BUDGET_H_
+
+#include <chrono>
+#include <cstddef>
+
+namespace MeCab {
+
+// Work allowed for one lattice (--max-nodes, --max-paths, --max-time).
+// A copy is started per lattice; exceeded() reads the clock only every
+// kClockInterval calls, so it can be called per position or candidate.
+class WorkBudget {
+ public:
+  bool bounded() const {
+    return max_nodes_ > 0 || max_paths_ > 0 || max_time_.count() > 0;
+  }
+
+  void start() {
+    checks_ = 0;
+    deadline_ = std::chrono::steady_clock::now() + max_time_;
+  }
+
+  // The limit that ran out, or 0.
+  const char *exceeded(size_t nodes, size_t paths) {
+    if (max_nodes_ > 0 && nodes > max_nodes_) {
+      return "work budget exceeded: max-nodes";
+    }
+    if (max_paths_ > 0 && paths > max_paths_) {
+      return "work budget exceeded: max-paths";
+    }
+    if (max_time_.count() > 0 && ++checks_ % kClockInterval == 0 &&
+        std::chrono::steady_clock::now() > deadline_) {
+      return "work budget exceeded: max-time";
+    }
+    return 0;
+  }
+
+  WorkBudget(size_t max_nodes = 0, size_t max_paths = 0,
+             double max_time_ms = 0.0)
+      : max_nodes_(max_nodes), max_paths_(max_paths),
+        max_time_(static_cast<long long>(max_time_ms * 1e6)), checks_(0) {}
+
+ private:
+  static const size_t kClockInterval = 16;
+
+  size_t max_nodes_;
+  size_t max_paths_;
+  std::chrono::nanoseconds max_time_;
+  std::chrono::steady_clock::time_point deadline_;
+  size_t checks_;
+};
+}
+#endif  // MECAB_BUDGET_H_
@@ -118,6 +118,43 @@ void CharProperty::close() {
 	 io_->close(handle_);
 }
 
+void CharProperty::classify(const char *begin, const char *end,
+                            SentenceChars *chars) const {
+  const size_t size = end - begin;
+  chars->info.resize(size + 1);
+  chars->length.assign(size + 1, 0);
+  chars->run_end.resize(size + 1);
+  chars->index.resize(size + 1);
+  chars->begin.clear();
+
+  size_t mblen = 0;
+  for (size_t b = 0; b < size; b += mblen) {
+    chars->info[b] = getCharInfo(begin + b, end, &mblen);
+    if (mblen == 0 || b + mblen > size) {  // a broken last character
+      mblen = size - b;
+    }
+    chars->length[b] = static_cast<unsigned char>(mblen);
+    for (size_t i = b; i < b + mblen; ++i) {
+      chars->index[i] = static_cast<unsigned int>(chars->begin.size());
+    }
+    chars->begin.push_back(static_cast<unsigned int>(b));
+  }
+  chars->index[size] = static_cast<unsigned int>(chars->begin.size());
+
+  // a run continues while a character shares a type with the previous
+  // one, as in seekToOtherType().
+  for (size_t k = chars->begin.size(); k-- > 0;) {
+    const size_t b = chars->begin[k];
+    const size_t next = b + chars->length[b];
+    chars->run_end[b] = static_cast<unsigned int>(
+        next < size && chars->info[next].isKindOf(chars->info[b]) ?
+        chars->run_end[next] : next);
+  }
+
+  chars->sentence = begin;
+  chars->size = size;
+}
+
 size_t CharProperty::size() const { return clist_.size(); }
 
 const char *CharProperty::name(size_t i) const {
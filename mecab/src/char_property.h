@@ -5,6 +5,8 @@
 #ifndef MECAB_CHARACTER_CATEGORY_H_
 #define MECAB_CHARACTER_CATEGORY_H_
 
+#include <algorithm>
+#include <vector>
 #include "utils.h"
 #include "ucs.h"
 
@@ -21,6 +23,33 @@ struct CharInfo {
   bool isKindOf(CharInfo c) const { return type & c.type; }
 };
 
+// The characters of a sentence classified once by
+// CharProperty::classify(), indexed by the byte offset of a character.
+// run_end is where seekToOtherType() from the character stops, so that
+// a run of the same type is not decoded again from each of its
+// characters.
+struct SentenceChars {
+  const char *sentence;  // 0 unless a sentence has been classified
+  size_t size;
+  std::vector<CharInfo> info;
+  std::vector<unsigned char> length;   // 0 inside a character
+  std::vector<unsigned int> run_end;
+  std::vector<unsigned int> index;     // characters before the byte
+  std::vector<unsigned int> begin;     // byte offset of a character
+
+  // true if [|b|, |e|) of the sentence begins and ends at characters
+  bool covers(const char *b, const char *e) const {
+    return sentence && b >= sentence && e <= sentence + size && b <= e &&
+        isCharBegin(b - sentence) && isCharBegin(e - sentence);
+  }
+
+  bool isCharBegin(size_t offset) const {
+    return offset == size || length[offset] != 0;
+  }
+
+  SentenceChars() : sentence(0), size(0) {}
+};
+
 class CharProperty {
  public:
   bool open(const Param &);
@@ -74,6 +103,50 @@ class CharProperty {
 
   inline CharInfo getCharInfo(size_t id) const { return map_[id]; }
 
+  // Fills |chars| with the classes and the runs of [begin, end).
+  void classify(const char *begin, const char *end,
+                SentenceChars *chars) const;
+
+  // The same as above, read from |chars| unless it is null. [begin, end)
+  // must be covered by |chars|.
+  inline const char *seekToOtherType(const SentenceChars *chars,
+                                     const char *begin, const char *end,
+                                     CharInfo c, CharInfo *fail,
+                                     size_t *mblen, size_t *clen) const {
+    if (!chars) {
+      return seekToOtherType(begin, end, c, fail, mblen, clen);
+    }
+    *clen = 0;
+    if (begin == end) {
+      return begin;
+    }
+    const size_t b = begin - chars->sentence;
+    const size_t e = end - chars->sentence;
+    *fail = chars->info[b];
+    *mblen = chars->length[b];
+    if (!c.isKindOf(*fail)) {
+      return begin;
+    }
+    const size_t r = std::min<size_t>(chars->run_end[b], e);
+    *clen = chars->index[r] - chars->index[b];
+    // the character which stopped the run, or the last one before |end|
+    const size_t last = r < e ? r : chars->begin[chars->index[e] - 1];
+    *fail = chars->info[last];
+    *mblen = chars->length[last];
+    return chars->sentence + r;
+  }
+
+  inline CharInfo getCharInfo(const SentenceChars *chars,
+                              const char *begin, const char *end,
+                              size_t *mblen) const {
+    if (!chars || begin >= end) {
+      return getCharInfo(begin, end, mblen);
+    }
+    const size_t b = begin - chars->sentence;
+    *mblen = chars->length[b];
+    return chars->info[b];
+  }
+
   static bool compile(const char *, const char *, const char*);
 
   CharProperty(macab_io_file_t *io/* = mecab_default_io()*/);
@@ -36,6 +36,7 @@
 #define UNK_DIC_FILE            "unk.dic"
 #define MATRIX_DEF_FILE         "matrix.def"
 #define MATRIX_FILE             "matrix.bin"
+#define CONTEXT_ID_MAP_FILE     "context-id.bin"
 #define CHAR_PROPERTY_DEF_FILE  "char.def"
 #define CHAR_PROPERTY_FILE      "char.bin"
 #define FEATURE_FILE            "feature.def"
@@ -45,7 +46,9 @@
 #define POS_ID_FILE             "pos-id.def"
 #define MODEL_DEF_FILE          "model.def"
 #define MODEL_FILE              "model.bin"
+#define AHO_CORASICK_FILE       "sys.aho"
 #define DICRC                   "dicrc"
+#define BUILD_CACHE_FILE        "build.cache"
 #define BOS_KEY                 "BOS/EOS"
 
 #define DEFAULT_MAX_GROUPING_SIZE 24
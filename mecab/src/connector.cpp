@@ -3,6 +3,8 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <algorithm>
+#include <climits>
 #include <fstream>
 #include <sstream>
 #include <array>
@@ -10,10 +12,42 @@
 #include "common.h"
 #include "file.h"
 #include "connector.h"
+#include "context_id.h"
 #include "param.h"
 #include "utils.h"
 
 namespace MeCab {
+namespace {
+
+// lsize/rsize pair that marks a compressed matrix.bin
+const unsigned short kCompressedMatrixMarker = 0xffff;
+
+size_t align4(size_t size) {
+  return (size + 3) & ~static_cast<size_t>(3);
+}
+
+// Picks the base value of a row so that as many cells as possible
+// fall into [base - 127, base + 127].
+short choose_base(const short *row, size_t size) {
+  std::vector<short> sorted(row, row + size);
+  std::sort(sorted.begin(), sorted.end());
+  size_t best = 0;
+  size_t best_count = 0;
+  for (size_t i = 0, j = 0; i < sorted.size(); ++i) {
+    while (j < sorted.size() && sorted[j] - sorted[i] <= 254) {
+      ++j;
+    }
+    if (j - i > best_count) {
+      best_count = j - i;
+      best = i;
+    }
+  }
+  if (sorted.empty()) {
+    return 0;
+  }
+  return static_cast<short>(std::min(sorted[best] + 127, SHRT_MAX));
+}
+}  // namespace
 
 bool Connector::open(const Param &param) {
   const std::string filename = create_filename
@@ -32,6 +66,37 @@ bool Connector::open(const char* filename, const char *mode) {
   ptr->read(&lsize_, sizeof(unsigned short));
   ptr->read(&rsize_, sizeof(unsigned short));
 
+  matrix_ = 0;
+  base_ = 0;
+  delta_ = 0;
+  exception_begin_ = 0;
+  exception_ = 0;
+
+  if (lsize_ == kCompressedMatrixMarker && rsize_ == kCompressedMatrixMarker) {
+    unsigned int nexception = 0;
+    ptr->read(&lsize_, sizeof(unsigned short));
+    ptr->read(&rsize_, sizeof(unsigned short));
+    ptr->read(&nexception, sizeof(unsigned int));
+
+    const size_t base_size = align4(sizeof(short) * rsize_);
+    const size_t begin_size = sizeof(unsigned int) * (rsize_ + 1);
+    const size_t exception_size = sizeof(MatrixException) * nexception;
+    CHECK_FALSE(length == 3 * sizeof(unsigned int) + base_size + begin_size +
+                exception_size + static_cast<size_t>(lsize_ * rsize_))
+        << "file size is invalid: " << filename;
+
+    base_ = reinterpret_cast<const short *>(ptr->data());
+    *ptr += static_cast<int>(base_size);
+    exception_begin_ = reinterpret_cast<const unsigned int *>(ptr->data());
+    *ptr += static_cast<int>(begin_size);
+    exception_ = reinterpret_cast<const MatrixException *>(ptr->data());
+    *ptr += static_cast<int>(exception_size);
+    delta_ = reinterpret_cast<const signed char *>(ptr->data());
+    CHECK_FALSE(base_ && exception_begin_ && delta_) << "matrix is NULL";
+
+    return true;
+  }
+
   matrix_ = (short*)ptr->data();
 
   // check valid
@@ -47,6 +112,21 @@ void Connector::close() {
 	 io_->close(handle_);
 }
 
+int Connector::exception_cost(unsigned short rcAttr,
+                              unsigned short lcAttr) const {
+  const MatrixException *begin = exception_ + exception_begin_[lcAttr];
+  const MatrixException *end = exception_ + exception_begin_[lcAttr + 1];
+  while (begin < end) {
+    const MatrixException *mid = begin + (end - begin) / 2;
+    if (mid->rcAttr < rcAttr) {
+      begin = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+  return begin->cost;
+}
+
 short * Connector::mutable_matrix()
 {
 	return &matrix_[0];
@@ -73,7 +153,9 @@ bool Connector::openText(const char *filename) {
   return true;
 }
 
-bool Connector::compile(const char *ifile, const char *ofile) {
+bool Connector::compile(const char *ifile, const char *ofile, bool compress,
+                        const char *map_file,
+                        const ContextIDProfile *profile) {
   std::ifstream ifs(WPATH(ifile));
   std::istringstream iss(MATRIX_DEF_DEFAULT);
   std::istream *is = &ifs;
@@ -92,8 +174,8 @@ bool Connector::compile(const char *ifile, const char *ofile) {
 
   CHECK_DIE(tokenize2(buf.data(), "\t ", column, 2) == 2) << "format error: " << buf.data();
 
-  const unsigned short lsize = std::atoi(column[0]);
-  const unsigned short rsize = std::atoi(column[1]);
+  unsigned short lsize = std::atoi(column[0]);
+  unsigned short rsize = std::atoi(column[1]);
   std::vector<short> matrix(lsize * rsize);
   std::fill(matrix.begin(), matrix.end(), 0);
 
@@ -109,8 +191,89 @@ bool Connector::compile(const char *ifile, const char *ofile) {
     matrix[(l + lsize * r)] = static_cast<short>(c);
   }
 
+  if (map_file) {
+    ContextIDMap idmap;
+    std::vector<short> compacted;
+    idmap.build(matrix, lsize, rsize, &compacted, profile);
+    CHECK_DIE(idmap.save(map_file));
+    std::cout << "compacting context ids ... " << lsize << "x" << rsize
+              << " -> " << idmap.compact_left_size() << "x"
+              << idmap.compact_right_size() << std::endl;
+    lsize = static_cast<unsigned short>(idmap.compact_left_size());
+    rsize = static_cast<unsigned short>(idmap.compact_right_size());
+    matrix.swap(compacted);
+  }
+
   std::ofstream ofs(WPATH(ofile), std::ios::binary|std::ios::out);
   CHECK_DIE(ofs) << "permission denied: " << ofile;
+
+  if (compress) {
+    CHECK_DIE(lsize != kCompressedMatrixMarker &&
+              rsize != kCompressedMatrixMarker) << "matrix is too large";
+    std::vector<short> base(rsize, 0);
+    std::vector<signed char> delta(matrix.size(), 0);
+    std::vector<unsigned int> exception_begin(1, 0);
+    std::vector<MatrixException> exception;
+
+    for (size_t r = 0; r < rsize; ++r) {
+      const short *row = &matrix[lsize * r];
+      base[r] = choose_base(row, lsize);
+      for (size_t l = 0; l < lsize; ++l) {
+        const int d = row[l] - base[r];
+        if (d >= -127 && d <= 127) {
+          delta[l + lsize * r] = static_cast<signed char>(d);
+        } else {
+          delta[l + lsize * r] = kEscapeDelta;
+          MatrixException e;
+          e.rcAttr = static_cast<unsigned short>(l);
+          e.cost = row[l];
+          exception.push_back(e);
+        }
+      }
+      exception_begin.push_back(static_cast<unsigned int>(exception.size()));
+    }
+
+    const unsigned int nexception = static_cast<unsigned int>(exception.size());
+    const size_t base_size = align4(sizeof(short) * rsize);
+    const size_t dense_size = (lsize * rsize + 2) * sizeof(short);
+    const size_t compressed_size = 3 * sizeof(unsigned int) + base_size +
+        exception_begin.size() * sizeof(unsigned int) +
+        exception.size() * sizeof(MatrixException) + delta.size();
+    if (compressed_size < dense_size) {
+      base.resize(base_size / sizeof(short), 0);
+      ofs.write(reinterpret_cast<const char*>(&kCompressedMatrixMarker),
+                sizeof(unsigned short));
+      ofs.write(reinterpret_cast<const char*>(&kCompressedMatrixMarker),
+                sizeof(unsigned short));
+      ofs.write(reinterpret_cast<const char*>(&lsize), sizeof(unsigned short));
+      ofs.write(reinterpret_cast<const char*>(&rsize), sizeof(unsigned short));
+      ofs.write(reinterpret_cast<const char*>(&nexception),
+                sizeof(unsigned int));
+      if (!base.empty()) {
+        ofs.write(reinterpret_cast<const char*>(&base[0]), base_size);
+      }
+      ofs.write(reinterpret_cast<const char*>(&exception_begin[0]),
+                exception_begin.size() * sizeof(unsigned int));
+      if (!exception.empty()) {
+        ofs.write(reinterpret_cast<const char*>(&exception[0]),
+                  exception.size() * sizeof(MatrixException));
+      }
+      if (!delta.empty()) {
+        ofs.write(reinterpret_cast<const char*>(&delta[0]), delta.size());
+      }
+
+      std::cout << "compressed matrix: " << dense_size << " -> "
+                << compressed_size << " bytes, "
+                << nexception << " exceptions" << std::endl;
+      ofs.close();
+      return true;
+    }
+
+    std::cout << "compressed matrix is not smaller than the dense one ("
+              << compressed_size << " >= " << dense_size
+              << " bytes). use the dense format." << std::endl;
+  }
+
   ofs.write(reinterpret_cast<const char*>(&lsize), sizeof(unsigned short));
   ofs.write(reinterpret_cast<const char*>(&rsize), sizeof(unsigned short));
   ofs.write(reinterpret_cast<const char*>(&matrix[0]), lsize * rsize * sizeof(short));
@@ -8,6 +8,13 @@
 
 namespace MeCab {
 class Param;
+struct ContextIDProfile;
+
+// Irregular cell of the compressed matrix.
+struct MatrixException {
+  unsigned short rcAttr;
+  short          cost;
+};
 
 class Connector {
  private:
@@ -18,6 +25,16 @@ class Connector {
   unsigned short  rsize_;
   whatlog         what_;
 
+  // compressed matrix: cost = base_[lcAttr] + delta_[rcAttr + lsize_ * lcAttr]
+  // unless the delta is kEscapeDelta, in which case the cost is found in
+  // exception_[exception_begin_[lcAttr] .. exception_begin_[lcAttr + 1]).
+  const short           *base_;
+  const signed char     *delta_;
+  const unsigned int    *exception_begin_;
+  const MatrixException *exception_;
+
+  int exception_cost(unsigned short rcAttr, unsigned short lcAttr) const;
+
  public:
 
   bool open(const Param &param);
@@ -32,16 +49,27 @@ class Connector {
   void set_left_size(size_t lsize)  { lsize_ = (unsigned short)lsize; }
   void set_right_size(size_t rsize) { rsize_ = (unsigned short)rsize; }
 
+  static const signed char kEscapeDelta = -128;
+
   inline int transition_cost(unsigned short rcAttr, unsigned short lcAttr) const {
-    return matrix_[rcAttr + lsize_ * lcAttr];
+    const int pos = rcAttr + lsize_ * lcAttr;
+    if (matrix_) {
+      return matrix_[pos];
+    }
+    const signed char delta = delta_[pos];
+    if (delta != kEscapeDelta) {
+      return base_[lcAttr] + delta;
+    }
+    return exception_cost(rcAttr, lcAttr);
   }
 
   inline int cost(const Node *lNode, const Node *rNode) const {
-	int pos = lNode->rcAttr + lsize_ * rNode->lcAttr;
-    return matrix_[pos] + rNode->wcost;
+    return transition_cost(lNode->rcAttr, rNode->lcAttr) + rNode->wcost;
   }
 
-  // access to raw matrix
+  bool is_compressed() const { return matrix_ == 0 && delta_ != 0; }
+
+  // access to raw matrix. NULL if the matrix is compressed.
   short *mutable_matrix();
   const short *matrix() const;
 
@@ -52,10 +80,16 @@ class Connector {
     return (lid >= 0 && lid < rsize_ && rid >= 0 && rid < lsize_);
   }
 
-  static bool compile(const char *, const char *);
+  // Compiles matrix.def. When |map_file| is given, identical rows and
+  // columns are merged, ids are renumbered by |profile| if any, and the
+  // id map is saved to |map_file|.
+  static bool compile(const char *, const char *, bool compress = false,
+                      const char *map_file = 0,
+                      const ContextIDProfile *profile = 0);
 
   explicit Connector(macab_io_file_t *io):
-	  io_(io), handle_(0), matrix_(0), lsize_(0), rsize_(0) {}
+	  io_(io), handle_(0), matrix_(0), lsize_(0), rsize_(0),
+	  base_(0), delta_(0), exception_begin_(0), exception_(0) {}
 
   virtual ~Connector() { this->close(); }
 };
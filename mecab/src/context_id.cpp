@@ -3,9 +3,12 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <algorithm>
 #include <fstream>
+#include <memory>
 #include <unordered_map>
 #include "mecab.h"
+#include "common.h"
 #include "context_id.h"
 #include "iconv_utils.h"
 #include "utils.h"
@@ -46,6 +49,67 @@ bool build(std::map<std::string, int> *cmap,
   return true;
 }
 
+// Orders the compacted ids by descending total.
+struct DescendingTotal {
+  const std::vector<size_t> *total;
+  explicit DescendingTotal(const std::vector<size_t> *t) : total(t) {}
+  bool operator()(unsigned short a, unsigned short b) const {
+    return (*total)[a] > (*total)[b];
+  }
+};
+
+// Renumbers the compacted ids by descending frequency. Id 0 (BOS/EOS)
+// keeps its number.
+void reorder(const std::vector<size_t> &freq,
+             std::vector<unsigned short> *ids,
+             std::vector<size_t> *rep) {
+  const size_t n = rep->size();
+  if (n == 0 || freq.size() != ids->size()) {
+    return;
+  }
+
+  std::vector<size_t> total(n, 0);
+  for (size_t i = 0; i < ids->size(); ++i) {
+    total[(*ids)[i]] += freq[i];
+  }
+
+  std::vector<unsigned short> order(n);
+  for (size_t i = 0; i < n; ++i) {
+    order[i] = static_cast<unsigned short>(i);
+  }
+  std::stable_sort(order.begin() + 1, order.end(), DescendingTotal(&total));
+
+  std::vector<unsigned short> perm(n);
+  std::vector<size_t> new_rep(n);
+  for (size_t i = 0; i < n; ++i) {
+    perm[order[i]] = static_cast<unsigned short>(i);
+    new_rep[i] = (*rep)[order[i]];
+  }
+  for (size_t i = 0; i < ids->size(); ++i) {
+    (*ids)[i] = perm[(*ids)[i]];
+  }
+  rep->swap(new_rep);
+}
+
+// Counts the transitions of the best paths by compacted context id.
+class TransitionCounter : public CorpusVisitor {
+ public:
+  std::vector<size_t> lfreq;  // lcAttr
+  std::vector<size_t> rfreq;  // rcAttr
+
+  void open(const DictionaryInfo &info) {
+    lfreq.assign(info.rsize, 0);
+    rfreq.assign(info.lsize, 0);
+  }
+
+  void visit(const Node &node) {
+    if (node.next) {
+      ++rfreq[node.rcAttr];
+      ++lfreq[node.next->lcAttr];
+    }
+  }
+};
+
 bool save(const char* filename,
           std::map<std::string, int> *cmap) {
   std::ofstream ofs(WPATH(filename));
@@ -106,4 +170,177 @@ int ContextID::rid(const char *r) const {
       << "cannot find RIGHT-ID  for " << r;
   return it->second;
 }
+
+size_t walk_corpus(const char *dicdir, const char *rcfile,
+                   const char *corpus, CorpusVisitor *visitor) {
+  const char *argv[] = { "mecab", "-r", rcfile, "-d", dicdir };
+  std::unique_ptr<Model> model(createModel(5, const_cast<char **>(argv)));
+  CHECK_DIE(model.get()) << getLastError();
+  std::unique_ptr<Tagger> tagger(model->createTagger());
+  std::unique_ptr<Lattice> lattice(model->createLattice());
+  CHECK_DIE(tagger.get() && lattice.get()) << getLastError();
+
+  const DictionaryInfo *info = model->dictionary_info();
+  CHECK_DIE(info) << "no dictionary is loaded";
+  visitor->open(*info);
+
+  std::ifstream ifs(WPATH(corpus));
+  CHECK_DIE(ifs) << "no such file or directory: " << corpus;
+  std::string line;
+  size_t num = 0;
+  while (std::getline(ifs, line)) {
+    lattice->set_sentence(line.c_str());
+    if (!tagger->parse(lattice.get())) {
+      continue;
+    }
+    for (const Node *node = lattice->bos_node(); node; node = node->next) {
+      visitor->visit(*node);
+    }
+    ++num;
+  }
+  return num;
+}
+
+bool ContextIDProfile::collect(const char *dicdir, const char *rcfile,
+                               const char *corpus) {
+  TransitionCounter counter;
+  const size_t num = walk_corpus(dicdir, rcfile, corpus, &counter);
+  std::cout << "collecting context id profile ... " << num << std::endl;
+  std::vector<size_t> &lfreq = counter.lfreq;
+  std::vector<size_t> &rfreq = counter.rfreq;
+
+  // translate the ids back to the CSV id space
+  ContextIDMap idmap;
+  const std::string map_file = create_filename(dicdir, CONTEXT_ID_MAP_FILE);
+  if (file_exists(map_file.c_str()) && idmap.open(map_file.c_str())) {
+    // a compacted id is counted at its first CSV id only, so that
+    // reorder() does not multiply its count by the size of its class.
+    left.assign(idmap.right_size(), 0);
+    right.assign(idmap.left_size(), 0);
+    std::vector<bool> seen(lfreq.size(), false);
+    for (size_t i = 0; i < left.size(); ++i) {
+      const unsigned short id = idmap.lid(i);
+      if (!seen[id]) {
+        seen[id] = true;
+        left[i] = lfreq[id];
+      }
+    }
+    seen.assign(rfreq.size(), false);
+    for (size_t i = 0; i < right.size(); ++i) {
+      const unsigned short id = idmap.rid(i);
+      if (!seen[id]) {
+        seen[id] = true;
+        right[i] = rfreq[id];
+      }
+    }
+  } else {
+    left.swap(lfreq);
+    right.swap(rfreq);
+  }
+
+  return true;
+}
+
+void ContextIDMap::build(const std::vector<short> &matrix,
+                         size_t lsize, size_t rsize,
+                         std::vector<short> *compacted,
+                         const ContextIDProfile *profile) {
+  CHECK_DIE(matrix.size() == lsize * rsize) << "matrix size is invalid";
+
+  // ids are numbered in order of first appearance, which keeps
+  // BOS/EOS (id 0) at 0.
+  std::map<std::vector<short>, unsigned short> rows;
+  std::vector<size_t> row_rep;
+  lid_.resize(rsize);
+  for (size_t r = 0; r < rsize; ++r) {
+    const std::vector<short> row(matrix.begin() + lsize * r,
+                                 matrix.begin() + lsize * (r + 1));
+    std::map<std::vector<short>, unsigned short>::const_iterator it =
+        rows.find(row);
+    if (it == rows.end()) {
+      it = rows.insert(std::make_pair(
+          row, static_cast<unsigned short>(row_rep.size()))).first;
+      row_rep.push_back(r);
+    }
+    lid_[r] = it->second;
+  }
+
+  std::map<std::vector<short>, unsigned short> columns;
+  std::vector<size_t> column_rep;
+  rid_.resize(lsize);
+  for (size_t l = 0; l < lsize; ++l) {
+    std::vector<short> column(row_rep.size());
+    for (size_t i = 0; i < row_rep.size(); ++i) {
+      column[i] = matrix[l + lsize * row_rep[i]];
+    }
+    std::map<std::vector<short>, unsigned short>::const_iterator it =
+        columns.find(column);
+    if (it == columns.end()) {
+      it = columns.insert(std::make_pair(
+          column, static_cast<unsigned short>(column_rep.size()))).first;
+      column_rep.push_back(l);
+    }
+    rid_[l] = it->second;
+  }
+
+  if (profile) {
+    reorder(profile->left, &lid_, &row_rep);
+    reorder(profile->right, &rid_, &column_rep);
+  }
+
+  compact_lsize_ = static_cast<unsigned short>(column_rep.size());
+  compact_rsize_ = static_cast<unsigned short>(row_rep.size());
+  compacted->resize(column_rep.size() * row_rep.size());
+  for (size_t r = 0; r < row_rep.size(); ++r) {
+    for (size_t l = 0; l < column_rep.size(); ++l) {
+      (*compacted)[l + compact_lsize_ * r] =
+          matrix[column_rep[l] + lsize * row_rep[r]];
+    }
+  }
+}
+
+bool ContextIDMap::open(const char *filename) {
+  std::ifstream ifs(WPATH(filename), std::ios::binary|std::ios::in);
+  CHECK_DIE(ifs) << "no such file or directory: " << filename;
+  unsigned short lsize = 0;
+  unsigned short rsize = 0;
+  ifs.read(reinterpret_cast<char *>(&lsize), sizeof(unsigned short));
+  ifs.read(reinterpret_cast<char *>(&rsize), sizeof(unsigned short));
+  ifs.read(reinterpret_cast<char *>(&compact_lsize_), sizeof(unsigned short));
+  ifs.read(reinterpret_cast<char *>(&compact_rsize_), sizeof(unsigned short));
+  rid_.resize(lsize);
+  lid_.resize(rsize);
+  if (lsize) {
+    ifs.read(reinterpret_cast<char *>(&rid_[0]),
+             sizeof(unsigned short) * lsize);
+  }
+  if (rsize) {
+    ifs.read(reinterpret_cast<char *>(&lid_[0]),
+             sizeof(unsigned short) * rsize);
+  }
+  CHECK_DIE(ifs) << "file is broken: " << filename;
+  return true;
+}
+
+bool ContextIDMap::save(const char *filename) const {
+  std::ofstream ofs(WPATH(filename), std::ios::binary|std::ios::out);
+  CHECK_DIE(ofs) << "permission denied: " << filename;
+  const unsigned short lsize = static_cast<unsigned short>(rid_.size());
+  const unsigned short rsize = static_cast<unsigned short>(lid_.size());
+  ofs.write(reinterpret_cast<const char *>(&lsize), sizeof(unsigned short));
+  ofs.write(reinterpret_cast<const char *>(&rsize), sizeof(unsigned short));
+  ofs.write(reinterpret_cast<const char *>(&compact_lsize_),
+            sizeof(unsigned short));
+  ofs.write(reinterpret_cast<const char *>(&compact_rsize_),
+            sizeof(unsigned short));
+  if (lsize) {
+    ofs.write(reinterpret_cast<const char *>(&rid_[0]),
+              sizeof(unsigned short) * lsize);
+  }
+  if (rsize) {
+    ofs.write(reinterpret_cast<const char *>(&lid_[0]),
+              sizeof(unsigned short) * rsize);
+  }
+  return true;
+}
 }
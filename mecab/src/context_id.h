@@ -9,6 +9,7 @@
 #include <map>
 #include <string>
 #include <vector>
+#include "mecab.h"
 
 namespace MeCab {
 
@@ -46,5 +47,64 @@ class ContextID {
             rid >= 0 && rid < right_size());
   }
 };
+
+// Receives the best paths of a corpus from walk_corpus().
+class CorpusVisitor {
+ public:
+  // called once the dictionary is loaded, before the first node
+  virtual void open(const DictionaryInfo &info) {}
+  // called for every node of a best path, from BOS to EOS
+  virtual void visit(const Node &node) = 0;
+  virtual ~CorpusVisitor() {}
+};
+
+// Parses |corpus| (one sentence per line) with the dictionary in
+// |dicdir| and passes the best paths to |visitor|. Returns the number
+// of sentences parsed.
+size_t walk_corpus(const char *dicdir, const char *rcfile,
+                   const char *corpus, CorpusVisitor *visitor);
+
+// Transition frequencies per context id, in the id space of the CSVs.
+struct ContextIDProfile {
+  std::vector<size_t> left;   // lcAttr
+  std::vector<size_t> right;  // rcAttr
+
+  // Parses |corpus| (one sentence per line) with the dictionary in
+  // |dicdir| and counts the context ids on the best paths.
+  bool collect(const char *dicdir, const char *rcfile, const char *corpus);
+};
+
+// Maps the context ids of left-id.def/right-id.def onto the compacted
+// ids of matrix.bin, in which identical rows and columns of the
+// connection matrix are merged. Sizes follow Connector: lsize is the
+// number of rcAttr values and rsize the number of lcAttr values.
+class ContextIDMap {
+ private:
+  std::vector<unsigned short> lid_;  // lcAttr -> compacted lcAttr
+  std::vector<unsigned short> rid_;  // rcAttr -> compacted rcAttr
+  unsigned short              compact_lsize_;
+  unsigned short              compact_rsize_;
+
+ public:
+  // Builds the map from a dense |matrix| and stores the compacted
+  // matrix in |compacted|. With |profile|, frequent ids get small
+  // numbers so that hot transitions form a dense block of the matrix.
+  void build(const std::vector<short> &matrix,
+             size_t lsize, size_t rsize,
+             std::vector<short> *compacted,
+             const ContextIDProfile *profile = 0);
+  bool open(const char *filename);
+  bool save(const char *filename) const;
+
+  unsigned short lid(size_t lcAttr) const { return lid_[lcAttr]; }
+  unsigned short rid(size_t rcAttr) const { return rid_[rcAttr]; }
+
+  size_t left_size() const  { return rid_.size(); }
+  size_t right_size() const { return lid_.size(); }
+  size_t compact_left_size() const  { return compact_lsize_; }
+  size_t compact_right_size() const { return compact_rsize_; }
+
+  ContextIDMap(): compact_lsize_(0), compact_rsize_(0) {}
+};
 }
 #endif
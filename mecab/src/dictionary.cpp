@@ -3,8 +3,12 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
 #include <climits>
+#include <map>
+#include <memory>
 #include <array>
 #include "mecab.h"
 #include "common.h"
@@ -21,6 +25,7 @@
 #include "feature_index.h"
 #include "iconv_utils.h"
 #include "param.h"
+#include "thread.h"
 
 #include "writer.h"
 
@@ -28,6 +33,7 @@ namespace MeCab {
 namespace {
 
 const unsigned int DictionaryMagicID = 0xef718f77u;
+const unsigned int CSVRunMagicID = 0x6e757243u;
 
 int toInt(const char *str) {
   if (!str || std::strlen(str) == 0) {
@@ -65,10 +71,183 @@ int calcCost(const std::string &w, const std::string &feature,
   return tocost(rnode.wcost, factor);
 }
 
+// Opens the context id map given by "context-id-map", or the one
+// in dicdir.
+bool open_context_id_map(const Param &param, ContextIDMap *idmap) {
+  std::string file = param.get<std::string>("context-id-map");
+  if (file.empty()) {
+    file = create_filename(param.get<std::string>("dicdir"),
+                           CONTEXT_ID_MAP_FILE);
+    if (!file_exists(file.c_str())) {
+      return false;
+    }
+  }
+  return idmap->open(file.c_str());
+}
+
 int progress_bar_darts(size_t current, size_t total) {
   return progress_bar("emitting double-array", current, total);
 }
 
+// Interns each CSV column of the features into its own string table.
+// Identical features share a row of column ids.
+class ColumnTableBuilder {
+ public:
+  unsigned int add(const std::string &feature) {
+    std::map<std::string, unsigned int>::const_iterator it =
+        row_.find(feature);
+    if (it != row_.end()) {
+      return it->second;
+    }
+
+    std::array<char, BUF_SIZE> buf;
+    std::array<char *, 64> col;
+    std::strncpy(buf.data(), feature.c_str(), buf.size() - 1);
+    buf.back() = '\0';
+    const size_t n = tokenizeCSV(buf.data(), col.data(), col.size());
+    if (table_.size() < n) {
+      table_.resize(n);
+    }
+
+    std::vector<unsigned int> ids(n);
+    for (size_t i = 0; i < n; ++i) {
+      const unsigned int id = static_cast<unsigned int>(table_[i].size());
+      ids[i] = table_[i].insert(std::make_pair(std::string(col[i]),
+                                               id)).first->second;
+    }
+
+    const unsigned int row = static_cast<unsigned int>(rows_.size());
+    rows_.push_back(ids);
+    row_.insert(std::make_pair(feature, row));
+    return row;
+  }
+
+  // layout: ncolumn, nrow, table[ncolumn + 1], offset[table[ncolumn]],
+  //         id[nrow * ncolumn], strings
+  void write(std::string *output) const {
+    const unsigned int ncolumn = static_cast<unsigned int>(table_.size());
+    const unsigned int nrow = static_cast<unsigned int>(rows_.size());
+    std::vector<unsigned int> table(1, 0);
+    std::vector<unsigned int> offset;
+    std::vector<std::vector<unsigned int> > remap(ncolumn);
+    std::map<std::string, unsigned int> pool;
+    std::string strings;
+
+    // renumber the ids in lexicographical order
+    for (size_t i = 0; i < ncolumn; ++i) {
+      remap[i].resize(table_[i].size());
+      unsigned int id = 0;
+      for (std::map<std::string, unsigned int>::const_iterator it =
+               table_[i].begin(); it != table_[i].end(); ++it) {
+        remap[i][it->second] = id++;
+        std::map<std::string, unsigned int>::const_iterator p =
+            pool.find(it->first);
+        if (p == pool.end()) {
+          p = pool.insert(std::make_pair(
+              it->first, static_cast<unsigned int>(strings.size()))).first;
+          strings.append(it->first.c_str(), it->first.size() + 1);
+        }
+        offset.push_back(p->second);
+      }
+      table.push_back(static_cast<unsigned int>(offset.size()));
+    }
+
+    output->clear();
+    output->append(reinterpret_cast<const char *>(&ncolumn),
+                   sizeof(unsigned int));
+    output->append(reinterpret_cast<const char *>(&nrow),
+                   sizeof(unsigned int));
+    output->append(reinterpret_cast<const char *>(&table[0]),
+                   sizeof(unsigned int) * table.size());
+    if (!offset.empty()) {
+      output->append(reinterpret_cast<const char *>(&offset[0]),
+                     sizeof(unsigned int) * offset.size());
+    }
+    for (size_t r = 0; r < rows_.size(); ++r) {
+      for (size_t i = 0; i < ncolumn; ++i) {
+        const unsigned int id = i < rows_[r].size() ?
+            remap[i][rows_[r][i]] : kNoColumn;
+        output->append(reinterpret_cast<const char *>(&id),
+                       sizeof(unsigned int));
+      }
+    }
+    output->append(strings);
+  }
+
+ private:
+  std::map<std::string, unsigned int> row_;
+  std::vector<std::map<std::string, unsigned int> > table_;
+  std::vector<std::vector<unsigned int> > rows_;
+};
+
+// Counts the known words of the best paths by surface.
+class TokenCounter : public CorpusVisitor {
+ public:
+  explicit TokenCounter(Dictionary::TokenProfile *profile)
+      : profile_(profile) {}
+
+  void visit(const Node &node) {
+    if (node.stat == MECAB_NOR_NODE) {
+      ++(*profile_)[std::string(node.surface, node.length)];
+    }
+  }
+
+ private:
+  Dictionary::TokenProfile *profile_;
+};
+
+// Reorders the token groups (tokens sharing a surface) by descending
+// frequency in |profile| and updates the double-array values |val|.
+// Feature strings are re-emitted in the same order so that the hot
+// tokens and their features occupy a contiguous prefix. Returns the
+// number of hot tokens.
+size_t hot_token_layout(const Dictionary::TokenProfile &profile,
+                      const std::vector<std::pair<std::string, Token*> > &dic,
+                      std::vector<Darts::DoubleArray::result_type> *val,
+                      std::vector<Token *> *tokens,
+                      std::string *fbuf, bool wakati) {
+  std::vector<size_t> freq(val->size(), 0);
+  std::vector<size_t> order(val->size());
+  for (size_t i = 0; i < val->size(); ++i) {
+    Dictionary::TokenProfile::const_iterator it =
+        profile.find(dic[(*val)[i] >> 8].first);
+    if (it != profile.end()) {
+      freq[i] = it->second;
+    }
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&freq](size_t a, size_t b) { return freq[a] > freq[b]; });
+
+  tokens->clear();
+  size_t hot = 0;
+  for (size_t i = 0; i < order.size(); ++i) {
+    const size_t begin = (*val)[order[i]] >> 8;
+    const size_t size = (*val)[order[i]] & 0xff;
+    (*val)[order[i]] = static_cast<Darts::DoubleArray::result_type>(
+        size + (tokens->size() << 8));
+    for (size_t j = begin; j < begin + size; ++j) {
+      tokens->push_back(dic[j].second);
+    }
+    if (freq[order[i]] > 0) {
+      hot = tokens->size();
+    }
+  }
+
+  if (!wakati) {
+    std::string buf;
+    buf.reserve(fbuf->size());
+    for (size_t i = 0; i < tokens->size(); ++i) {
+      const char *feature = fbuf->data() + (*tokens)[i]->feature;
+      (*tokens)[i]->feature = static_cast<unsigned int>(buf.size());
+      buf.append(feature, std::strlen(feature) + 1);
+    }
+    fbuf->swap(buf);
+  }
+
+  return hot;
+}
+
 template <typename T1, typename T2>
 struct pair_1st_cmp: public std::binary_function<bool, T1, T2> {
   bool operator()(const std::pair<T1, T2> &x1,
@@ -76,6 +255,331 @@ struct pair_1st_cmp: public std::binary_function<bool, T1, T2> {
     return x1.first < x2.first;
   }
 };
+
+// std::stable_sort on several threads. The chunks are sorted in
+// parallel and then merged pairwise in order, which keeps equal
+// elements in their input order just as std::stable_sort does.
+template <class T, class Cmp>
+class SortJob {
+ public:
+  SortJob(std::vector<T> *v, size_t chunk)
+      : v_(v), chunk_(chunk), width_(0) {}
+
+  void sort(size_t thread_num) {
+    run_jobs(this, thread_num);
+    for (width_ = chunk_; width_ < v_->size(); width_ *= 2) {
+      run_jobs(this, thread_num);
+    }
+  }
+
+  void run(size_t id, size_t size) {
+    if (width_ == 0) {
+      for (size_t b = id * chunk_; b < v_->size(); b += size * chunk_) {
+        std::stable_sort(v_->begin() + b,
+                         v_->begin() + std::min(b + chunk_, v_->size()),
+                         Cmp());
+      }
+      return;
+    }
+    for (size_t b = id * 2 * width_; b + width_ < v_->size();
+         b += size * 2 * width_) {
+      std::inplace_merge(v_->begin() + b,
+                         v_->begin() + b + width_,
+                         v_->begin() + std::min(b + 2 * width_, v_->size()),
+                         Cmp());
+    }
+  }
+
+ private:
+  std::vector<T> *v_;
+  size_t chunk_;
+  size_t width_;
+};
+
+template <class T, class Cmp>
+void parallel_stable_sort(std::vector<T> *v, size_t thread_num) {
+  if (thread_num <= 1) {
+    std::stable_sort(v->begin(), v->end(), Cmp());
+    return;
+  }
+  SortJob<T, Cmp> job(v, std::max<size_t>(1, (v->size() + thread_num - 1) /
+                                          thread_num));
+  job.sort(thread_num);
+}
+
+// Merges the sorted ranges [bound[i], bound[i+1]) of |v| pairwise, the
+// left range first, which is the same as a stable sort of the whole.
+template <class T, class Cmp>
+void merge_runs(std::vector<T> *v, std::vector<size_t> bound) {
+  while (bound.size() > 2) {
+    std::vector<size_t> next;
+    for (size_t i = 0; i + 2 < bound.size(); i += 2) {
+      next.push_back(bound[i]);
+      std::inplace_merge(v->begin() + bound[i],
+                         v->begin() + bound[i + 1],
+                         v->begin() + bound[i + 2],
+                         Cmp());
+    }
+    if ((bound.size() - 1) % 2 == 1) {
+      next.push_back(bound[bound.size() - 2]);
+    }
+    next.push_back(bound.back());
+    bound.swap(next);
+  }
+}
+
+// A line of a CSV dictionary with the fields parsed by CSVReader.
+struct CSVRecord {
+  std::string line;
+  std::string w;
+  std::string feature;
+  size_t size;       // number of columns
+  int lid;
+  int rid;
+  int cost;
+  int pid;
+  bool converted;    // w and feature have been converted by iconv
+  bool w_ok;
+  bool feature_ok;
+};
+
+// Reads CSV lines in blocks and parses each block on the threads. The
+// columns are split and the POS id is assigned. The surface and feature
+// are also converted by iconv unless the cost or the context ids have
+// to be computed from them first. The records come out in input order.
+class CSVReader {
+ public:
+  CSVReader(std::istream *is, const POSIDGenerator *posid,
+            std::vector<std::shared_ptr<Iconv> > *iconv, int type)
+      : is_(is), posid_(posid), iconv_(iconv), type_(type),
+        size_(0), index_(0), eof_(false) {}
+
+  CSVRecord *next() {
+    if (index_ == size_) {
+      if (eof_) {
+        return 0;
+      }
+      fill();
+      if (size_ == 0) {
+        return 0;
+      }
+    }
+    return &record_[index_++];
+  }
+
+  void run(size_t id, size_t size) {
+    Iconv *iconv = (*iconv_)[id].get();
+    for (size_t i = id; i < size_; i += size) {
+      CSVRecord *r = &record_[i];
+      char *col[8];
+      r->converted = false;
+      r->size = tokenizeCSV(&r->line[0], col, 5);
+      if (r->size != 5) {
+        continue;
+      }
+      r->w = col[0];
+      r->lid = toInt(col[1]);
+      r->rid = toInt(col[2]);
+      r->cost = toInt(col[3]);
+      r->feature = col[4];
+      r->pid = posid_->id(r->feature.c_str());
+      if (r->cost != INT_MAX && !r->w.empty() &&
+          r->lid >= 0 && r->rid >= 0 &&
+          r->lid != INT_MAX && r->rid != INT_MAX) {
+        r->feature_ok = iconv->convert(&r->feature);
+        r->w_ok = type_ == MECAB_UNK_DIC || iconv->convert(&r->w);
+        r->converted = true;
+      }
+    }
+  }
+
+ private:
+  std::istream *is_;
+  const POSIDGenerator *posid_;
+  std::vector<std::shared_ptr<Iconv> > *iconv_;
+  int type_;
+  std::vector<CSVRecord> record_;  // reused over the blocks
+  size_t size_;
+  size_t index_;
+  bool eof_;
+
+  void fill() {
+    const size_t block = 4096 * iconv_->size();
+    std::array<char, BUF_SIZE> line;
+    if (record_.size() < block) {
+      record_.resize(block);
+    }
+    size_ = index_ = 0;
+    while (size_ < block) {
+      if (!is_->getline(line.data(), line.size())) {
+        eof_ = true;
+        break;
+      }
+      record_[size_++].line = line.data();
+    }
+    run_jobs(this, iconv_->size());
+  }
+};
+
+// An entry of a CSV after its cost and context ids are assigned and its
+// feature is converted, i.e. what goes to the token table.
+struct CSVEntry {
+  std::string w;
+  std::string feature;
+  int lid;
+  int rid;
+  int cost;
+  int pid;
+};
+
+// The entries of one CSV in input order. |order| lists them stably
+// sorted by surface.
+struct CSVRun {
+  std::vector<CSVEntry> entry;
+  std::vector<unsigned int> order;
+
+  void sort() {
+    order.resize(entry.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = static_cast<unsigned int>(i);
+    }
+    std::stable_sort(order.begin(), order.end(), surface_less(&entry));
+  }
+
+ private:
+  struct surface_less {
+    const std::vector<CSVEntry> *entry;
+    explicit surface_less(const std::vector<CSVEntry> *e) : entry(e) {}
+    bool operator()(unsigned int x, unsigned int y) const {
+      return (*entry)[x].w < (*entry)[y].w;
+    }
+  };
+};
+
+template <class T>
+void write_value(std::ostream *os, const T &value) {
+  os->write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T>
+bool read_value(std::istream *is, T *value) {
+  return !!is->read(reinterpret_cast<char *>(value), sizeof(T));
+}
+
+void write_string(std::ostream *os, const std::string &str) {
+  write_value(os, static_cast<unsigned int>(str.size()));
+  os->write(str.data(), str.size());
+}
+
+bool read_string(std::istream *is, std::string *str) {
+  unsigned int size = 0;
+  if (!read_value(is, &size)) {
+    return false;
+  }
+  str->resize(size);
+  return size == 0 || !!is->read(&(*str)[0], size);
+}
+
+// The runs of the last build, kept in |output|.runs by --incremental.
+// A run is reused while its CSV hashes the same and the configuration
+// the file was written with is unchanged. The runs of this build are
+// written to a temporary file which replaces the old one on commit().
+class CSVRunCache {
+ public:
+  CSVRunCache(const std::string &filename, uint64_t config)
+      : filename_(filename) {
+    ifs_.open(WPATH(filename_.c_str()), std::ios::binary|std::ios::in);
+    unsigned int magic = 0;
+    uint64_t old_config = 0;
+    if (ifs_ && read_value(&ifs_, &magic) && read_value(&ifs_, &old_config) &&
+        magic == CSVRunMagicID && old_config == config) {
+      std::string name;
+      uint64_t hash = 0;
+      uint64_t size = 0;
+      while (read_string(&ifs_, &name) && read_value(&ifs_, &hash) &&
+             read_value(&ifs_, &size)) {
+        index_[name] = std::make_pair(hash, ifs_.tellg());
+        ifs_.seekg(static_cast<std::streamoff>(size), std::ios::cur);
+      }
+      ifs_.clear();
+    }
+
+    const std::string tmp = filename_ + ".tmp";
+    ofs_.open(WPATH(tmp.c_str()), std::ios::binary|std::ios::out);
+    CHECK_DIE(ofs_) << "permission denied: " << tmp;
+    write_value(&ofs_, CSVRunMagicID);
+    write_value(&ofs_, config);
+  }
+
+  bool find(const std::string &name, uint64_t hash, CSVRun *run) {
+    std::map<std::string,
+             std::pair<uint64_t, std::streampos> >::const_iterator it =
+        index_.find(name);
+    if (it == index_.end() || it->second.first != hash) {
+      return false;
+    }
+    ifs_.clear();
+    ifs_.seekg(it->second.second);
+    unsigned int size = 0;
+    bool ok = read_value(&ifs_, &size);
+    run->entry.resize(ok ? size : 0);
+    run->order.resize(ok ? size : 0);
+    for (size_t i = 0; ok && i < size; ++i) {
+      CSVEntry *e = &run->entry[i];
+      ok = read_value(&ifs_, &e->lid) && read_value(&ifs_, &e->rid) &&
+          read_value(&ifs_, &e->cost) && read_value(&ifs_, &e->pid) &&
+          read_string(&ifs_, &e->w) && read_string(&ifs_, &e->feature);
+    }
+    for (size_t i = 0; ok && i < size; ++i) {
+      ok = read_value(&ifs_, &run->order[i]);
+    }
+    if (!ok) {  // a broken cache is read as the CSV again
+      run->entry.clear();
+      run->order.clear();
+    }
+    return ok;
+  }
+
+  void write(const std::string &name, uint64_t hash, const CSVRun &run) {
+    std::ostringstream body;
+    write_value(&body, static_cast<unsigned int>(run.entry.size()));
+    for (size_t i = 0; i < run.entry.size(); ++i) {
+      const CSVEntry &e = run.entry[i];
+      write_value(&body, e.lid);
+      write_value(&body, e.rid);
+      write_value(&body, e.cost);
+      write_value(&body, e.pid);
+      write_string(&body, e.w);
+      write_string(&body, e.feature);
+    }
+    for (size_t i = 0; i < run.order.size(); ++i) {
+      write_value(&body, run.order[i]);
+    }
+    const std::string str = body.str();
+    write_string(&ofs_, name);
+    write_value(&ofs_, hash);
+    write_value(&ofs_, static_cast<uint64_t>(str.size()));
+    ofs_.write(str.data(), str.size());
+  }
+
+  bool commit() {
+    const std::string tmp = filename_ + ".tmp";
+    ofs_.close();
+    ifs_.close();
+    CHECK_DIE(ofs_) << "cannot write: " << tmp;
+    std::remove(filename_.c_str());
+    CHECK_DIE(std::rename(tmp.c_str(), filename_.c_str()) == 0)
+        << "cannot rename " << tmp << " to " << filename_;
+    return true;
+  }
+
+ private:
+  std::string filename_;
+  std::ifstream ifs_;
+  std::ofstream ofs_;
+  // name -> (hash of the CSV, offset of the entries)
+  std::map<std::string, std::pair<uint64_t, std::streampos> > index_;
+};
 }  // namespace
 
 bool Dictionary::open(const char *file, const char *mode) {
@@ -92,7 +596,7 @@ bool Dictionary::open(const char *file, const char *mode) {
   unsigned int tsize;
   unsigned int fsize;
   unsigned int magic;
-  unsigned int dummy;
+  unsigned int csize;
   
   ptr->read(&magic, sizeof(unsigned int));
   CHECK_FALSE((magic ^ DictionaryMagicID) == length) << "dictionary file is broken: " << file;
@@ -107,9 +611,10 @@ bool Dictionary::open(const char *file, const char *mode) {
   ptr->read(&dsize, sizeof(unsigned int));
   ptr->read(&tsize, sizeof(unsigned int));
   ptr->read(&fsize, sizeof(unsigned int));
-  ptr->read(&dummy, sizeof(unsigned int));
+  ptr->read(&csize, sizeof(unsigned int));
   ptr->read((void*)charset_, 32);
-  da_.set_array(reinterpret_cast<void *>(ptr->data(dsize)));
+  da_.set_array(reinterpret_cast<void *>(ptr->data(dsize)),
+                dsize / da_.unit_size());
   *ptr += dsize;
 
   token_ = ptr->clone();
@@ -118,6 +623,25 @@ bool Dictionary::open(const char *file, const char *mode) {
   feature_ = ptr->clone();
   *ptr += fsize;
 
+  column_size_ = 0;
+  column_table_.assign(1, 0);
+  if (csize > 0) {
+    unsigned int *header = nullptr;
+    ptr->read(0, (void**)&header, sizeof(unsigned int) * 2);
+    column_size_ = header[0];
+    const unsigned int rows = header[1];
+    *ptr += sizeof(unsigned int) * 2;
+    unsigned int *table = nullptr;
+    ptr->read(0, (void**)&table, sizeof(unsigned int) * (column_size_ + 1));
+    column_table_.assign(table, table + column_size_ + 1);
+    *ptr += sizeof(unsigned int) * (column_size_ + 1);
+    column_offsets_ = ptr->clone();
+    *ptr += sizeof(unsigned int) * column_table_.back();
+    column_ids_ = ptr->clone();
+    *ptr += sizeof(unsigned int) * rows * column_size_;
+    column_strings_ = ptr->clone();
+  }
+
   return true;
 }
 
@@ -174,6 +698,13 @@ bool Dictionary::assignUserDictionaryCosts(
     matrix.set_right_size(1);
   }
 
+  // ids in the CSVs are not compacted
+  ContextIDMap idmap;
+  if (open_context_id_map(param, &idmap)) {
+    matrix.set_left_size(idmap.left_size());
+    matrix.set_right_size(idmap.right_size());
+  }
+
   cid.open(left_id_file.c_str(),
            right_id_file.c_str(), &config_iconv);
   CHECK_DIE(cid.left_size()  == matrix.left_size() &&
@@ -222,6 +753,8 @@ Dictionary::Dictionary(macab_io_file_t *io)
 	, handle_(0)
 	, token_(0)
 	, feature_(0)
+	, column_table_(1, 0)
+	, column_size_(0)
 	, charset_{ 0 }
 {}
 
@@ -230,6 +763,18 @@ Dictionary::~Dictionary()
 	this->close();
 }
 
+bool Dictionary::collectTokenProfile(const char *dicdir,
+                                     const char *rcfile,
+                                     const char *corpus,
+                                     TokenProfile *profile) {
+  profile->clear();
+  TokenCounter counter(profile);
+  const size_t num = walk_corpus(dicdir, rcfile, corpus, &counter);
+  std::cout << "collecting token profile ... " << num << std::endl;
+
+  return true;
+}
+
 const Token *Dictionary::token(const result_type &n) const
 {
 	int offset = sizeof(Token) * (n.value >> 8);
@@ -245,9 +790,61 @@ const char *Dictionary::feature(const Token &t) const
 	return str;
 }
 
+unsigned int Dictionary::column_id(const Token &t, size_t i) const {
+  if (i >= column_size_) {
+    return kNoColumn;
+  }
+  unsigned int *id = nullptr;
+  column_ids_->read(
+      static_cast<int>(sizeof(unsigned int) * (t.compound * column_size_ + i)),
+      (void**)&id, sizeof(unsigned int));
+  return *id;
+}
+
+const char *Dictionary::column_value(size_t i, unsigned int id) const {
+  if (i >= column_size_ || id >= column_table_size(i)) {
+    return nullptr;
+  }
+  unsigned int *offset = nullptr;
+  column_offsets_->read(
+      static_cast<int>(sizeof(unsigned int) * (column_table_[i] + id)),
+      (void**)&offset, sizeof(unsigned int));
+  char *str = nullptr;
+  column_strings_->read(*offset, &str);
+  return str;
+}
+
+const char *Dictionary::column(const Token &t, size_t i) const {
+  return column_value(i, column_id(t, i));
+}
+
+unsigned int Dictionary::find_column_id(size_t i, const char *value) const {
+  if (i >= column_size_) {
+    return kNoColumn;
+  }
+  // per-column tables are sorted at compile time
+  size_t lo = 0;
+  size_t hi = column_table_size(i);
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    const int r = std::strcmp(column_value(i, static_cast<unsigned int>(mid)),
+                              value);
+    if (r == 0) {
+      return static_cast<unsigned int>(mid);
+    } else if (r < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return kNoColumn;
+}
+
 bool Dictionary::compile(const Param &param,
                          const std::vector<std::string> &dics,
-                         const char *output) {
+                         const char *output,
+                         const TokenProfile *profile,
+                         size_t *hot_size) {
   Connector matrix(mecab_default_io());
   std::shared_ptr<DictionaryRewriter> rewrite;
   std::shared_ptr<POSIDGenerator> posid;
@@ -257,6 +854,7 @@ bool Dictionary::compile(const Param &param,
   std::shared_ptr<Lattice> lattice;
   std::shared_ptr<StringBuffer> os;
   std::shared_ptr<CharProperty> property;
+  std::shared_ptr<ColumnTableBuilder> columns;
   Node node;
 
   const std::string dicdir = param.get<std::string>("dicdir");
@@ -269,6 +867,7 @@ bool Dictionary::compile(const Param &param,
   const std::string pos_id_file     = DCONF(POS_ID_FILE);
 
   std::vector<std::pair<std::string, Token*> > dic;
+  FreeList<Token> token_freelist(8192);
 
   size_t offset  = 0;
   unsigned int lexsize = 0;
@@ -277,10 +876,13 @@ bool Dictionary::compile(const Param &param,
   const std::string from = param.get<std::string>("dictionary-charset");
   const std::string to = param.get<std::string>("charset");
   const bool wakati = param.get<bool>("wakati");
+  const bool columnar = param.get<bool>("columnar");
   const int type = param.get<int>("type");
   const std::string node_format = param.get<std::string>("node-format");
   const int factor = param.get<int>("cost-factor");
+  const size_t thread_num = std::max<size_t>(1, param.get<size_t>("thread"));
   CHECK_DIE(factor > 0)   << "cost factor needs to be positive value";
+  CHECK_DIE(thread_num <= 512) << "# thread is invalid: " << thread_num;
 
   // for backward compatibility
   std::string config_charset = param.get<std::string>("config-charset");
@@ -299,6 +901,14 @@ bool Dictionary::compile(const Param &param,
   CHECK_DIE(config_iconv.open(config_charset.c_str(), from.c_str()))
       << "iconv_open() failed with from=" << config_charset << " to=" << from;
 
+  // one converter for each thread of CSVReader
+  std::vector<std::shared_ptr<Iconv> > thread_iconv(thread_num);
+  for (size_t i = 0; i < thread_num; ++i) {
+    thread_iconv[i].reset(new Iconv);
+    CHECK_DIE(thread_iconv[i]->open(from.c_str(), to.c_str()))
+        << "iconv_open() failed with from=" << from << " to=" << to;
+  }
+
   if (!node_format.empty()) {
     writer.reset(new Writer);
     lattice.reset(createLattice());
@@ -306,21 +916,48 @@ bool Dictionary::compile(const Param &param,
     memset(&node, 0, sizeof(node));
   }
 
+  if (columnar && !wakati) {
+    columns.reset(new ColumnTableBuilder);
+  }
+
   if (!matrix.openText(matrix_file.c_str()) &&
       !matrix.open(matrix_bin_file.c_str())) {
     matrix.set_left_size(1);
     matrix.set_right_size(1);
   }
 
+  ContextIDMap idmap;
+  const bool compact = open_context_id_map(param, &idmap);
+  if (compact) {
+    matrix.set_left_size(idmap.left_size());
+    matrix.set_right_size(idmap.right_size());
+  }
+
   posid.reset(new POSIDGenerator);
   posid->open(pos_id_file.c_str(), &config_iconv);
 
   std::istringstream iss(UNK_DEF_DEFAULT);
+  std::istringstream none;
+
+  std::shared_ptr<CSVRunCache> runs;
+  std::vector<size_t> run_bound(1, 0);
+  if (param.get<bool>("incremental")) {
+    runs.reset(new CSVRunCache(std::string(output) + ".runs",
+                               inputHash(param,
+                                         std::vector<std::string>())));
+  }
 
   for (size_t i = 0; i < dics.size(); ++i) {
+    CSVRun run;
+    const uint64_t hash =
+        runs.get() ? BuildCache::hashFile(dics[i].c_str()) : 0;
+    const bool cached = runs.get() && runs->find(dics[i], hash, &run);
+
     std::ifstream ifs(WPATH(dics[i].c_str()));
     std::istream *is = &ifs;
-    if (!ifs) {
+    if (cached) {
+      is = &none;  // the entries come from the cache
+    } else if (!ifs) {
       if (type == MECAB_UNK_DIC) {
         std::cerr << dics[i]
                   << " is not found. minimum setting is used." << std::endl;
@@ -330,22 +967,20 @@ bool Dictionary::compile(const Param &param,
       }
     }
 
-    std::cout << "reading " << dics[i] << " ... ";
+    std::cout << "reading " << dics[i] << (cached ? " (cached)" : "")
+              << " ... ";
 
-    std::array<char, BUF_SIZE> line;
-    size_t num = 0;
+    CSVReader reader(is, posid.get(), &thread_iconv, type);
 
-    while (is->getline(line.data(), line.size())) {
-      char *col[8];
-      const size_t n = tokenizeCSV(line.data(), col, 5);
-      CHECK_DIE(n == 5) << "format error: " << line.data();
+    while (CSVRecord *r = reader.next()) {
+      CHECK_DIE(r->size == 5) << "format error: " << r->line.c_str();
 
-      std::string w = col[0];
-      int lid = toInt(col[1]);
-      int rid = toInt(col[2]);
-      int cost = toInt(col[3]);
-      std::string feature = col[4];
-      const int pid = posid->id(feature.c_str());
+      std::string &w = r->w;
+      int lid = r->lid;
+      int rid = r->rid;
+      int cost = r->cost;
+      std::string &feature = r->feature;
+      const int pid = r->pid;
 
       if (cost == INT_MAX) {
         CHECK_DIE(type == MECAB_USR_DIC)
@@ -392,18 +1027,29 @@ bool Dictionary::compile(const Param &param,
       CHECK_DIE(lid >= 0 && rid >= 0 && matrix.is_valid(lid, rid))
           << "invalid ids are found lid=" << lid << " rid=" << rid;
 
+      if (compact) {
+        lid = idmap.lid(lid);
+        rid = idmap.rid(rid);
+      }
+
       if (w.empty()) {
         std::cerr << "empty word is found, discard this line" << std::endl;
         continue;
       }
 
-      if (!iconv.convert(&feature)) {
+      if (!r->converted) {
+        r->feature_ok = iconv.convert(&feature);
+        r->w_ok = r->feature_ok &&
+            (type == MECAB_UNK_DIC || iconv.convert(&w));
+      }
+
+      if (!r->feature_ok) {
         std::cerr << "iconv conversion failed. skip this entry"
                   << std::endl;
         continue;
       }
 
-      if (type != MECAB_UNK_DIC && !iconv.convert(&w)) {
+      if (!r->w_ok) {
         std::cerr << "iconv conversion failed. skip this entry"
                   << std::endl;
         continue;
@@ -428,19 +1074,32 @@ bool Dictionary::compile(const Param &param,
         feature = os->str();
       }
 
+      run.entry.push_back(CSVEntry());
+      CSVEntry *e = &run.entry.back();
+      e->w.swap(w);
+      e->feature.swap(feature);
+      e->lid = lid;
+      e->rid = rid;
+      e->cost = cost;
+      e->pid = pid;
+    }
+
+    const size_t begin = dic.size();
+    for (size_t j = 0; j < run.entry.size(); ++j) {
+      const CSVEntry &e = run.entry[j];
       std::string key;
       if (!wakati) {
-        key = feature + '\0';
+        key = e.feature + '\0';
       }
 
-      Token* token  = new Token;
-      token->lcAttr = lid;
-      token->rcAttr = rid;
-      token->posid  = pid;
-      token->wcost = cost;
+      Token* token  = token_freelist.alloc();
+      token->lcAttr = e.lid;
+      token->rcAttr = e.rid;
+      token->posid  = e.pid;
+      token->wcost = e.cost;
       token->feature = (unsigned int)offset;
-      token->compound = 0;
-      dic.push_back(std::pair<std::string, Token*>(w, token));
+      token->compound = columns.get() ? columns->add(e.feature) : 0;
+      dic.push_back(std::pair<std::string, Token*>(e.w, token));
 
       // append to output buffer
       if (!wakati) {
@@ -448,19 +1107,43 @@ bool Dictionary::compile(const Param &param,
       }
       offset += key.size();
 
-      ++num;
       ++lexsize;
     }
 
-    std::cout << num << std::endl;
+    // with the cache, each CSV is kept sorted and merged with the others
+    // after reading instead of sorting everything at once
+    if (runs.get()) {
+      if (!cached) {
+        run.sort();
+      }
+      runs->write(dics[i], hash, run);
+      std::vector<std::pair<std::string, Token *> > sorted(run.order.size());
+      for (size_t j = 0; j < run.order.size(); ++j) {
+        sorted[j].first.swap(dic[begin + run.order[j]].first);
+        sorted[j].second = dic[begin + run.order[j]].second;
+      }
+      for (size_t j = 0; j < sorted.size(); ++j) {
+        dic[begin + j].first.swap(sorted[j].first);
+        dic[begin + j].second = sorted[j].second;
+      }
+      run_bound.push_back(dic.size());
+    }
+
+    std::cout << run.entry.size() << std::endl;
   }
 
   if (wakati) {
     fbuf.append("\0", 1);
   }
 
-  std::stable_sort(dic.begin(), dic.end(),
-                   pair_1st_cmp<std::string, Token *>());
+  if (runs.get()) {
+    merge_runs<std::pair<std::string, Token *>,
+               pair_1st_cmp<std::string, Token *> >(&dic, run_bound);
+  } else {
+    parallel_stable_sort<std::pair<std::string, Token *>,
+                         pair_1st_cmp<std::string, Token *> >(&dic,
+                                                              thread_num);
+  }
 
   size_t bsize = 0;
   size_t idx = 0;
@@ -488,32 +1171,50 @@ bool Dictionary::compile(const Param &param,
   CHECK_DIE(str.size() == len.size());
   CHECK_DIE(str.size() == val.size());
 
+  std::vector<Token *> tokens;
+  if (hot_size) {
+    *hot_size = 0;
+  }
+  if (profile && !profile->empty()) {
+    const size_t hot =
+        hot_token_layout(*profile, dic, &val, &tokens, &fbuf, wakati);
+    if (hot_size) {
+      *hot_size = hot;
+    }
+  } else {
+    for (size_t i = 0; i < dic.size(); ++i) {
+      tokens.push_back(dic[i].second);
+    }
+  }
+
   Darts::DoubleArray da;
   CHECK_DIE(da.build(str.size(), const_cast<char **>(&str[0]),
                      &len[0], &val[0], &progress_bar_darts) == 0)
       << "unknown error in building double-array";
 
-  std::string tbuf;
-  for (size_t i = 0; i < dic.size(); ++i) {
-    tbuf.append(reinterpret_cast<const char*>(dic[i].second),
-                sizeof(Token));
-    delete dic[i].second;
+  // the tokens are written straight from |tokens|, padded with dummy
+  // tokens to be 8byte(64bit) aligned
+  size_t padding = 0;
+  while ((tokens.size() + padding) * sizeof(Token) % 8 != 0) {
+    ++padding;
   }
-  dic.clear();
 
-  // needs to be 8byte(64bit) aligned
-  while (tbuf.size() % 8 != 0) {
-    Token dummy;
-    memset(&dummy, 0, sizeof(Token));
-    tbuf.append(reinterpret_cast<const char*>(&dummy), sizeof(Token));
+  std::string cbuf;
+  if (columns.get()) {
+    while (fbuf.size() % 8 != 0) {
+      fbuf.push_back('\0');
+    }
+    columns->write(&cbuf);
   }
 
-  unsigned int dummy = 0;
-  unsigned int lsize = unsigned int(matrix.left_size());
-  unsigned int rsize = unsigned int(matrix.right_size());
+  unsigned int lsize = unsigned int(compact ? idmap.compact_left_size() :
+                                    matrix.left_size());
+  unsigned int rsize = unsigned int(compact ? idmap.compact_right_size() :
+                                    matrix.right_size());
   unsigned int dsize = unsigned int(da.unit_size() * da.size());
-  unsigned int tsize = unsigned int(tbuf.size());
+  unsigned int tsize = unsigned int((tokens.size() + padding) * sizeof(Token));
   unsigned int fsize = unsigned int(fbuf.size());
+  unsigned int csize = unsigned int(cbuf.size());
 
   unsigned int version = DIC_VERSION;
   char charset[32];
@@ -536,15 +1237,23 @@ bool Dictionary::compile(const Param &param,
   bofs.write(reinterpret_cast<const char *>(&dsize),   sizeof(unsigned int));
   bofs.write(reinterpret_cast<const char *>(&tsize),   sizeof(unsigned int));
   bofs.write(reinterpret_cast<const char *>(&fsize),   sizeof(unsigned int));
-  bofs.write(reinterpret_cast<const char *>(&dummy),   sizeof(unsigned int));
+  bofs.write(reinterpret_cast<const char *>(&csize),   sizeof(unsigned int));
 
   // 32 * 8 = 64 * 4
   bofs.write(reinterpret_cast<const char *>(charset),  sizeof(charset));
 
   bofs.write(reinterpret_cast<const char*>(da.array()),
              da.unit_size() * da.size());
-  bofs.write(const_cast<const char *>(tbuf.data()), tbuf.size());
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    bofs.write(reinterpret_cast<const char*>(tokens[i]), sizeof(Token));
+  }
+  for (size_t i = 0; i < padding; ++i) {
+    Token dummy;
+    memset(&dummy, 0, sizeof(Token));
+    bofs.write(reinterpret_cast<const char*>(&dummy), sizeof(Token));
+  }
   bofs.write(const_cast<const char *>(fbuf.data()), fbuf.size());
+  bofs.write(const_cast<const char *>(cbuf.data()), cbuf.size());
 
   // save magic id
   magic = static_cast<unsigned int>(bofs.tellp());
@@ -554,6 +1263,111 @@ bool Dictionary::compile(const Param &param,
 
   bofs.close();
 
+  if (runs.get()) {
+    runs->commit();
+  }
+
   return true;
 }
+
+uint64_t Dictionary::inputHash(const Param &param,
+                               const std::vector<std::string> &dics) {
+  const std::string dicdir = param.get<std::string>("dicdir");
+  std::vector<std::string> files(dics);
+  const std::string matrix_file = create_filename(dicdir, MATRIX_DEF_FILE);
+  files.push_back(file_exists(matrix_file.c_str()) ? matrix_file :
+                  create_filename(dicdir, MATRIX_FILE));
+  files.push_back(create_filename(dicdir, LEFT_ID_FILE));
+  files.push_back(create_filename(dicdir, RIGHT_ID_FILE));
+  files.push_back(create_filename(dicdir, REWRITE_FILE));
+  files.push_back(create_filename(dicdir, POS_ID_FILE));
+  files.push_back(param.get<std::string>("context-id-map"));
+  const int type = param.get<int>("type");
+  if (type == MECAB_USR_DIC) {
+    // costs of user dictionaries can be computed with the model
+    files.push_back(create_filename(dicdir, FEATURE_FILE));
+    files.push_back(create_filename(dicdir, CHAR_PROPERTY_FILE));
+    files.push_back(param.get<std::string>("model"));
+  }
+
+  std::ostringstream options;
+  options << DIC_VERSION
+          << ' ' << type
+          << ' ' << param.get<std::string>("dictionary-charset")
+          << ' ' << param.get<std::string>("config-charset")
+          << ' ' << param.get<std::string>("charset")
+          << ' ' << param.get<bool>("wakati")
+          << ' ' << param.get<bool>("columnar")
+          << ' ' << param.get<int>("cost-factor")
+          << ' ' << param.get<std::string>("node-format");
+  return BuildCache::hash(files, options.str());
+}
+
+bool BuildCache::open(const char *filename) {
+  filename_ = filename;
+  entry_.clear();
+  std::ifstream ifs(WPATH(filename));
+  if (!ifs) {
+    return true;  // nothing is built yet
+  }
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream is(line);
+    std::string name;
+    uint64_t input = 0;
+    uint64_t output = 0;
+    if (std::getline(is, name, '\t') && is >> std::hex >> input >> output) {
+      entry_[name] = std::make_pair(input, output);
+    }
+  }
+  return true;
+}
+
+bool BuildCache::save() const {
+  std::ofstream ofs(WPATH(filename_.c_str()));
+  CHECK_DIE(ofs) << "permission denied: " << filename_;
+  for (std::map<std::string, std::pair<uint64_t, uint64_t> >::const_iterator
+           it = entry_.begin(); it != entry_.end(); ++it) {
+    ofs << it->first << '\t' << std::hex << it->second.first
+        << '\t' << it->second.second << std::endl;
+  }
+  return true;
+}
+
+bool BuildCache::isUpToDate(const char *output, uint64_t input) const {
+  std::string name = output;
+  remove_pathname(&name);
+  std::map<std::string, std::pair<uint64_t, uint64_t> >::const_iterator it =
+      entry_.find(name);
+  return it != entry_.end() && it->second.first == input &&
+      it->second.second == hashFile(output);
+}
+
+void BuildCache::update(const char *output, uint64_t input) {
+  std::string name = output;
+  remove_pathname(&name);
+  entry_[name] = std::make_pair(input, hashFile(output));
+}
+
+uint64_t BuildCache::hash(const std::vector<std::string> &files,
+                          const std::string &options) {
+  std::ostringstream os;
+  os << options << std::hex;
+  for (size_t i = 0; i < files.size(); ++i) {
+    std::string name = files[i];
+    remove_pathname(&name);
+    os << '\n' << name << '\t' << hashFile(files[i].c_str());
+  }
+  return fingerprint(os.str());
+}
+
+uint64_t BuildCache::hashFile(const char *filename) {
+  std::ifstream ifs(WPATH(filename), std::ios::binary|std::ios::in);
+  if (!filename[0] || !ifs) {
+    return 0;
+  }
+  std::ostringstream os;
+  os << ifs.rdbuf();
+  return fingerprint(os.str()) | 1;  // 0 is kept for missing files
+}
 }
@@ -6,6 +6,7 @@
 #ifndef MECAB_DICTIONARY_H_
 #define MECAB_DICTIONARY_H_
 
+#include <map>
 #include "darts.h"
 #include "char_property.h"
 
@@ -13,13 +14,15 @@ namespace MeCab {
 
 class Param;
 
+const unsigned int kNoColumn = 0xffffffffu;
+
 struct Token {
   unsigned short lcAttr;
   unsigned short rcAttr;
   unsigned short posid;
   short wcost;
   unsigned int   feature;
-  unsigned int   compound;
+  unsigned int   compound;  // row in the columnar feature store
 };
 
 class Dictionary {
@@ -35,6 +38,8 @@ class Dictionary {
     return da_.commonPrefixSearch(key, result, rlen, len);
   }
 
+  const Darts::DoubleArray &double_array() const { return da_; }
+
   result_type exactMatchSearch(const char* key) const {
     result_type n;
     da_.exactMatchSearch(key, n);
@@ -61,9 +66,42 @@ class Dictionary {
   size_t token_size(const result_type &n) const { return 0xff & n.value; }
   const char *feature(const Token &t) const;
 
+  // Columnar feature store. Available only when the dictionary was
+  // compiled with --columnar; each CSV column of the feature is interned
+  // in a sorted per-column string table and addressed by its id.
+  size_t column_size() const { return column_size_; }
+  size_t column_table_size(size_t i) const {
+    return column_table_[i + 1] - column_table_[i];
+  }
+  unsigned int column_id(const Token &t, size_t i) const;
+  const char *column(const Token &t, size_t i) const;
+  const char *column_value(size_t i, unsigned int id) const;
+  unsigned int find_column_id(size_t i, const char *value) const;
+
+  // Surface frequencies used to put hot tokens at the head of sys.dic.
+  typedef std::map<std::string, size_t> TokenProfile;
+
+  // With --incremental, the parsed entries of each CSV are cached in
+  // |output|.runs and reused while the CSV and the configuration files
+  // are unchanged. With |profile|, the number of tokens laid out as hot
+  // is stored in |hot_size|.
   static bool compile(const Param &param,
                       const std::vector<std::string> &dics,
-                      const char *output);  // outputs
+                      const char *output,  // outputs
+                      const TokenProfile *profile = 0,
+                      size_t *hot_size = 0);
+
+  // Hash of everything compile() reads to build |dics|: the CSVs, the
+  // definition files in dicdir and the options.
+  static uint64_t inputHash(const Param &param,
+                            const std::vector<std::string> &dics);
+
+  // Parses |corpus| with the dictionary in |dicdir| and counts the
+  // surfaces of the known words on the best paths.
+  static bool collectTokenProfile(const char *dicdir,
+                                  const char *rcfile,
+                                  const char *corpus,
+                                  TokenProfile *profile);
 
   static bool assignUserDictionaryCosts(
       const Param &param,
@@ -81,6 +119,11 @@ class Dictionary {
   file_handle_t        handle_;
   IMMap::Ptr			token_;
   IMMap::Ptr			feature_;
+  IMMap::Ptr          column_ids_;
+  IMMap::Ptr          column_offsets_;
+  IMMap::Ptr          column_strings_;
+  std::vector<unsigned int> column_table_;
+  unsigned int        column_size_;
   const char         charset_[32];
   unsigned int        version_;
   unsigned int        type_;
@@ -91,5 +134,30 @@ class Dictionary {
   whatlog             what_;
   Darts::DoubleArray  da_;
 };
+
+// Records which inputs each file in the output directory was built
+// from, so that mecab-dict-index --incremental can skip the files whose
+// inputs did not change. Saved as BUILD_CACHE_FILE in outdir.
+class BuildCache {
+ public:
+  bool open(const char *filename);
+  bool save() const;
+
+  // true if |output| was built from the inputs hashed to |input| and
+  // has not been modified since.
+  bool isUpToDate(const char *output, uint64_t input) const;
+  void update(const char *output, uint64_t input);
+
+  // Hash of the contents of |files| and |options|. A missing file is
+  // hashed differently from an empty one.
+  static uint64_t hash(const std::vector<std::string> &files,
+                       const std::string &options);
+  static uint64_t hashFile(const char *filename);
+
+ private:
+  std::string filename_;
+  // output name -> (input hash, output hash)
+  std::map<std::string, std::pair<uint64_t, uint64_t> > entry_;
+};
 }
 #endif  // MECAB_DICTIONARY_H_
@@ -2,6 +2,7 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <cstdio>
 #include <iostream>
 #include <map>
 #include <vector>
@@ -17,7 +18,9 @@
 #include "char_property.h"
 #include "feature_index.h"
 #include "connector.h"
+#include "context_id.h"
 #include "dictionary.h"
+#include "aho_corasick.h"
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -27,6 +30,17 @@ namespace MeCab {
 
 class DictionaryComplier {
  public:
+  // true if |output| can be kept as it is, i.e. --incremental is given
+  // and |output| was built from the same inputs.
+  static bool isUpToDate(const BuildCache &cache, bool incremental,
+                         const char *output, uint64_t input) {
+    if (!incremental || !cache.isUpToDate(output, input)) {
+      return false;
+    }
+    std::cout << output << " is up to date. skipped." << std::endl;
+    return true;
+  }
+
   static int run(int argc, char **argv) {
     static const MeCab::Option long_options[] = {
       { "dicdir",   'd',   ".",   "DIR", "set DIR as dic dir (default \".\")" },
@@ -42,6 +56,16 @@ class DictionaryComplier {
       { "build-charcategory", 'C', 0, 0,   "build character category maps" },
       { "build-sysdic",  's', 0, 0,   "build system dictionary" },
       { "build-matrix",    'm',  0,   0,   "build connection matrix" },
+      { "compress-matrix", 'z',  0,   0,
+        "build connection matrix in the compressed format" },
+      { "compact-context-id", 'k', 0, 0,
+        "merge context ids having identical matrix rows/columns" },
+      { "renumber-context-id", 'R', 0, "FILE",
+        "renumber context ids by the transitions observed on FILE "
+        "with the dictionary in outdir (implies -k)" },
+      { "hot-token-layout", 'H', 0, "FILE",
+        "put the tokens frequent on FILE at the head of sys.dic, "
+        "parsed with the dictionary in outdir" },
       { "charset",   'c',  MECAB_DEFAULT_CHARSET, "ENC",
         "make charset of binary dictionary ENC (default "
         MECAB_DEFAULT_CHARSET ")"  },
@@ -51,8 +75,18 @@ class DictionaryComplier {
         MECAB_DEFAULT_CHARSET ")"  },
       { "wakati",    'w',  0,   0,   "build wakati-gaki only dictionary", },
       { "posid",     'p',  0,   0,   "assign Part-of-speech id" },
+      { "columnar",  'l',  0,   0,
+        "store features in per-column string tables" },
+      { "aho-corasick", 'A', 0, 0,
+        "build the Aho-Corasick index of sys.dic, with which the words "
+        "of a sentence are looked up in one scan" },
       { "node-format", 'F', 0,  "STR",
         "use STR as the user defined node format" },
+      { "thread",    'j',  "1", "INT",
+        "number of threads to compile dictionaries (default 1)" },
+      { "incremental", 'I', 0,  0,
+        "rebuild only the outputs whose inputs have changed, "
+        "reusing the CSVs parsed in the last build" },
       { "version",   'v',  0,   0,   "show the version and exit."  },
       { "help",      'h',  0,   0,   "show this help and exit."  },
       { 0, 0, 0, 0 }
@@ -74,12 +108,20 @@ class DictionaryComplier {
     const std::string outdir = param.get<std::string>("outdir");
     bool opt_unknown = param.get<bool>("build-unknown");
     bool opt_matrix = param.get<bool>("build-matrix");
+    const bool opt_compress_matrix = param.get<bool>("compress-matrix");
+    bool opt_compact_context_id = param.get<bool>("compact-context-id");
+    const std::string profile_corpus =
+        param.get<std::string>("renumber-context-id");
+    const std::string token_corpus =
+        param.get<std::string>("hot-token-layout");
     bool opt_charcategory = param.get<bool>("build-charcategory");
     bool opt_sysdic = param.get<bool>("build-sysdic");
     bool opt_model = param.get<bool>("build-model");
     bool opt_assign_user_dictionary_costs = param.get<bool>
         ("assign-user-dictionary-costs");
     const std::string userdic = param.get<std::string>("userdic");
+    const bool incremental = param.get<bool>("incremental");
+    const bool opt_aho_corasick = param.get<bool>("aho-corasick");
 
 #define DCONF(file) create_filename(dicdir, std::string(file)).c_str()
 #define OCONF(file) create_filename(outdir, std::string(file)).c_str()
@@ -110,24 +152,103 @@ class DictionaryComplier {
             opt_sysdic = opt_model = true;
       }
 
+      // the profile is taken with the binaries which are rebuilt below
+      std::shared_ptr<ContextIDProfile> profile;
+      if (!profile_corpus.empty()) {
+        CHECK_DIE(opt_matrix && opt_unknown && opt_sysdic)
+            << "renumbering context ids rebuilds matrix, unk.dic and sys.dic";
+        profile.reset(new ContextIDProfile);
+        CHECK_DIE(profile->collect(outdir.c_str(), DCONF(DICRC),
+                                   profile_corpus.c_str()));
+        opt_compact_context_id = true;
+      }
+
+      std::shared_ptr<Dictionary::TokenProfile> token_profile;
+      if (!token_corpus.empty()) {
+        CHECK_DIE(opt_sysdic) << "hot token layout rebuilds sys.dic";
+        token_profile.reset(new Dictionary::TokenProfile);
+        CHECK_DIE(Dictionary::collectTokenProfile(outdir.c_str(),
+                                                  DCONF(DICRC),
+                                                  token_corpus.c_str(),
+                                                  token_profile.get()));
+      }
+
+      BuildCache cache;
+      if (incremental) {
+        CHECK_DIE(cache.open(OCONF(BUILD_CACHE_FILE)));
+      }
+
+      // the context id map must be ready before the lexicons are built
+      if (opt_matrix) {
+        const std::string map_file = OCONF(CONTEXT_ID_MAP_FILE);
+        const uint64_t input = BuildCache::hash(
+            std::vector<std::string>(1, DCONF(MATRIX_DEF_FILE)),
+            std::string(opt_compress_matrix ? "z" : "") +
+            (opt_compact_context_id ? "k" : ""));
+        if (!profile && isUpToDate(cache, incremental,
+                                   OCONF(MATRIX_FILE), input) &&
+            (!opt_compact_context_id ||
+             cache.isUpToDate(map_file.c_str(), input))) {
+          // the context id map is kept as well
+        } else if (opt_compact_context_id) {
+          Connector::compile(DCONF(MATRIX_DEF_FILE),
+                             OCONF(MATRIX_FILE), opt_compress_matrix,
+                             map_file.c_str(), profile.get());
+        } else {
+          std::remove(map_file.c_str());
+          Connector::compile(DCONF(MATRIX_DEF_FILE),
+                             OCONF(MATRIX_FILE), opt_compress_matrix);
+        }
+        // the outputs of a profile are not reproduced from the inputs
+        if (!profile) {
+          cache.update(OCONF(MATRIX_FILE), input);
+          if (opt_compact_context_id) {
+            cache.update(map_file.c_str(), input);
+          }
+        }
+        if (opt_compact_context_id) {
+          param.set("context-id-map", map_file);
+        }
+      } else if (file_exists(OCONF(CONTEXT_ID_MAP_FILE))) {
+        param.set("context-id-map", OCONF(CONTEXT_ID_MAP_FILE));
+      }
+
       if (opt_charcategory || opt_unknown) {
-        CharProperty::compile(DCONF(CHAR_PROPERTY_DEF_FILE),
-                              DCONF(UNK_DEF_FILE),
-                              OCONF(CHAR_PROPERTY_FILE));
+        std::vector<std::string> files;
+        files.push_back(DCONF(CHAR_PROPERTY_DEF_FILE));
+        files.push_back(DCONF(UNK_DEF_FILE));
+        const uint64_t input = BuildCache::hash(files, "");
+        if (!isUpToDate(cache, incremental,
+                        OCONF(CHAR_PROPERTY_FILE), input)) {
+          CharProperty::compile(DCONF(CHAR_PROPERTY_DEF_FILE),
+                                DCONF(UNK_DEF_FILE),
+                                OCONF(CHAR_PROPERTY_FILE));
+          cache.update(OCONF(CHAR_PROPERTY_FILE), input);
+        }
       }
 
       if (opt_unknown) {
         std::vector<std::string> tmp;
         tmp.push_back(DCONF(UNK_DEF_FILE));
         param.set("type", static_cast<int>(MECAB_UNK_DIC));
-        Dictionary::compile(param, tmp, OCONF(UNK_DIC_FILE));
+        const uint64_t input = Dictionary::inputHash(param, tmp);
+        if (!isUpToDate(cache, incremental, OCONF(UNK_DIC_FILE), input)) {
+          Dictionary::compile(param, tmp, OCONF(UNK_DIC_FILE));
+          cache.update(OCONF(UNK_DIC_FILE), input);
+        }
       }
 
       if (opt_model) {
         if (file_exists(DCONF(MODEL_DEF_FILE))) {
-          FeatureIndex::compile(param,
-                                DCONF(MODEL_DEF_FILE),
-                                OCONF(MODEL_FILE));
+          const uint64_t input = BuildCache::hash(
+              std::vector<std::string>(1, DCONF(MODEL_DEF_FILE)),
+              param.get<std::string>("charset"));
+          if (!isUpToDate(cache, incremental, OCONF(MODEL_FILE), input)) {
+            FeatureIndex::compile(param,
+                                  DCONF(MODEL_DEF_FILE),
+                                  OCONF(MODEL_FILE));
+            cache.update(OCONF(MODEL_FILE), input);
+          }
         } else {
           std::cout << DCONF(MODEL_DEF_FILE)
                     << " is not found. skipped." << std::endl;
@@ -137,12 +258,37 @@ class DictionaryComplier {
       if (opt_sysdic) {
         CHECK_DIE(dic.size()) << "no dictionaries are specified";
         param.set("type", static_cast<int>(MECAB_SYS_DIC));
-        Dictionary::compile(param, dic, OCONF(SYS_DIC_FILE));
+        const uint64_t input = Dictionary::inputHash(param, dic);
+        if (token_profile ||
+            !isUpToDate(cache, incremental, OCONF(SYS_DIC_FILE), input)) {
+          size_t hot_size = 0;
+          Dictionary::compile(param, dic, OCONF(SYS_DIC_FILE),
+                              token_profile.get(), &hot_size);
+          if (token_profile) {
+            std::cout << "hot tokens: " << hot_size << " ("
+                      << token_profile->size() << " surfaces in "
+                      << token_corpus << ")" << std::endl;
+          } else {
+            cache.update(OCONF(SYS_DIC_FILE), input);
+          }
+        }
       }
 
-      if (opt_matrix) {
-        Connector::compile(DCONF(MATRIX_DEF_FILE),
-                           OCONF(MATRIX_FILE));
+      // the index follows sys.dic, and a stale one is removed
+      if (opt_sysdic || opt_aho_corasick) {
+        const std::string index_file = OCONF(AHO_CORASICK_FILE);
+        const uint64_t input = BuildCache::hashFile(OCONF(SYS_DIC_FILE));
+        if (!opt_aho_corasick) {
+          std::remove(index_file.c_str());
+        } else if (!isUpToDate(cache, incremental,
+                               index_file.c_str(), input)) {
+          AhoCorasick::compile(OCONF(SYS_DIC_FILE), index_file.c_str());
+          cache.update(index_file.c_str(), input);
+        }
+      }
+
+      if (incremental) {
+        cache.save();
       }
     }
 
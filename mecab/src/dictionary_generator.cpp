@@ -3,6 +3,7 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -15,6 +16,7 @@
 #include "param.h"
 #include "utils.h"
 #include "string_buffer.h"
+#include "thread.h"
 #include "freelist.h"
 #include "dictionary_rewriter.h"
 #include "learner_node.h"
@@ -24,6 +26,105 @@
 #include "dictionary.h"
 
 namespace MeCab {
+namespace {
+
+// a context feature split into CSV columns once for the whole matrix.
+struct ContextFeature {
+  int id;
+  std::string feature;
+  std::vector<char> buf;
+  std::vector<char *> column;
+
+  void set(const std::string &f, int i) {
+    id = i;
+    feature = f;
+    buf.assign(feature.c_str(), feature.c_str() + feature.size() + 1);
+    column.resize(64);
+    column.resize(tokenizeCSV(&buf[0], &column[0], column.size()));
+  }
+};
+
+// computes the costs of the rows [begin, end) of the matrix.
+struct MatrixJob {
+  const std::vector<ContextFeature> *right;
+  const std::vector<ContextFeature> *left;
+  std::vector<DecoderFeatureIndex *> *fi;
+  std::vector<int> cost;
+  size_t begin;
+  size_t end;
+  int factor;
+
+  void run(size_t id, size_t size) {
+    DecoderFeatureIndex *f = (*fi)[id];
+    LearnerPath path;
+    LearnerNode rnode;
+    LearnerNode lnode;
+    rnode.stat = lnode.stat = MECAB_NOR_NODE;
+    rnode.rpath = &path;
+    lnode.lpath = &path;
+    path.lnode = &lnode;
+    path.rnode = &rnode;
+
+    const size_t lsize = left->size();
+    for (size_t r = begin + id; r < end; r += size) {
+      const ContextFeature &rf = (*right)[r];
+      int *c = &cost[(r - begin) * lsize];
+      f->clear();
+      for (size_t l = 0; l < lsize; ++l) {
+        const ContextFeature &lf = (*left)[l];
+        path.rnode->wcost = 0;
+        f->buildBigramFeature(&path,
+                              rf.feature.c_str(),
+                              const_cast<char **>(&rf.column[0]),
+                              rf.column.size(),
+                              lf.feature.c_str(),
+                              const_cast<char **>(&lf.column[0]),
+                              lf.column.size());
+        f->calcCost(&path);
+        c[l] = tocost(path.cost, factor);
+      }
+    }
+  }
+};
+
+// a dictionary entry whose word cost is computed by a thread.
+struct DicEntry {
+  std::string w;
+  std::string feature;
+  std::string ufeature;
+  int lid;
+  int rid;
+  unsigned char char_type;
+  int cost;
+};
+
+struct DicJob {
+  std::vector<DicEntry> *entry;
+  std::vector<DecoderFeatureIndex *> *fi;
+  int factor;
+
+  void run(size_t id, size_t size) {
+    DecoderFeatureIndex *f = (*fi)[id];
+    LearnerPath path;
+    LearnerNode rnode;
+    LearnerNode lnode;
+    rnode.stat  = lnode.stat = MECAB_NOR_NODE;
+    rnode.rpath = &path;
+    lnode.lpath = &path;
+    path.lnode  = &lnode;
+    path.rnode  = &rnode;
+
+    f->clear();
+    for (size_t i = id; i < entry->size(); i += size) {
+      DicEntry *e = &(*entry)[i];
+      path.rnode->char_type = e->char_type;
+      f->buildUnigramFeature(&path, e->ufeature.c_str());
+      f->calcCost(&rnode);
+      e->cost = tocost(rnode.wcost, factor);
+    }
+  }
+};
+}
 
 void copy(const char *src, const char *dst) {
   std::cout << "copying " << src << " to " <<  dst << std::endl;
@@ -71,44 +172,56 @@ class DictionaryGenerator {
     ifs.close();
   }
 
+  // The rows are computed by the threads in blocks and written in the
+  // same order as with one thread.
   static bool genmatrix(const char *filename,
                         const ContextID &cid,
-                        DecoderFeatureIndex *fi,
+                        std::vector<DecoderFeatureIndex *> *fi,
                         int factor) {
     std::ofstream ofs(WPATH(filename));
     CHECK_DIE(ofs) << "permission denied: " << filename;
 
-    LearnerPath path;
-    LearnerNode rnode;
-    LearnerNode lnode;
-    rnode.stat = lnode.stat = MECAB_NOR_NODE;
-    rnode.rpath = &path;
-    lnode.lpath = &path;
-    path.lnode = &lnode;
-    path.rnode = &rnode;
+    const std::map<std::string, int> &left_ids =  cid.left_ids();
+    const std::map<std::string, int> &right_ids = cid.right_ids();
 
-    const std::map<std::string, int> &left =  cid.left_ids();
-    const std::map<std::string, int> &right = cid.right_ids();
+    CHECK_DIE(left_ids.size() > 0)  << "left id size is empty";
+    CHECK_DIE(right_ids.size() > 0) << "right id size is empty";
 
-    CHECK_DIE(left.size() > 0)  << "left id size is empty";
-    CHECK_DIE(right.size() > 0) << "right id size is empty";
+    std::vector<ContextFeature> left(left_ids.size());
+    std::vector<ContextFeature> right(right_ids.size());
+    {
+      size_t i = 0;
+      for (std::map<std::string, int>::const_iterator it = left_ids.begin();
+           it != left_ids.end(); ++it) {
+        left[i++].set(it->first, it->second);
+      }
+      i = 0;
+      for (std::map<std::string, int>::const_iterator it = right_ids.begin();
+           it != right_ids.end(); ++it) {
+        right[i++].set(it->first, it->second);
+      }
+    }
 
     ofs << right.size() << ' ' << left.size() << std::endl;
 
-    size_t l = 0;
-    for (std::map<std::string, int>::const_iterator rit = right.begin();
-         rit != right.end();
-         ++rit) {
-      ++l;
-      progress_bar("emitting matrix      ", l+1, right.size());
-      for (std::map<std::string, int>::const_iterator lit = left.begin();
-           lit != left.end();
-           ++lit) {
-        path.rnode->wcost = 0;
-        fi->buildBigramFeature(&path, rit->first.c_str(), lit->first.c_str());
-        fi->calcCost(&path);
-        ofs << rit->second << ' ' << lit->second << ' '
-            << tocost(path.cost, factor) << '\n';
+    MatrixJob job;
+    job.right = &right;
+    job.left = &left;
+    job.fi = fi;
+    job.factor = factor;
+
+    const size_t block = 64 * fi->size();
+    for (size_t begin = 0; begin < right.size(); begin += block) {
+      job.begin = begin;
+      job.end = std::min(begin + block, right.size());
+      job.cost.resize((job.end - job.begin) * left.size());
+      run_jobs(&job, fi->size());
+      for (size_t r = job.begin; r < job.end; ++r) {
+        progress_bar("emitting matrix      ", r + 2, right.size());
+        const int *c = &job.cost[(r - job.begin) * left.size()];
+        for (size_t l = 0; l < left.size(); ++l) {
+          ofs << right[r].id << ' ' << left[l].id << ' ' << c[l] << '\n';
+        }
       }
     }
 
@@ -120,7 +233,7 @@ class DictionaryGenerator {
                      const CharProperty &property,
                      DictionaryRewriter *rewrite,
                      const ContextID &cid,
-                     DecoderFeatureIndex *fi,
+                     std::vector<DecoderFeatureIndex *> *fi,
                      bool unk,
                      int factor) {
     std::ifstream ifs(WPATH(ifile));
@@ -131,52 +244,66 @@ class DictionaryGenerator {
 
     std::cout <<  "emitting " << ofile << " ... " << std::flush;
 
-    LearnerPath path;
-    LearnerNode rnode;
-    LearnerNode lnode;
-    rnode.stat  = lnode.stat = MECAB_NOR_NODE;
-    rnode.rpath = &path;
-    lnode.lpath = &path;
-    path.lnode  = &lnode;
-    path.rnode  = &rnode;
-
     std::array<char, BUF_SIZE> line;
     char *col[8];
     size_t num = 0;
 
-    while (ifs.getline(line.data(), line.size())) {
-      const size_t n = tokenizeCSV(line.data(), col, 5);
-      CHECK_DIE(n == 5) << "format error: " << line.data();
-
-      std::string w = std::string(col[0]);
-      const std::string feature = std::string(col[4]);
-
-      std::string ufeature, lfeature, rfeature;
-      rewrite->rewrite2(feature, &ufeature, &lfeature, &rfeature);
-      const int lid = cid.lid(lfeature.c_str());
-      const int rid = cid.rid(rfeature.c_str());
-
-      CHECK_DIE(lid > 0) << "CID is not found for " << lfeature;
-      CHECK_DIE(rid > 0) << "CID is not found for " << rfeature;
-
-      if (unk) {
-        const int c = property.id(w.c_str());
-        CHECK_DIE(c >= 0) << "unknown property [" << w << "]";
-        path.rnode->char_type = static_cast<unsigned char>(c);
-      } else {
-        size_t mblen = 0;
-        const CharInfo cinfo = property.getCharInfo(w.c_str(), w.c_str() + w.size(), &mblen);
-        path.rnode->char_type = cinfo.default_type;
+    // the lines are read in blocks; the threads compute the word costs
+    // of a block, which is then written in order.
+    std::vector<DicEntry> entry;
+    DicJob job;
+    job.entry = &entry;
+    job.fi = fi;
+    job.factor = factor;
+
+    const size_t block = 8192 * fi->size();
+    for (bool eof = false; !eof; ) {
+      entry.clear();
+      while (entry.size() < block) {
+        if (!ifs.getline(line.data(), line.size())) {
+          eof = true;
+          break;
+        }
+
+        const size_t n = tokenizeCSV(line.data(), col, 5);
+        CHECK_DIE(n == 5) << "format error: " << line.data();
+
+        entry.resize(entry.size() + 1);
+        DicEntry *e = &entry.back();
+        e->w = col[0];
+        e->feature = col[4];
+
+        std::string lfeature, rfeature;
+        rewrite->rewrite2(e->feature, &e->ufeature, &lfeature, &rfeature);
+        e->lid = cid.lid(lfeature.c_str());
+        e->rid = cid.rid(rfeature.c_str());
+
+        CHECK_DIE(e->lid > 0) << "CID is not found for " << lfeature;
+        CHECK_DIE(e->rid > 0) << "CID is not found for " << rfeature;
+
+        if (unk) {
+          const int c = property.id(e->w.c_str());
+          CHECK_DIE(c >= 0) << "unknown property [" << e->w << "]";
+          e->char_type = static_cast<unsigned char>(c);
+        } else {
+          size_t mblen = 0;
+          const CharInfo cinfo = property.getCharInfo(
+              e->w.c_str(), e->w.c_str() + e->w.size(), &mblen);
+          e->char_type = cinfo.default_type;
+        }
       }
 
-      fi->buildUnigramFeature(&path, ufeature.c_str());
-      fi->calcCost(&rnode);
-      CHECK_DIE(escape_csv_element(&w)) << "invalid character found: " << w;
+      run_jobs(&job, fi->size());
 
-      ofs << w << ',' << lid << ',' << rid << ','
-          << tocost(rnode.wcost, factor)
-          << ',' << feature << '\n';
-      ++num;
+      for (size_t i = 0; i < entry.size(); ++i) {
+        DicEntry *e = &entry[i];
+        CHECK_DIE(escape_csv_element(&e->w))
+            << "invalid character found: " << e->w;
+        ofs << e->w << ',' << e->lid << ',' << e->rid << ','
+            << e->cost
+            << ',' << e->feature << '\n';
+        ++num;
+      }
     }
 
     std::cout << num << std::endl;
@@ -189,6 +316,7 @@ class DictionaryGenerator {
       { "dicdir",  'd',  ".",   "DIR", "set DIR as dicdir(default \".\" )" },
       { "outdir",  'o',  ".",   "DIR", "set DIR as output dir" },
       { "model",   'm',  0,     "FILE",   "use FILE as model file" },
+      { "thread",  'p',  "1",   "INT",    "number of threads(default 1)" },
       { "version", 'v',  0,   0,  "show the version and exit"  },
       { "help",    'h',  0,   0,  "show this help and exit."      },
       { 0, 0, 0, 0 }
@@ -232,6 +360,7 @@ class DictionaryGenerator {
 
     const std::string bos = param.get<std::string>("bos-feature");
     const int factor = param.get<int>("cost-factor");
+    const size_t thread_num = param.get<size_t>("thread");
 
     std::vector<std::string> dic;
     enum_csv_dictionaries(dicdir.c_str(), &dic);
@@ -247,6 +376,18 @@ class DictionaryGenerator {
       CHECK_DIE(!bos.empty()) << "bos-feature is empty";
       CHECK_DIE(dic.size()) << "no dictionary is found in " << dicdir;
       CHECK_DIE(rewrite.open(DCONF(REWRITE_FILE)));
+      CHECK_DIE(thread_num > 0 && thread_num <= 512)
+          << "# thread is invalid: " << thread_num;
+    }
+
+    // thread 0 uses |fi| itself; the others share its model.
+    std::vector<std::shared_ptr<DecoderFeatureIndex> > fi_data;
+    std::vector<DecoderFeatureIndex *> fis(1, &fi);
+    for (size_t i = 1; i < thread_num; ++i) {
+      fi_data.push_back(std::shared_ptr<DecoderFeatureIndex>(
+          new DecoderFeatureIndex(mecab_default_io())));
+      fi_data.back()->share(fi);
+      fis.push_back(fi_data.back().get());
     }
 
     gencid_bos(bos, &rewrite, &cid);
@@ -266,7 +407,7 @@ class DictionaryGenerator {
     cid.save(OCONF(LEFT_ID_FILE), OCONF(RIGHT_ID_FILE));
 
     gendic(DCONF(UNK_DEF_FILE), OCONF(UNK_DEF_FILE), property,
-           &rewrite, cid, &fi, true, factor);
+           &rewrite, cid, &fis, true, factor);
 
     for (std::vector<std::string>::const_iterator it = dic.begin();
          it != dic.end();
@@ -274,10 +415,10 @@ class DictionaryGenerator {
       std::string file =  *it;
       remove_pathname(&file);
       gendic(it->c_str(), OCONF(file.c_str()), property,
-             &rewrite, cid, &fi, false, factor);
+             &rewrite, cid, &fis, false, factor);
     }
 
-    genmatrix(OCONF(MATRIX_DEF_FILE), cid, &fi, factor);
+    genmatrix(OCONF(MATRIX_DEF_FILE), cid, &fis, factor);
 
     copy(DCONF(CHAR_PROPERTY_DEF_FILE), OCONF(CHAR_PROPERTY_DEF_FILE));
     copy(DCONF(REWRITE_FILE), OCONF(REWRITE_FILE));
@@ -4,6 +4,7 @@
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
 #include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <fstream>
 #include <string>
@@ -22,6 +23,12 @@
 #define BUFSIZE (2048)
 #define POSSIZE (64)
 
+// set in the size field of model.bin when the keys are in Eytzinger order
+#define EYTZINGER_LAYOUT (0x80000000U)
+// set in the size field of model.bin when the model has 2^k weights
+// indexed by feature hash and no keys; the rest of the field is k.
+#define HASHED_LAYOUT (0x40000000U)
+
 #define ADDB(b) do { const int id = this->id((b));  \
     if (id != -1) feature_.push_back(id); } while (0)
 
@@ -32,6 +39,19 @@
     feature_.clear(); } while (0)
 
 namespace MeCab {
+namespace {
+// stores |sorted| into |tree| in the order of a breadth-first walk of
+// the implicit binary search tree whose k-th node has children 2k, 2k+1.
+template <class T>
+void eytzinger(const std::vector<T> &sorted, std::vector<T> *tree,
+               size_t *i, size_t k) {
+  if (k <= sorted.size()) {
+    eytzinger(sorted, tree, i, 2 * k);
+    (*tree)[k - 1] = sorted[(*i)++];
+    eytzinger(sorted, tree, i, 2 * k + 1);
+  }
+}
+}
 
 const char* FeatureIndex::getIndex(char **p, char **column, size_t max) {
   ++(*p);
@@ -114,6 +134,9 @@ bool FeatureIndex::openTemplate(const Param &param) {
 }
 
 bool EncoderFeatureIndex::open(const Param &param) {
+  hash_bits_ = param.get<size_t>("feature-hash");
+  CHECK_DIE(hash_bits_ <= 30) << "feature-hash is out of range: " << hash_bits_;
+  maxid_ = hash_bits_ ? (static_cast<size_t>(1) << hash_bits_) : 0;
   return openTemplate(param);
 }
 
@@ -141,10 +164,21 @@ bool DecoderFeatureIndex::openFromArray(const char *begin, const char *end) {
   const char *ptr = begin;
   unsigned int maxid = 0;
   read_static<unsigned int>(&ptr, maxid);
-  maxid_ = static_cast<size_t>(maxid);
+  const bool hashed = (maxid & HASHED_LAYOUT) != 0;
+  eytzinger_ = (maxid & EYTZINGER_LAYOUT) != 0;
+  maxid &= ~(EYTZINGER_LAYOUT | HASHED_LAYOUT);
+  if (hashed) {
+    if (eytzinger_ || maxid == 0 || maxid > 30) {
+      return false;
+    }
+    maxid_ = static_cast<size_t>(1) << maxid;
+  } else {
+    maxid_ = static_cast<size_t>(maxid);
+  }
   const size_t file_size = static_cast<size_t>(end - begin);
   const size_t expected_file_size =
-      (sizeof(double) + sizeof(uint64_t)) * maxid_ + sizeof(maxid) + 32;
+      (sizeof(double) + (hashed ? 0 : sizeof(uint64_t))) * maxid_ +
+      sizeof(maxid) + 32;
   if (expected_file_size != file_size) {
     return false;
   }
@@ -152,7 +186,7 @@ bool DecoderFeatureIndex::openFromArray(const char *begin, const char *end) {
   ptr += 32;
   alpha_ = reinterpret_cast<const double *>(ptr);
   ptr += (sizeof(alpha_[0]) * maxid_);
-  key_ = reinterpret_cast<const uint64_t *>(ptr);
+  key_ = hashed ? 0 : reinterpret_cast<const uint64_t *>(ptr);
   return true;
 }
 
@@ -187,6 +221,16 @@ void DecoderFeatureIndex::clear() {
   feature_freelist_.free();
 }
 
+void DecoderFeatureIndex::share(const DecoderFeatureIndex &fi) {
+  unigram_templs_ = fi.unigram_templs_;
+  bigram_templs_ = fi.bigram_templs_;
+  maxid_ = fi.maxid_;
+  alpha_ = fi.alpha_;
+  key_ = fi.key_;
+  charset_ = fi.charset_;
+  eytzinger_ = fi.eytzinger_;
+}
+
 void EncoderFeatureIndex::clear() {}
 
 void EncoderFeatureIndex::clearcache() {
@@ -289,44 +333,40 @@ bool EncoderFeatureIndex::buildFeature(LearnerPath *path) {
       << " cannot rewrite pattern: "
       << path->rnode->feature;
 
+  // building a feature vector only adds to |dic_|, so the cache entry
+  // stays valid while the vector is built into it.
   {
     os_.clear();
     os_ << ufeature2 << ' ' << path->rnode->char_type << '\0';
-    const std::string key(os_.str());
-    std::map<std::string, std::pair<const int *, size_t> >::iterator
-        it = feature_cache_.find(key);
-    if (it != feature_cache_.end()) {
-      path->rnode->fvector = it->second.first;
-      it->second.second++;
-    } else {
+    std::pair<std::pair<const int *, size_t> *, bool> it =
+        feature_cache_.insert(os_.str(),
+                              std::pair<const int *, size_t>(0, 0));
+    if (it.second) {
       if (!buildUnigramFeature(path, ufeature2.c_str())) {
         return false;
       }
-      feature_cache_.insert(std::pair
-                            <std::string, std::pair<const int *, size_t> >
-                            (key,
-                             std::pair<const int *, size_t>
-                             (path->rnode->fvector, 1)));
+      it.first->first = path->rnode->fvector;
+    } else {
+      path->rnode->fvector = it.first->first;
     }
+    it.first->second++;
   }
 
   {
     os_.clear();
     os_ << rfeature1 << ' ' << lfeature2 << '\0';
-    std::string key(os_.str());
-    std::map<std::string, std::pair<const int *, size_t> >::iterator
-        it = feature_cache_.find(key);
-    if (it != feature_cache_.end()) {
-      path->fvector = it->second.first;
-      it->second.second++;
-    } else {
-      if (!buildBigramFeature(path, rfeature1.c_str(), lfeature2.c_str()))
+    std::pair<std::pair<const int *, size_t> *, bool> it =
+        feature_cache_.insert(os_.str(),
+                              std::pair<const int *, size_t>(0, 0));
+    if (it.second) {
+      if (!buildBigramFeature(path, rfeature1.c_str(), lfeature2.c_str())) {
         return false;
-      feature_cache_.insert(std::pair
-                            <std::string, std::pair<const int *, size_t> >
-                            (key, std::pair<const int *, size_t>
-                             (path->fvector, 1)));
+      }
+      it.first->first = path->fvector;
+    } else {
+      path->fvector = it.first->first;
     }
+    it.first->second++;
   }
 
   CHECK_DIE(path->fvector) << " fvector is NULL";
@@ -392,13 +432,23 @@ bool FeatureIndex::buildBigramFeature(LearnerPath *path,
   std::array<char *, POSSIZE> R;
   std::array<char *, POSSIZE> L;
 
-  feature_.clear();
   std::strncpy(lbuf.data(),  rfeature, lbuf.size());
   std::strncpy(rbuf.data(),  lfeature, rbuf.size());
 
   const size_t lsize = tokenizeCSV(lbuf.data(), L.data(), L.size());
   const size_t rsize = tokenizeCSV(rbuf.data(), R.data(), R.size());
 
+  return buildBigramFeature(path, rfeature, L.data(), lsize,
+                            lfeature, R.data(), rsize);
+}
+
+bool FeatureIndex::buildBigramFeature(LearnerPath *path,
+                                      const char *rfeature,
+                                      char **L, size_t lsize,
+                                      const char *lfeature,
+                                      char **R, size_t rsize) {
+  feature_.clear();
+
   for (std::vector<const char*>::const_iterator it = bigram_templs_.begin();
        it != bigram_templs_.end(); ++it) {
     const char *p = *it;
@@ -411,12 +461,12 @@ bool FeatureIndex::buildBigramFeature(LearnerPath *path,
         case '%': {
           switch (*++p) {
             case 'L': {
-              const char *r = getIndex(const_cast<char **>(&p), L.data(), lsize);
+              const char *r = getIndex(const_cast<char **>(&p), L, lsize);
               if (!r) goto NEXT;
               os_ << r;
             } break;
             case 'R': {
-              const char *r = getIndex(const_cast<char **>(&p), R.data(), rsize);
+              const char *r = getIndex(const_cast<char **>(&p), R, rsize);
               if (!r) goto NEXT;
               os_ << r;
             } break;
@@ -443,6 +493,21 @@ bool FeatureIndex::buildBigramFeature(LearnerPath *path,
 
 int DecoderFeatureIndex::id(const char *key) {
   const uint64_t fp = fingerprint(key, std::strlen(key));
+  if (!key_) {
+    return static_cast<int>(fp & (maxid_ - 1));
+  }
+  if (eytzinger_) {
+    // each step reads one key, and the first levels of the tree share
+    // a few cache lines.
+    for (size_t k = 1; k <= maxid_; ) {
+      const uint64_t key = key_[k - 1];
+      if (key == fp) {
+        return static_cast<int>(k - 1);
+      }
+      k = 2 * k + (key < fp);
+    }
+    return -1;
+  }
   const uint64_t *result = std::lower_bound(key_,
                                             key_ + maxid_,
                                             fp);
@@ -455,14 +520,15 @@ int DecoderFeatureIndex::id(const char *key) {
 }
 
 int EncoderFeatureIndex::id(const char *key) {
-  std::map<std::string, int>::const_iterator it = dic_.find(key);
-  if (it == dic_.end()) {
-    dic_.insert(std::pair<std::string, int>(std::string(key), int(maxid_)));
-    return int(maxid_++);
-  } else {
-    return it->second;
+  if (hash_bits_) {
+    return static_cast<int>(fingerprint(key, std::strlen(key)) &
+                            (maxid_ - 1));
   }
-  return -1;
+  const std::pair<int *, bool> it = dic_.insert(key, int(maxid_));
+  if (it.second) {
+    ++maxid_;
+  }
+  return *it.first;
 }
 
 void EncoderFeatureIndex::shrink(size_t freq,
@@ -470,47 +536,41 @@ void EncoderFeatureIndex::shrink(size_t freq,
   std::vector<size_t> freqv;
   // count fvector
   freqv.resize(maxid_);
-  for (std::map<std::string, std::pair<const int*, size_t> >::const_iterator
+  for (StringMap<std::pair<const int*, size_t> >::const_iterator
            it = feature_cache_.begin();
        it != feature_cache_.end(); ++it) {
-    for (const int *f = it->second.first; *f != -1; ++f) {
-      freqv[*f] += it->second.second;  // freq
+    for (const int *f = it->value.first; *f != -1; ++f) {
+      freqv[*f] += it->value.second;  // freq
     }
   }
 
-  if (freq <= 1) {
+  // hashed ids cannot be renumbered.
+  if (freq <= 1 || hash_bits_) {
     return;
   }
 
-  // make old2new map
+  // make old2new map, -1 for removed ids
   maxid_ = 0;
-  std::map<int, int> old2new;
+  std::vector<int> old2new(freqv.size(), -1);
   for (size_t i = 0; i < freqv.size(); ++i) {
     if (freqv[i] >= freq) {
-      old2new.insert(std::pair<int, int>(int(i), int(maxid_++)));
+      old2new[i] = int(maxid_++);
     }
   }
 
   // update dic_
-  for (std::map<std::string, int>::iterator
-           it = dic_.begin(); it != dic_.end();) {
-    std::map<int, int>::const_iterator it2 = old2new.find(it->second);
-    if (it2 != old2new.end()) {
-      it->second = it2->second;
-      ++it;
-    } else {
-      dic_.erase(it++);
-    }
+  for (StringMap<int>::iterator it = dic_.begin(); it != dic_.end(); ++it) {
+    it->value = old2new[it->value];
   }
+  dic_.retain([](const StringMap<int>::entry_t &e) { return e.value != -1; });
 
   // update all fvector
-  for (std::map<std::string, std::pair<const int*, size_t> >::const_iterator
+  for (StringMap<std::pair<const int*, size_t> >::const_iterator
            it = feature_cache_.begin(); it != feature_cache_.end(); ++it) {
-    int *to = const_cast<int *>(it->second.first);
-    for (const int *f = it->second.first; *f != -1; ++f) {
-      std::map<int, int>::const_iterator it2 = old2new.find(*f);
-      if (it2 != old2new.end()) {
-        *to = it2->second;
+    int *to = const_cast<int *>(it->value.first);
+    for (const int *f = it->value.first; *f != -1; ++f) {
+      if (old2new[*f] != -1) {
+        *to = old2new[*f];
         ++to;
       }
     }
@@ -519,10 +579,9 @@ void EncoderFeatureIndex::shrink(size_t freq,
 
   // update observed vector
   std::vector<double> observed_new(maxid_);
-  for (size_t i = 0; i < observed->size(); ++i) {
-    std::map<int, int>::const_iterator it = old2new.find(static_cast<int>(i));
-    if (it != old2new.end()) {
-      observed_new[it->second] = (*observed)[i];
+  for (size_t i = 0; i < observed->size() && i < old2new.size(); ++i) {
+    if (old2new[i] != -1) {
+      observed_new[old2new[i]] = (*observed)[i];
     }
   }
 
@@ -550,6 +609,7 @@ bool FeatureIndex::convert(const Param &param,
   char *column[4];
   std::vector<std::pair<uint64_t, double>> dic;
   std::string model_charset;
+  size_t hash_bits = 0;
 
   while (ifs.getline(buf.data(), buf.size())) {
     if (std::strlen(buf.data()) == 0) {
@@ -558,6 +618,10 @@ bool FeatureIndex::convert(const Param &param,
     CHECK_DIE(tokenize2(buf.data(), ":", column, 2) == 2) << "format error: " << buf.data();
     if (std::string(column[0]) == "charset") {
       model_charset = column[1] + 1;
+    } else if (std::string(column[0]) == "feature-hash") {
+      hash_bits = std::atoi(column[1] + 1);
+      CHECK_DIE(hash_bits > 0 && hash_bits <= 30)
+          << "feature-hash is out of range: " << hash_bits;
     }
   }
 
@@ -578,13 +642,29 @@ bool FeatureIndex::convert(const Param &param,
     to = from;
   }
 
+  // the ids of a hashed model are hashes of the features in the
+  // charset of training, which cannot be converted.
+  CHECK_DIE(!hash_bits || decode_charset(from.c_str()) ==
+            decode_charset(to.c_str()))
+      << "cannot convert a hashed model from=" << from
+      << " to=" << to;
+
   Iconv iconv;
   CHECK_DIE(iconv.open(from.c_str(), to.c_str()))
             << "cannot create model from=" << from
             << " to=" << to;
 
+  // a hashed model lists "weight<TAB>id" and is stored as a dense array.
+  std::vector<double> hashed_alpha(hash_bits ? (1 << hash_bits) : 0);
+
   while (ifs.getline(buf.data(), buf.size())) {
     CHECK_DIE(tokenize2(buf.data(), "\t", column, 2) == 2) << "format error: " << buf.data();
+    if (hash_bits) {
+      const size_t n = std::atoi(column[1]);
+      CHECK_DIE(n < hashed_alpha.size()) << "format error: " << column[1];
+      hashed_alpha[n] = atof(column[0]);
+      continue;
+    }
     std::string feature = column[1];
     CHECK_DIE(iconv.convert(&feature));
     const uint64_t fp = fingerprint(feature);
@@ -594,6 +674,13 @@ bool FeatureIndex::convert(const Param &param,
 
   output->clear();
   unsigned int size = static_cast<unsigned int>(dic.size());
+  CHECK_DIE(!(size & (EYTZINGER_LAYOUT | HASHED_LAYOUT)))
+      << "too many features: " << size;
+  if (hash_bits) {
+    size = static_cast<unsigned int>(hash_bits) | HASHED_LAYOUT;
+  } else {
+    size |= EYTZINGER_LAYOUT;
+  }
   output->append(reinterpret_cast<const char*>(&size), sizeof(size));
 
   char charset_buf[32];
@@ -602,8 +689,21 @@ bool FeatureIndex::convert(const Param &param,
   output->append(reinterpret_cast<const char *>(charset_buf),
                  sizeof(charset_buf));
 
+  if (hash_bits) {
+    output->append(reinterpret_cast<const char *>(&hashed_alpha[0]),
+                   sizeof(hashed_alpha[0]) * hashed_alpha.size());
+    return true;
+  }
+
   std::sort(dic.begin(), dic.end());
 
+  {
+    std::vector<std::pair<uint64_t, double> > tree(dic.size());
+    size_t i = 0;
+    eytzinger(dic, &tree, &i, 1);
+    dic.swap(tree);
+  }
+
   for (size_t i = 0; i < dic.size(); ++i) {
     const double alpha = dic[i].second;
     output->append(reinterpret_cast<const char *>(&alpha), sizeof(alpha));
@@ -633,6 +733,9 @@ bool EncoderFeatureIndex::reopen(const char *filename,
 
   std::string model_charset;
 
+  // the old model decides whether features are hashed.
+  param->set<size_t>("feature-hash", 0, true);
+
   while (ifs.getline(buf.data(), buf.size())) {
     if (std::strlen(buf.data()) == 0) {
       break;
@@ -657,19 +760,35 @@ bool EncoderFeatureIndex::reopen(const char *filename,
   CHECK_DIE(maxid_ == 0);
   CHECK_DIE(dic_.empty());
 
+  hash_bits_ = param->get<size_t>("feature-hash");
+  CHECK_DIE(hash_bits_ <= 30) << "feature-hash is out of range: " << hash_bits_;
+  if (hash_bits_) {
+    maxid_ = static_cast<size_t>(1) << hash_bits_;
+    alpha->resize(maxid_);
+  }
+
   while (ifs.getline(buf.data(), buf.size())) {
     CHECK_DIE(tokenize2(buf.data(), "\t", column, 2) == 2)
         << "format error: " << buf.data();
+    if (hash_bits_) {
+      const size_t n = std::atoi(column[1]);
+      CHECK_DIE(n < maxid_) << "format error: " << column[1];
+      (*alpha)[n] = atof(column[0]);
+      continue;
+    }
     std::string feature = column[1];
     CHECK_DIE(iconv.convert(&feature));
-    dic_.insert(std::make_pair(feature, int(maxid_++)));
-    alpha->push_back(atof(column[0]));
+    if (dic_.insert(feature.c_str(), int(maxid_)).second) {
+      ++maxid_;
+      alpha->push_back(atof(column[0]));
+    }
   }
 
   return true;
 }
 
-bool EncoderFeatureIndex::save(const char *filename, const char *header) const {
+bool EncoderFeatureIndex::save(const char *filename, const char *header,
+                               double threshold) const {
   CHECK_DIE(header);
   CHECK_DIE(alpha_);
 
@@ -684,9 +803,33 @@ bool EncoderFeatureIndex::save(const char *filename, const char *header) const {
   ofs << header;
   ofs << std::endl;
 
-  for (std::map<std::string, int>::const_iterator it = dic_.begin();
+  if (hash_bits_) {
+    for (size_t i = 0; i < maxid_; ++i) {
+      if (alpha_[i] != 0.0 && std::fabs(alpha_[i]) > threshold) {
+        ofs << alpha_[i] << '\t' << i << '\n';
+      }
+    }
+    return true;
+  }
+
+  // written in key order, as the model files have always been.
+  std::vector<const StringMap<int>::entry_t *> entry;
+  entry.reserve(dic_.size());
+  for (StringMap<int>::const_iterator it = dic_.begin();
        it != dic_.end(); ++it) {
-    ofs << alpha_[it->second] << '\t' << it->first << '\n';
+    entry.push_back(&*it);
+  }
+  std::sort(entry.begin(), entry.end(),
+            [](const StringMap<int>::entry_t *a,
+               const StringMap<int>::entry_t *b) {
+              return std::strcmp(a->key, b->key) < 0;
+            });
+
+  for (size_t i = 0; i < entry.size(); ++i) {
+    const double alpha = alpha_[entry[i]->value];
+    if (std::fabs(alpha) > threshold) {
+      ofs << alpha << '\t' << entry[i]->key << '\n';
+    }
   }
 
   return true;
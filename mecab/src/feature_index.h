@@ -10,6 +10,95 @@ namespace MeCab {
 
 class Param;
 
+// Open-addressing hash table keyed by strings copied into an arena.
+// Entries are kept in a vector in insertion order; the table holds
+// their index + 1 and is probed linearly.
+template <class T> class StringMap {
+ public:
+  struct entry_t {
+    const char *key;
+    uint64_t    hash;
+    T           value;
+  };
+
+  typedef typename std::vector<entry_t>::iterator iterator;
+  typedef typename std::vector<entry_t>::const_iterator const_iterator;
+
+  iterator begin() { return entry_.begin(); }
+  iterator end() { return entry_.end(); }
+  const_iterator begin() const { return entry_.begin(); }
+  const_iterator end() const { return entry_.end(); }
+  size_t size() const { return entry_.size(); }
+  bool empty() const { return entry_.empty(); }
+
+  // inserts |key| unless it exists. Returns the stored value and
+  // whether it was inserted. The pointer is valid until the next insert.
+  std::pair<T *, bool> insert(const char *key, const T &value) {
+    const size_t len = std::strlen(key);
+    const uint64_t hash = fingerprint(key, len);
+    size_t i = lookup(key, hash);
+    if (table_[i]) {
+      return std::make_pair(&entry_[table_[i] - 1].value, false);
+    }
+    if (2 * (entry_.size() + 1) > table_.size()) {
+      rehash(2 * table_.size());
+      i = lookup(key, hash);
+    }
+    char *copy = arena_.alloc(len + 1);
+    std::memcpy(copy, key, len + 1);
+    const entry_t e = { copy, hash, value };
+    entry_.push_back(e);
+    table_[i] = static_cast<unsigned int>(entry_.size());
+    return std::make_pair(&entry_.back().value, true);
+  }
+
+  // removes the entries for which |pred| returns false.
+  template <class Pred> void retain(Pred pred) {
+    entry_.erase(std::remove_if(entry_.begin(), entry_.end(),
+                                [&pred](const entry_t &e) {
+                                  return !pred(e); }),
+                 entry_.end());
+    rehash(table_.size());
+  }
+
+  void clear() {
+    entry_.clear();
+    table_.assign(kInitialSize, 0);
+    arena_.free();
+  }
+
+  StringMap(): table_(kInitialSize, 0), arena_(8192 * 32) {}
+
+ private:
+  enum { kInitialSize = 1024 };
+  std::vector<entry_t>      entry_;
+  std::vector<unsigned int> table_;
+  ChunkFreeList<char>       arena_;
+
+  size_t lookup(const char *key, uint64_t hash) const {
+    const size_t mask = table_.size() - 1;
+    for (size_t i = static_cast<size_t>(hash) & mask; ; i = (i + 1) & mask) {
+      const unsigned int n = table_[i];
+      if (n == 0 || (entry_[n - 1].hash == hash &&
+                     std::strcmp(entry_[n - 1].key, key) == 0)) {
+        return i;
+      }
+    }
+  }
+
+  void rehash(size_t size) {
+    table_.assign(size, 0);
+    const size_t mask = size - 1;
+    for (size_t n = 0; n < entry_.size(); ++n) {
+      size_t i = static_cast<size_t>(entry_[n].hash) & mask;
+      while (table_[i]) {
+        i = (i + 1) & mask;
+      }
+      table_[i] = static_cast<unsigned int>(n + 1);
+    }
+  }
+};
+
 class FeatureIndex {
  public:
   virtual bool open(const Param &param) = 0;
@@ -23,6 +112,10 @@ class FeatureIndex {
 
   bool buildUnigramFeature(LearnerPath *, const char *);
   bool buildBigramFeature(LearnerPath *, const char *, const char*);
+  // same as above, with both features already split by tokenizeCSV().
+  bool buildBigramFeature(LearnerPath *path,
+                          const char *rfeature, char **L, size_t lsize,
+                          const char *lfeature, char **R, size_t rsize);
 
   void calcCost(LearnerPath *path);
   void calcCost(LearnerNode *node);
@@ -57,6 +150,8 @@ class FeatureIndex {
 
 class EncoderFeatureIndex: public FeatureIndex {
  public:
+  EncoderFeatureIndex(): hash_bits_(0) {}
+
   bool open(const Param &param);
   void close();
   void clear();
@@ -66,27 +161,35 @@ class EncoderFeatureIndex: public FeatureIndex {
               std::vector<double> *alpha,
               Param *param);
 
-  bool save(const char *filename, const char *header) const;
+  bool save(const char *filename, const char *header,
+            double threshold = -1.0) const;
   void shrink(size_t freq,
               std::vector<double> *observed);
   bool buildFeature(LearnerPath *path);
   void clearcache();
 
  private:
-  std::map<std::string, int> dic_;
-  std::map<std::string, std::pair<const int*, size_t> > feature_cache_;
+  StringMap<int> dic_;
+  StringMap<std::pair<const int*, size_t> > feature_cache_;
+  size_t hash_bits_;  // features are hashed into 2^hash_bits_ ids if > 0
   int id(const char *key);
 };
 
 class DecoderFeatureIndex: public FeatureIndex {
  public:
-  DecoderFeatureIndex(macab_io_file_t *io) : io_(io), handle_(0) {}
+  DecoderFeatureIndex(macab_io_file_t *io)
+      : io_(io), handle_(0), key_(0), charset_(0), eytzinger_(false) {}
 
   bool open(const Param &param);
   void clear();
   void close();
   bool buildFeature(LearnerPath *path);
 
+  // uses the model and templates of |fi|, which must outlive this
+  // object. Only the buffers for building features are its own, so
+  // that each thread can build features with its own copy.
+  void share(const DecoderFeatureIndex &fi);
+
   const char *charset() const {
     return charset_;
   }
@@ -100,8 +203,9 @@ class DecoderFeatureIndex: public FeatureIndex {
   macab_io_file_t *io_;
   file_handle_t handle_;
   std::string model_buffer_;
-  const uint64_t *key_;
+  const uint64_t *key_;  // 0 if features are hashed
   const char *charset_;
+  bool eytzinger_;       // keys are in Eytzinger order, not sorted
 };
 }
 #endif
@@ -3,7 +3,12 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
 #include <string>
 #include <vector>
 #include "mecab.h"
@@ -26,28 +31,196 @@ namespace {
 #define DCONF(file) create_filename(dicdir, std::string(file)).c_str()
 
 #ifdef MECAB_USE_THREAD
+class learner_pool;
+
 class learner_thread: public thread {
  public:
-  unsigned short start_i;
-  unsigned short thread_num;
-  size_t size;
+  size_t id;
   size_t micro_p;
   size_t micro_r;
   size_t micro_c;
   size_t err;
   double f;
-  EncoderLearnerTagger **x;
+  learner_pool *pool;
   std::vector<double> expected;
-  void run() {
-    micro_p = micro_r = micro_c = err = 0;
-    f = 0.0;
-    std::fill(expected.begin(), expected.end(), 0.0);
-    for (size_t i = start_i; i < size; i += thread_num) {
-      f += x[i]->gradient(&expected[0]);
-      err += x[i]->eval(&micro_c, &micro_p, &micro_r);
+  void run();
+};
+
+// Threads started once and reused by every iteration. Sentences are
+// grouped into chunks of similar lattice size, largest first, and each
+// thread takes the next chunk from a shared cursor until none is left.
+// The per-thread gradients are then summed in parallel, each thread
+// owning a slice of the features.
+class learner_pool {
+ public:
+  learner_pool(size_t thread_num, size_t psize,
+               const std::vector<EncoderLearnerTagger *> &x)
+      : x_(x), psize_(psize), expected_(0), cursor_(0), generation_(0),
+        pending_(0), arrived_(0), barrier_(0), stop_(false) {
+    thread_.resize(thread_num);
+    for (size_t i = 0; i < thread_num; ++i) {
+      thread_[i].id = i;
+      thread_[i].pool = this;
+      thread_[i].expected.resize(psize);
+    }
+    for (size_t i = 0; i < thread_num; ++i) {
+      thread_[i].start();
+    }
+    prepare();
+  }
+
+  // splits the sentences into chunks; must be called when |x| changes.
+  void prepare() {
+    // about 16 chunks per thread, one sentence at least.
+    std::vector<std::pair<size_t, size_t> > order(x_.size());
+    size_t total = 0;
+    for (size_t i = 0; i < x_.size(); ++i) {
+      order[i].first = x_[i]->path_size();
+      order[i].second = i;
+      total += order[i].first;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     std::greater<std::pair<size_t, size_t> >());
+    const size_t chunk_cost =
+        std::max<size_t>(1, total / (thread_.size() * 16));
+    size_t cost = 0;
+    index_.clear();
+    chunk_.clear();
+    chunk_.push_back(0);
+    for (size_t i = 0; i < order.size(); ++i) {
+      index_.push_back(order[i].second);
+      cost += order[i].first;
+      if (cost >= chunk_cost) {
+        chunk_.push_back(index_.size());
+        cost = 0;
+      }
+    }
+    if (chunk_.back() != index_.size()) {
+      chunk_.push_back(index_.size());
+    }
+  }
+
+  ~learner_pool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_.notify_all();
+    for (size_t i = 0; i < thread_.size(); ++i) {
+      thread_[i].join();
+    }
+  }
+
+  // computes the sum of the gradients of all sentences into |expected|.
+  void gradient(double *expected, double *obj, size_t *err,
+                size_t *micro_c, size_t *micro_p, size_t *micro_r) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      expected_ = expected;
+      cursor_ = 0;
+      pending_ = thread_.size();
+      ++generation_;
+    }
+    start_.notify_all();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (pending_ > 0) {
+        done_.wait(lock);
+      }
+    }
+    for (size_t i = 0; i < thread_.size(); ++i) {
+      *obj += thread_[i].f;
+      *err += thread_[i].err;
+      *micro_r += thread_[i].micro_r;
+      *micro_p += thread_[i].micro_p;
+      *micro_c += thread_[i].micro_c;
+    }
+  }
+
+  void work(learner_thread *t) {
+    size_t generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stop_ && generation == generation_) {
+          start_.wait(lock);
+        }
+        if (stop_) {
+          return;
+        }
+        generation = generation_;
+      }
+
+      t->micro_p = t->micro_r = t->micro_c = t->err = 0;
+      t->f = 0.0;
+      std::fill(t->expected.begin(), t->expected.end(), 0.0);
+      for (size_t c = cursor_++; c + 1 < chunk_.size(); c = cursor_++) {
+        for (size_t k = chunk_[c]; k < chunk_[c + 1]; ++k) {
+          EncoderLearnerTagger *x = x_[index_[k]];
+          t->f += x->gradient(&t->expected[0]);
+          t->err += x->eval(&t->micro_c, &t->micro_p, &t->micro_r);
+        }
+      }
+
+      wait_all();
+
+      const size_t n = thread_.size();
+      const size_t begin = psize_ * t->id / n;
+      const size_t end = psize_ * (t->id + 1) / n;
+      for (size_t k = begin; k < end; ++k) {
+        double sum = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+          sum += thread_[i].expected[k];
+        }
+        expected_[k] = sum;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending_ == 0) {
+          done_.notify_one();
+        }
+      }
+    }
+  }
+
+ private:
+  const std::vector<EncoderLearnerTagger *> &x_;
+  size_t psize_;
+  double *expected_;
+  std::vector<size_t> index_;  // sentences in descending lattice size
+  std::vector<size_t> chunk_;  // chunk boundaries in |index_|
+  std::vector<learner_thread> thread_;
+  std::atomic<size_t> cursor_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  std::condition_variable arrive_;
+  size_t generation_;
+  size_t pending_;
+  size_t arrived_;
+  size_t barrier_;
+  bool stop_;
+
+  // waits until all threads have finished their chunks.
+  void wait_all() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const size_t barrier = barrier_;
+    if (++arrived_ == thread_.size()) {
+      arrived_ = 0;
+      ++barrier_;
+      arrive_.notify_all();
+      return;
+    }
+    while (barrier == barrier_) {
+      arrive_.wait(lock);
     }
   }
 };
+
+void learner_thread::run() {
+  pool->work(this);
+}
 #endif
 
 class CRFLearner {
@@ -96,7 +269,13 @@ class CRFLearner {
     const size_t unk_eval_size = param->get<size_t>("unk-eval-size");
     const size_t thread_num = param->get<size_t>("thread");
     const size_t freq = param->get<size_t>("freq");
+    const std::string reg = param->get<std::string>("regularization");
+    const bool l1 = (reg == "L1" || reg == "EN");
+    const bool l2 = (reg == "L2" || reg == "EN");
+    const double C1 = param->get<double>("l1-cost");
 
+    CHECK_DIE(l1 || l2) << "unknown regularization: " << reg;
+    CHECK_DIE(!l1 || C1 > 0) << "l1-cost is out of range: " << C1;
     CHECK_DIE(C > 0) << "cost parameter is out of range: " << C;
     CHECK_DIE(eta > 0) "eta is out of range: " << eta;
     CHECK_DIE(eval_size > 0) << "eval-size is out of range: " << eval_size;
@@ -110,6 +289,10 @@ class CRFLearner {
     std::cout.setf(std::ios::fixed, std::ios::floatfield);
     std::cout.precision(5);
 
+    if (param->get<bool>("online")) {
+      return runOnline(param, &tokenizer, &feature_index, &old_alpha);
+    }
+
     std::cout << "reading corpus ..." << std::flush;
 
     std::ifstream ifs(WPATH(ifile.c_str()));
@@ -161,26 +344,24 @@ class CRFLearner {
 #endif
     std::cout << "charset:             " <<
         tokenizer.dictionary_info()->charset << std::endl;
+    std::cout << "regularization:      " << reg        << std::endl;
+    if (l1) {
+      std::cout << "L1 cost:             " << C1         << std::endl;
+    }
     std::cout << "C(sigma^2):          " << C          << std::endl
               << std::endl;
 
 #ifdef MECAB_USE_THREAD
-    std::vector<learner_thread> thread;
+    std::shared_ptr<learner_pool> pool;
     if (thread_num > 1) {
-      thread.resize(thread_num);
-      for (size_t i = 0; i < thread_num; ++i) {
-        thread[i].start_i = (unsigned short)i;
-        thread[i].size = x.size();
-        thread[i].thread_num = (unsigned short)thread_num;
-        thread[i].x = &x[0];
-        thread[i].expected.resize(expected.size());
-      }
+      pool.reset(new learner_pool(thread_num, psize, x));
     }
 #endif
 
     int converge = 0;
     double prev_obj = 0.0;
     LBFGS lbfgs;
+    std::vector<double> evaluated(psize);  // the weights |obj| is of
 
     for (size_t itr = 0; ;  ++itr) {
       std::fill(expected.begin(), expected.end(), 0.0);
@@ -191,25 +372,9 @@ class CRFLearner {
       size_t micro_c = 0;
 
 #ifdef MECAB_USE_THREAD
-      if (thread_num > 1) {
-        for (size_t i = 0; i < thread_num; ++i) {
-          thread[i].start();
-        }
-
-        for (size_t i = 0; i < thread_num; ++i) {
-          thread[i].join();
-        }
-
-        for (size_t i = 0; i < thread_num; ++i) {
-          obj += thread[i].f;
-          err += thread[i].err;
-          micro_r += thread[i].micro_r;
-          micro_p += thread[i].micro_p;
-          micro_c += thread[i].micro_c;
-          for (size_t k = 0; k < psize; ++k) {
-            expected[k] += thread[i].expected[k];
-          }
-        }
+      if (pool.get()) {
+        pool->gradient(&expected[0], &obj, &err,
+                       &micro_c, &micro_p, &micro_r);
       } else
 #endif
       {
@@ -223,10 +388,22 @@ class CRFLearner {
       const double r = 1.0 * micro_c / micro_r;
       const double micro_f = 2 * p * r / (p + r);
 
+      // the L1 term is handled by OWL-QN in LBFGS, so only its value
+      // is added here.
+      size_t active = 0;
       for (size_t i = 0; i < psize; ++i) {
-        const double penalty = (alpha[i] - old_alpha[i]);
-        obj += (penalty * penalty / (2.0 * C));
-        expected[i] = expected[i] - observed[i] + penalty / C;
+        expected[i] = expected[i] - observed[i];
+        if (l2) {
+          const double penalty = (alpha[i] - old_alpha[i]);
+          obj += (penalty * penalty / (2.0 * C));
+          expected[i] += penalty / C;
+        }
+        if (l1) {
+          obj += std::fabs(alpha[i]) / C1;
+        }
+        if (alpha[i] != 0.0) {
+          ++active;
+        }
       }
 
       const double diff = (itr == 0 ? 1.0 :
@@ -234,8 +411,11 @@ class CRFLearner {
       std::cout << "iter="    << itr
                 << " err="    << 1.0 * err/x.size()
                 << " F="      << micro_f
-                << " target=" << obj
-                << " diff="   << diff << std::endl;
+                << " target=" << obj;
+      if (l1) {
+        std::cout << " act=" << active;
+      }
+      std::cout << " diff="   << diff << std::endl;
       prev_obj = obj;
 
       if (diff < eta) {
@@ -248,33 +428,265 @@ class CRFLearner {
         break;  // 3 is ad-hoc
       }
 
+      std::copy(alpha.begin(), alpha.end(), evaluated.begin());
       const int ret = lbfgs.optimize(psize,
                                      &alpha[0], obj,
-                                     &expected[0], false, C);
+                                     &expected[0], l1, C1);
+
+      // the OWL-QN line search may give up on rounding errors near the
+      // optimum. |alpha| is its last trial point then, so the weights
+      // evaluated above are restored.
+      CHECK_DIE(ret >= 0 || l1) << "unexpected error in LBFGS routin";
+      if (ret < 0) {
+        std::copy(evaluated.begin(), evaluated.end(), alpha.begin());
+      }
+
+      if (ret <= 0) {
+        break;
+      }
+    }
+
+    std::cout << "\nDone! writing model file ... " << std::endl;
+
+    return save(*param, tokenizer.dictionary_info()->charset,
+                feature_index, model);
+  }
 
-      CHECK_DIE(ret >= 0) << "unexpected error in LBFGS routin";
+ private:
+  // Streams the corpus in mini-batches and updates the weights with
+  // AdaGrad after every batch, so only the lattices of one batch are
+  // kept in memory. The corpus is read once more to fix the feature set.
+  static int runOnline(Param *param,
+                       Tokenizer<LearnerNode, LearnerPath> *tokenizer,
+                       EncoderFeatureIndex *feature_index,
+                       std::vector<double> *old_alpha) {
+    const std::string ifile = param->rest_args()[0];
+    const std::string model = param->rest_args()[1];
+    const double C = param->get<double>("cost");
+    const double eta = param->get<double>("eta");
+    const size_t eval_size = param->get<size_t>("eval-size");
+    const size_t unk_eval_size = param->get<size_t>("unk-eval-size");
+    const size_t thread_num = param->get<size_t>("thread");
+    const size_t freq = param->get<size_t>("freq");
+    const size_t batch_size = param->get<size_t>("batch-size");
+    const size_t epoch = param->get<size_t>("epoch");
+    const double rate = param->get<double>("learning-rate");
+    const std::string reg = param->get<std::string>("regularization");
+    const bool l1 = (reg == "L1" || reg == "EN");
+    const bool l2 = (reg == "L2" || reg == "EN");
+    const double C1 = param->get<double>("l1-cost");
+
+    CHECK_DIE(batch_size > 0) << "batch-size is out of range: " << batch_size;
+    CHECK_DIE(epoch > 0) << "epoch is out of range: " << epoch;
+    CHECK_DIE(rate > 0) << "learning-rate is out of range: " << rate;
 
-      if (ret == 0) {
+    Allocator<LearnerNode, LearnerPath> allocator;
+    std::vector<double> observed;
+    size_t sentence_num = 0;
+
+    std::cout << "reading corpus ..." << std::flush;
+
+    {
+      std::ifstream ifs(WPATH(ifile.c_str()));
+      CHECK_DIE(ifs) << "no such file or directory: " << ifile;
+      while (ifs) {
+        EncoderLearnerTagger tagger;
+        CHECK_DIE(tagger.open(tokenizer,
+                              &allocator,
+                              feature_index,
+                              eval_size,
+                              unk_eval_size));
+        CHECK_DIE(tagger.read(&ifs, &observed));
+        if (!tagger.empty() && ++sentence_num % 100 == 0) {
+          std::cout << sentence_num << "... " << std::flush;
+        }
+        allocator.free();
+      }
+    }
+
+    // the feature cache is kept, so that the next passes find every
+    // feature there and never allocate a new id.
+    feature_index->shrink(freq, &observed);
+
+    const size_t psize = feature_index->size();
+    old_alpha->resize(psize);
+    std::vector<double> alpha(*old_alpha);
+    std::vector<double> expected(psize);
+    std::vector<double> sum_grad(psize);
+    observed.resize(psize);
+
+    feature_index->set_alpha(&alpha[0]);
+
+    std::cout << std::endl;
+    std::cout << "Number of sentences: " << sentence_num << std::endl;
+    std::cout << "Number of features:  " << psize     << std::endl;
+    std::cout << "eta:                 " << eta       << std::endl;
+    std::cout << "freq:                " << freq      << std::endl;
+    std::cout << "eval-size:           " << eval_size << std::endl;
+    std::cout << "unk-eval-size:       " << unk_eval_size << std::endl;
+#ifdef MECAB_USE_THREAD
+    std::cout << "threads:             " << thread_num << std::endl;
+#endif
+    std::cout << "batch-size:          " << batch_size << std::endl;
+    std::cout << "learning-rate:       " << rate      << std::endl;
+    std::cout << "regularization:      " << reg       << std::endl;
+    if (l1) {
+      std::cout << "L1 cost:             " << C1        << std::endl;
+    }
+    std::cout << "charset:             " <<
+        tokenizer->dictionary_info()->charset << std::endl;
+    std::cout << "C(sigma^2):          " << C          << std::endl
+              << std::endl;
+
+    std::vector<EncoderLearnerTagger *> batch;
+
+#ifdef MECAB_USE_THREAD
+    std::shared_ptr<learner_pool> pool;
+    if (thread_num > 1) {
+      pool.reset(new learner_pool(thread_num, psize, batch));
+    }
+#endif
+
+    double prev_obj = 0.0;
+
+    for (size_t itr = 0; itr < epoch; ++itr) {
+      std::ifstream ifs(WPATH(ifile.c_str()));
+      CHECK_DIE(ifs) << "no such file or directory: " << ifile;
+
+      double obj = 0.0;
+      size_t err = 0;
+      size_t micro_p = 0;
+      size_t micro_r = 0;
+      size_t micro_c = 0;
+
+      while (ifs) {
+        std::fill(observed.begin(), observed.end(), 0.0);
+        while (ifs && batch.size() < batch_size) {
+          EncoderLearnerTagger *tagger = new EncoderLearnerTagger();
+          CHECK_DIE(tagger->open(tokenizer,
+                                 &allocator,
+                                 feature_index,
+                                 eval_size,
+                                 unk_eval_size));
+          CHECK_DIE(tagger->read(&ifs, &observed));
+          if (!tagger->empty()) {
+            batch.push_back(tagger);
+          } else {
+            delete tagger;
+          }
+        }
+
+        CHECK_DIE(feature_index->size() == psize && observed.size() == psize)
+            << "corpus has been changed while training: " << ifile;
+
+        if (batch.empty()) {
+          break;
+        }
+
+        std::fill(expected.begin(), expected.end(), 0.0);
+
+#ifdef MECAB_USE_THREAD
+        if (pool.get()) {
+          pool->prepare();
+          pool->gradient(&expected[0], &obj, &err,
+                         &micro_c, &micro_p, &micro_r);
+        } else
+#endif
+        {
+          for (size_t i = 0; i < batch.size(); ++i) {
+            obj += batch[i]->gradient(&expected[0]);
+            err += batch[i]->eval(&micro_c, &micro_p, &micro_r);
+          }
+        }
+
+        // the regularizer is split over the batches by their size. The
+        // L1 term is applied by truncating the weights towards zero.
+        const double scale = 1.0 * batch.size() / sentence_num;
+        for (size_t i = 0; i < psize; ++i) {
+          double g = expected[i] - observed[i];
+          if (l2) {
+            g += scale * (alpha[i] - (*old_alpha)[i]) / C;
+          }
+          sum_grad[i] += g * g;
+          if (sum_grad[i] == 0.0) {
+            continue;
+          }
+          const double step = rate / std::sqrt(sum_grad[i]);
+          alpha[i] -= step * g;
+          if (l1) {
+            const double t = step * scale / C1;
+            alpha[i] = alpha[i] > t ? alpha[i] - t :
+                alpha[i] < -t ? alpha[i] + t : 0.0;
+          }
+        }
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+          delete batch[i];
+        }
+        batch.clear();
+        allocator.free();
+      }
+
+      for (size_t i = 0; i < psize; ++i) {
+        const double penalty = (alpha[i] - (*old_alpha)[i]);
+        if (l2) {
+          obj += (penalty * penalty / (2.0 * C));
+        }
+        if (l1) {
+          obj += std::fabs(alpha[i]) / C1;
+        }
+      }
+
+      const double p = 1.0 * micro_c / micro_p;
+      const double r = 1.0 * micro_c / micro_r;
+      const double micro_f = 2 * p * r / (p + r);
+
+      const double diff = (itr == 0 ? 1.0 :
+                           std::fabs(1.0 * (prev_obj - obj)) / prev_obj);
+      std::cout << "epoch="   << itr
+                << " err="    << 1.0 * err / sentence_num
+                << " F="      << micro_f
+                << " target=" << obj
+                << " diff="   << diff << std::endl;
+      prev_obj = obj;
+
+      if (diff < eta) {
         break;
       }
     }
 
     std::cout << "\nDone! writing model file ... " << std::endl;
 
+    return save(*param, tokenizer->dictionary_info()->charset,
+                *feature_index, model);
+  }
+
+  static int save(const Param &param, const char *charset,
+                  const EncoderFeatureIndex &feature_index,
+                  const std::string &model) {
     std::ostringstream oss;
 
-    oss << "eta: "  << eta   << std::endl;
-    oss << "freq: " << freq  << std::endl;
-    oss << "C: "    << C     << std::endl;
+    oss << "eta: "  << param.get<double>("eta")  << std::endl;
+    oss << "freq: " << param.get<size_t>("freq") << std::endl;
+    oss << "C: "    << param.get<double>("cost") << std::endl;
+    if (param.get<size_t>("feature-hash")) {
+      oss << "feature-hash: " << param.get<size_t>("feature-hash")
+          << std::endl;
+    }
     oss.setf(std::ios::fixed, std::ios::floatfield);
     oss.precision(16);
-    oss << "eval-size: " << eval_size << std::endl;
-    oss << "unk-eval-size: " << unk_eval_size << std::endl;
-    oss << "charset: " <<  tokenizer.dictionary_info()->charset << std::endl;
+    oss << "eval-size: " << param.get<size_t>("eval-size") << std::endl;
+    oss << "unk-eval-size: " << param.get<size_t>("unk-eval-size")
+        << std::endl;
+    oss << "charset: " << charset << std::endl;
 
     const std::string header = oss.str();
 
-    CHECK_DIE(feature_index.save(model.c_str(), header.c_str()))
+    // weights not greater than the threshold are left out of the model.
+    const std::string prune = param.get<std::string>("prune");
+    const double threshold = prune.empty() ? -1.0 : std::atof(prune.c_str());
+
+    CHECK_DIE(feature_index.save(model.c_str(), header.c_str(), threshold))
         << "permission denied: " << model;
 
     return 0;
@@ -291,11 +703,27 @@ class Learner {
         "set FILE as old CRF model file" },
       { "cost",     'c',  "1.0",   "FLOAT",
         "set FLOAT for cost C for constraints violatoin" },
+      { "regularization", 'a', "L2", "TYPE",
+        "set L1, L2 or EN (elastic-net) as regularization (default L2)" },
+      { "l1-cost",  'l',  "1.0",   "FLOAT",
+        "set FLOAT for cost C of the L1 term with -a L1 or EN (default 1.0)" },
+      { "prune",    'P',  0,       "FLOAT",
+        "drop the weights whose absolute value is at most FLOAT" },
       { "freq",     'f',  "1",     "INT",
         "set the frequency cut-off (default 1)" },
       { "eta",      'e',  "0.00005", "DIR",
         "set FLOAT for tolerance of termination criterion" },
       { "thread",   'p',  "1",     "INT",    "number of threads(default 1)" },
+      { "feature-hash", 'H', 0,    "INT",
+        "hash features into 2^INT weights instead of a dictionary" },
+      { "online",   'O',  0,       0,
+        "train online with mini-batch AdaGrad" },
+      { "batch-size", 'b', "1000", "INT",
+        "set INT as the mini-batch size of online training (default 1000)" },
+      { "epoch",    'i',  "10",    "INT",
+        "set INT as the max epochs of online training (default 10)" },
+      { "learning-rate", 'r', "0.1", "FLOAT",
+        "set FLOAT as the learning rate of online training (default 0.1)" },
       { "version",  'v',  0,   0,  "show the version and exit"  },
       { "help",     'h',  0,   0,  "show this help and exit."      },
       { 0, 0, 0, 0 }
@@ -389,6 +389,18 @@ bool LearnerTagger::viterbi() {
   return true;
 }
 
+size_t EncoderLearnerTagger::path_size() const {
+  size_t size = 0;
+  for (size_t pos = 0; pos <= len_; ++pos) {
+    for (LearnerNode *node = begin_node_list_[pos]; node; node = node->bnext) {
+      for (LearnerPath *path = node->lpath; path; path = path->lnext) {
+        ++size;
+      }
+    }
+  }
+  return size;
+}
+
 double EncoderLearnerTagger::gradient(double *expected) {
   viterbi();
 
@@ -54,6 +54,7 @@ class EncoderLearnerTagger: public LearnerTagger {
   bool read(std::istream *, std::vector<double> *);
   int eval(size_t *, size_t *, size_t *) const;
   double gradient(double *expected);
+  size_t path_size() const;
   explicit EncoderLearnerTagger(): eval_size_(1024), unk_eval_size_(1024) {}
   virtual ~EncoderLearnerTagger() { close(); }
 
@@ -251,6 +251,62 @@ int mecab_parse_lattice(mecab_t *mecab, mecab_lattice_t *lattice) {
           reinterpret_cast<MeCab::Lattice *>(lattice)));
 }
 
+size_t mecab_record_parse(const void *data, size_t size,
+                          mecab_record_t *record) {
+  const mecab_record_header_t *header =
+      reinterpret_cast<const mecab_record_header_t *>(data);
+  if (!data || !record || size < sizeof(*header) ||
+      header->magic != MECAB_RECORD_MAGIC ||
+      header->size < sizeof(*header) || header->size > size ||
+      header->size % 4 != 0) {
+    return 0;
+  }
+
+  // each term is checked against the rest so that the sum cannot wrap.
+  size_t rest = header->size - sizeof(*header);
+  if (header->token_size > rest / sizeof(mecab_record_token_t)) {
+    return 0;
+  }
+  rest -= header->token_size * sizeof(mecab_record_token_t);
+  if (header->sentence_length > rest ||
+      header->feature_size > rest - header->sentence_length) {
+    return 0;
+  }
+
+  const char *ptr = reinterpret_cast<const char *>(data) + sizeof(*header);
+  const mecab_record_token_t *tokens =
+      reinterpret_cast<const mecab_record_token_t *>(ptr);
+  ptr += header->token_size * sizeof(mecab_record_token_t);
+  const char *sentence = ptr;
+  ptr += header->sentence_length;
+  const char *features = ptr;
+
+  // the surfaces must lie in the sentence and the features must be
+  // NUL-terminated strings in the feature area.
+  for (unsigned int i = 0; i < header->token_size; ++i) {
+    const mecab_record_token_t &token = tokens[i];
+    if (token.begin > header->sentence_length ||
+        token.length > header->sentence_length - token.begin ||
+        token.rlength < token.length ||
+        token.rlength - token.length > token.begin ||
+        token.feature_offset >= header->feature_size ||
+        token.feature_length >=
+        header->feature_size - token.feature_offset ||
+        features[token.feature_offset + token.feature_length] != '\0') {
+      return 0;
+    }
+  }
+
+  record->tokens = tokens;
+  record->token_size = header->token_size;
+  record->sentence = sentence;
+  record->sentence_length = header->sentence_length;
+  record->features = features;
+  record->feature_size = header->feature_size;
+
+  return header->size;
+}
+
 mecab_lattice_t *mecab_lattice_new() {
   return reinterpret_cast<mecab_lattice_t *>(MeCab::createLattice());
 }
@@ -320,6 +376,11 @@ size_t mecab_lattice_get_size(mecab_lattice_t *lattice) {
   return reinterpret_cast<MeCab::Lattice *>(lattice)->size();
 }
 
+const mecab_span_t *mecab_lattice_get_best_path_spans(
+    mecab_lattice_t *lattice, size_t *size) {
+  return reinterpret_cast<MeCab::Lattice *>(lattice)->best_path_spans(size);
+}
+
 double mecab_lattice_get_z(mecab_lattice_t *lattice) {
   return reinterpret_cast<MeCab::Lattice *>(lattice)->Z();
 }
@@ -424,6 +485,15 @@ void mecab_lattice_set_feature_constraint(mecab_lattice_t *lattice,
       lattice)->set_feature_constraint(begin_pos, end_pos, feature);
 }
 
+void mecab_lattice_set_feature_pattern(mecab_lattice_t *lattice,
+                                       size_t begin_pos, size_t end_pos,
+                                       const mecab_feature_pattern_t *pattern) {
+  return reinterpret_cast<MeCab::Lattice *>(
+      lattice)->set_feature_pattern(
+          begin_pos, end_pos,
+          reinterpret_cast<const MeCab::FeaturePattern *>(pattern));
+}
+
 void mecab_lattice_set_result(mecab_lattice_t *lattice,
                               const char *result) {
   return reinterpret_cast<MeCab::Lattice *>(lattice)->set_result(result);
@@ -433,6 +503,11 @@ const char *mecab_lattice_strerror(mecab_lattice_t *lattice) {
   return reinterpret_cast<MeCab::Lattice *>(lattice)->what();
 }
 
+int mecab_lattice_is_degraded(mecab_lattice_t *lattice) {
+  return static_cast<int>(
+      reinterpret_cast<MeCab::Lattice *>(lattice)->is_degraded());
+}
+
 mecab_model_t *mecab_model_new(int argc, char **argv) {
   MeCab::Model *model = MeCab::createModel(argc, argv);
   if (!model) {
@@ -451,6 +526,17 @@ mecab_model_t *mecab_model_new2(const char *arg) {
   return reinterpret_cast<mecab_model_t *>(model);
 }
 
+mecab_feature_pattern_t *mecab_model_new_feature_pattern(
+    mecab_model_t *model, const char *feature) {
+  return reinterpret_cast<mecab_feature_pattern_t *>(
+      reinterpret_cast<MeCab::Model *>(model)->createFeaturePattern(feature));
+}
+
+void mecab_feature_pattern_destroy(mecab_feature_pattern_t *pattern) {
+  MeCab::deleteFeaturePattern(
+      reinterpret_cast<MeCab::FeaturePattern *>(pattern));
+}
+
 void mecab_model_destroy(mecab_model_t *model) {
   MeCab::Model *ptr = reinterpret_cast<MeCab::Model *>(model);
   MeCab::deleteModel(ptr);
@@ -486,6 +572,10 @@ int mecab_model_transition_cost(mecab_model_t *model,
       rcAttr, lcAttr);
 }
 
+void mecab_model_stats(mecab_model_t *model, mecab_stats_t *stats) {
+  *stats = reinterpret_cast<MeCab::Model *>(model)->stats();
+}
+
 mecab_node_t *mecab_model_lookup(mecab_model_t *model,
                                  const char *begin,
                                  const char *end,
@@ -311,7 +311,13 @@ enum {
    * When this flag is set, tagger internally copies the body of passed
    * sentence into internal buffer.
    */
-  MECAB_ALLOCATE_SENTENCE = 64
+  MECAB_ALLOCATE_SENTENCE = 64,
+
+  /**
+   * Set this flag if you want to obtain the best path as an array
+   * of spans from MeCab::Lattice::best_path_spans().
+   */
+  MECAB_BEST_PATH_SPANS   = 128
 };
 
 /**
@@ -334,6 +340,236 @@ enum {
   MECAB_INSIDE_TOKEN = 2
 };
 
+/**
+ * Magic number of a record written by output-format-type "binary" ("MCBR").
+ */
+#define MECAB_RECORD_MAGIC 0x5242434dU
+
+/**
+ * Header of a binary record.
+ * A record is laid out as the header, |token_size| token entries,
+ * the sentence and the NUL-terminated features, padded to 4 bytes.
+ * All integers are stored in host byte order.
+ */
+struct mecab_record_header_t {
+  /**
+   * MECAB_RECORD_MAGIC
+   */
+  unsigned int magic;
+
+  /**
+   * total size of this record in bytes, including the header
+   */
+  unsigned int size;
+
+  /**
+   * number of tokens
+   */
+  unsigned int token_size;
+
+  /**
+   * length of the sentence in bytes
+   */
+  unsigned int sentence_length;
+
+  /**
+   * size of the feature area in bytes
+   */
+  unsigned int feature_size;
+};
+
+/**
+ * Token entry of a binary record.
+ */
+struct mecab_record_token_t {
+  /**
+   * byte offset of the surface in the sentence
+   */
+  unsigned int   begin;
+
+  /**
+   * length of the surface
+   */
+  unsigned short length;
+
+  /**
+   * length of the surface including white spaces before the morph
+   */
+  unsigned short rlength;
+
+  /**
+   * part-of-speech id
+   */
+  unsigned short posid;
+
+  /**
+   * left attribute id
+   */
+  unsigned short lcAttr;
+
+  /**
+   * right attribute id
+   */
+  unsigned short rcAttr;
+
+  /**
+   * character type
+   */
+  unsigned char  char_type;
+
+  /**
+   * status of this node (MECAB_NOR_NODE or MECAB_UNK_NODE)
+   */
+  unsigned char  stat;
+
+  /**
+   * word cost
+   */
+  short          wcost;
+
+  /**
+   * always 0
+   */
+  short          reserved;
+
+  /**
+   * best accumulative cost from bos node to this node
+   */
+  int            cost;
+
+  /**
+   * offset of the feature in the feature area
+   */
+  unsigned int   feature_offset;
+
+  /**
+   * length of the feature without the terminating NUL
+   */
+  unsigned int   feature_length;
+};
+
+/**
+ * Token span of the best path. See MeCab::Lattice::best_path_spans().
+ */
+struct mecab_span_t {
+  /**
+   * byte offset of the surface in the sentence
+   */
+  unsigned int   begin;
+
+  /**
+   * length of the surface
+   */
+  unsigned short length;
+
+  /**
+   * length of the surface including white spaces before the morph
+   */
+  unsigned short rlength;
+
+  /**
+   * part-of-speech id
+   */
+  unsigned short posid;
+
+  /**
+   * left attribute id
+   */
+  unsigned short lcAttr;
+
+  /**
+   * right attribute id
+   */
+  unsigned short rcAttr;
+
+  /**
+   * character type
+   */
+  unsigned char  char_type;
+
+  /**
+   * status of this node (MECAB_NOR_NODE or MECAB_UNK_NODE)
+   */
+  unsigned char  stat;
+
+  /**
+   * word cost
+   */
+  short          wcost;
+
+  /**
+   * best accumulative cost from bos node to this node
+   */
+  int            cost;
+
+  /**
+   * feature string, owned by the dictionary
+   */
+  const char    *feature;
+};
+
+/**
+ * Decoded view of a binary record. All pointers refer to the
+ * buffer passed to mecab_record_parse().
+ */
+struct mecab_record_t {
+  const struct mecab_record_token_t *tokens;
+  unsigned int                       token_size;
+  const char                        *sentence;
+  unsigned int                       sentence_length;
+  const char                        *features;
+  unsigned int                       feature_size;
+};
+
+/**
+ * Counters of the analysis collected by a model opened with --stats.
+ * See MeCab::Model::stats(). Cycles are time stamp counter cycles on
+ * x86 and nanoseconds elsewhere.
+ */
+struct mecab_stats_t {
+  /**
+   * number of analyzed sentences and their total size in bytes
+   */
+  unsigned long long sentences;
+  unsigned long long bytes;
+
+  /**
+   * number of dictionary lookups, i.e. positions reached by the search
+   */
+  unsigned long long lookups;
+
+  /**
+   * nodes found by the double-array prefix search and unknown word nodes
+   */
+  unsigned long long dictionary_nodes;
+  unsigned long long unknown_nodes;
+
+  /**
+   * number of connections (left node, right node) evaluated
+   */
+  unsigned long long paths;
+
+  /**
+   * sentences whose work budget ran out. See Lattice::is_degraded().
+   */
+  unsigned long long degraded;
+
+  /**
+   * number of Writer calls and the bytes they wrote
+   */
+  unsigned long long writes;
+  unsigned long long written_bytes;
+
+  /**
+   * cycles spent in the whole analysis and in its phases
+   */
+  unsigned long long analyze_cycles;
+  unsigned long long lookup_cycles;
+  unsigned long long connect_cycles;
+  unsigned long long forwardbackward_cycles;
+  unsigned long long write_cycles;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -359,9 +595,15 @@ extern "C" {
   typedef struct mecab_t                 mecab_t;
   typedef struct mecab_model_t           mecab_model_t;
   typedef struct mecab_lattice_t         mecab_lattice_t;
+  typedef struct mecab_feature_pattern_t mecab_feature_pattern_t;
   typedef struct mecab_dictionary_info_t mecab_dictionary_info_t;
   typedef struct mecab_node_t            mecab_node_t;
   typedef struct mecab_path_t            mecab_path_t;
+  typedef struct mecab_record_header_t   mecab_record_header_t;
+  typedef struct mecab_record_token_t    mecab_record_token_t;
+  typedef struct mecab_record_t          mecab_record_t;
+  typedef struct mecab_span_t            mecab_span_t;
+  typedef struct mecab_stats_t           mecab_stats_t;
 
 #ifndef SWIG
   /* C interface */
@@ -592,6 +834,11 @@ extern "C" {
    */
   MECAB_DLL_EXTERN size_t           mecab_lattice_get_size(mecab_lattice_t *lattice);
 
+  /**
+   * C wrapper of MeCab::Lattice::best_path_spans()
+   */
+  MECAB_DLL_EXTERN const mecab_span_t *mecab_lattice_get_best_path_spans(mecab_lattice_t *lattice, size_t *size);
+
   /**
    * C wrapper of MeCab::Lattice::Z()
    */
@@ -696,6 +943,11 @@ extern "C" {
    */
   MECAB_DLL_EXTERN void            mecab_lattice_set_feature_constraint(mecab_lattice_t *lattice, size_t begin_pos, size_t end_pos, const char *feature);
 
+  /**
+   * C wrapper of MeCab::Lattice::set_feature_pattern(begin_pos, end_pos, pattern)
+   */
+  MECAB_DLL_EXTERN void            mecab_lattice_set_feature_pattern(mecab_lattice_t *lattice, size_t begin_pos, size_t end_pos, const mecab_feature_pattern_t *pattern);
+
   /**
    * C wrapper of MeCab::Lattice::set_result(result);
    */
@@ -706,6 +958,11 @@ extern "C" {
    */
   MECAB_DLL_EXTERN const char      *mecab_lattice_strerror(mecab_lattice_t *lattice);
 
+  /**
+   * C wrapper of MeCab::Lattice::is_degraded()
+   */
+  MECAB_DLL_EXTERN int              mecab_lattice_is_degraded(mecab_lattice_t *lattice);
+
 
   /* model interface */
   /**
@@ -724,6 +981,16 @@ extern "C" {
 
   MECAB_DLL_EXTERN void             mecab_model_destroy(mecab_model_t *model);
 
+  /**
+   * C wapper of MeCab::Model::createFeaturePattern(feature)
+   */
+  MECAB_DLL_EXTERN mecab_feature_pattern_t *mecab_model_new_feature_pattern(mecab_model_t *model, const char *feature);
+
+  /**
+   * C wapper of MeCab::deleteFeaturePattern(pattern)
+   */
+  MECAB_DLL_EXTERN void             mecab_feature_pattern_destroy(mecab_feature_pattern_t *pattern);
+
   /**
    * C wapper of MeCab::Model::createTagger()
    */
@@ -759,6 +1026,21 @@ extern "C" {
                                                     const char *end,
                                                     mecab_lattice_t *lattice);
 
+  /**
+   * C wrapper of MeCab::Model::stats()
+   */
+  MECAB_DLL_EXTERN void mecab_model_stats(mecab_model_t *model,
+                                          mecab_stats_t *stats);
+
+  /**
+   * Decode the binary record at the head of |data| without copying.
+   * Return the size of the record, or 0 if |data| does not hold a
+   * complete record or a token points outside of the record.
+   * |data| must be 4-byte aligned.
+   */
+  MECAB_DLL_EXTERN size_t mecab_record_parse(const void *data, size_t size,
+                                             mecab_record_t *record);
+
   /* static functions */
   MECAB_DLL_EXTERN int           mecab_do(int argc, char **argv);
   MECAB_DLL_EXTERN int           mecab_dict_index(int argc, char **argv);
@@ -766,6 +1048,7 @@ extern "C" {
   MECAB_DLL_EXTERN int           mecab_cost_train(int argc, char **argv);
   MECAB_DLL_EXTERN int           mecab_system_eval(int argc, char **argv);
   MECAB_DLL_EXTERN int           mecab_test_gen(int argc, char **argv);
+  MECAB_DLL_EXTERN int           mecab_bench(int argc, char **argv);
 #endif
 
 #ifdef __cplusplus
@@ -779,9 +1062,12 @@ namespace MeCab {
 typedef struct mecab_dictionary_info_t DictionaryInfo;
 typedef struct mecab_path_t            Path;
 typedef struct mecab_node_t            Node;
+typedef struct mecab_span_t            Span;
+typedef struct mecab_stats_t           Stats;
 
 template <typename N, typename P> class Allocator;
 class Tagger;
+class FeaturePattern;
 
 /**
  * Lattice class
@@ -1065,6 +1351,72 @@ public:
 #endif
 
   virtual ~Lattice() {}
+
+  /**
+   * Set parsing constraint with a compiled feature pattern.
+   * Candidates are matched against the pre-split columns of |pattern|
+   * instead of parsing the constraint for every node.
+   * @param begin_pos the starting position of the constrained token.
+   * @param end_pos the the ending position of the constrained token.
+   * @param pattern pattern created by Model::createFeaturePattern().
+   * It must outlive the parsing of this lattice.
+   */
+  virtual void set_feature_pattern(size_t begin_pos, size_t end_pos,
+                                   const FeaturePattern *pattern);
+
+  /**
+   * Returns the compiled pattern at the position.
+   * @param pos the beginning position of constraint.
+   * @return pattern, or NULL if the constraint is not compiled.
+   */
+  virtual const FeaturePattern *feature_pattern(size_t pos) const {
+    return 0;
+  }
+
+  /**
+   * Return the best path as a contiguous array of spans, from the first
+   * token to the last one. The array is only built for lattices with the
+   * MECAB_BEST_PATH_SPANS request type, and is valid until the lattice is
+   * parsed again or cleared.
+   * @param size the number of spans is stored
+   * @return array of spans, or NULL if the best path is empty
+   */
+  virtual const Span *best_path_spans(size_t *size) const {
+    *size = 0;
+    return 0;
+  }
+
+  /**
+   * Return true if the work budget of the model (--max-nodes,
+   * --max-paths, --max-time) ran out. The best path is then a cheap
+   * segmentation into runs of the same character type and what() tells
+   * which limit was hit. An N-best search that stops early at
+   * --nbest-max-candidates or --max-time only sets what().
+   * @return boolean
+   */
+  virtual bool is_degraded() const {
+    return false;
+  }
+
+  /**
+   * Set the degraded flag. Lattice::set_sentence() clears it.
+   * @param degraded flag
+   */
+  virtual void set_degraded(bool degraded) {}
+};
+
+/**
+ * Compiled feature constraint
+ */
+class MECAB_DLL_CLASS_EXTERN FeaturePattern {
+ public:
+  /**
+   * Return the feature constraint this pattern was compiled from.
+   * @return feature string
+   */
+  virtual const char *feature() const = 0;
+
+  virtual ~FeaturePattern() {}
 };
 
 /**
@@ -1128,6 +1480,29 @@ public:
 
   virtual ~Model() {}
 
+  /**
+   * Compile a CSV feature constraint for Lattice::set_feature_pattern().
+   * "*" columns match anything. The other columns are looked up in the
+   * dictionaries of this model once.
+   * The pattern must be deleted with deleteFeaturePattern().
+   * @param feature feature constraint
+   * @return new FeaturePattern object, or NULL if not supported
+   */
+  virtual FeaturePattern *createFeaturePattern(const char *feature) const {
+    return 0;
+  }
+
+  /**
+   * Return the counters of the analysis merged over all threads.
+   * They are collected only when the model is opened with --stats,
+   * and are all zero otherwise.
+   * @return counters
+   */
+  virtual Stats stats() const {
+    Stats stats = {};
+    return stats;
+  }
+
 #ifndef SWIG
   /**
    * Factory method to create a new Model with a specified main's argc/argv-style parameters.
@@ -1489,6 +1864,12 @@ MECAB_DLL_EXTERN void        deleteLattice(Lattice *lattice);
  */
 MECAB_DLL_EXTERN void        deleteModel(Model *model);
 
+/**
+ * delete FeaturePattern object.
+ * @param pattern pattern object
+ */
+MECAB_DLL_EXTERN void        deleteFeaturePattern(FeaturePattern *pattern);
+
 /**
  * delete Tagger object.
  * This method calles "delete tagger".
@@ -3,47 +3,157 @@
 //
 //  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
-#include <queue>
+#include <algorithm>
 #include "mecab.h"
+#include "common.h"
+#include "file.h"
+#include "utils.h"
+#include "connector.h"
 #include "nbest_generator.h"
 
 namespace MeCab {
 
-bool NBestGenerator::set(Lattice *lattice) {
+bool NBestGenerator::set(Lattice *lattice, const Connector *connector,
+                         size_t agenda_size, int unique,
+                         size_t max_candidates,
+                         const WorkBudget &budget) {
   freelist_.free();
-  while (!agenda_.empty()) {
-    agenda_.pop();   // make empty
-  }
-  QueueElement *eos = freelist_.alloc();
+  agenda_.clear();
+  spare_.clear();
+  results_.clear();
+  lattice_ = lattice;
+  connector_ = connector;
+  agenda_size_ = agenda_size;
+  unique_ = unique;
+  max_candidates_ = max_candidates;
+  budget_ = budget;
+  pushed_ = 0;
+  found_ = 0;
+  QueueElement *eos = newElement();
   eos->node = lattice->eos_node();
   eos->next = 0;
   eos->fx = eos->gx = 0;
-  agenda_.push(eos);
+  push(eos);
   return true;
 }
 
+NBestGenerator::QueueElement *NBestGenerator::newElement() {
+  if (spare_.empty()) {
+    return freelist_.alloc();
+  }
+  QueueElement *element = spare_.back();
+  spare_.pop_back();
+  return element;
+}
+
+void NBestGenerator::push(QueueElement *element) {
+  ++pushed_;
+  agenda_.push_back(element);
+  std::push_heap(agenda_.begin(), agenda_.end(), QueueElementComp());
+  if (agenda_size_ > 0 && agenda_.size() >= 2 * agenda_size_) {
+    shrink();
+  }
+}
+
+// Drops all but the best |agenda_size_| candidates. Queued elements are
+// never referenced by others, so the dropped ones are reused.
+void NBestGenerator::shrink() {
+  // QueueElementComp orders by descending fx; the best ones are at the end.
+  const size_t drop = agenda_.size() - agenda_size_;
+  std::nth_element(agenda_.begin(), agenda_.begin() + drop,
+                   agenda_.end(), QueueElementComp());
+  spare_.insert(spare_.end(), agenda_.begin(), agenda_.begin() + drop);
+  agenda_.erase(agenda_.begin(), agenda_.begin() + drop);
+  std::make_heap(agenda_.begin(), agenda_.end(), QueueElementComp());
+}
+
+bool NBestGenerator::isDuplicated(const QueueElement *bos) {
+  const char *sentence = lattice_->sentence();
+  std::string key;
+  for (const QueueElement *n = bos->next; n->next; n = n->next) {
+    const Node *node = n->node;
+    const size_t begin = node->surface - sentence;
+    key.append(reinterpret_cast<const char *>(&begin), sizeof(begin));
+    key.append(reinterpret_cast<const char *>(&node->length),
+               sizeof(node->length));
+    const char *feature = node->feature;
+    const char *end = feature;
+    for (int column = 0; column < unique_ && *end; ++end) {
+      if (*end == ',' && ++column == unique_) {
+        break;
+      }
+    }
+    key.append(feature, end - feature);
+    key.push_back('\0');
+  }
+  return !results_.insert(key).second;
+}
+
 bool NBestGenerator::next() {
   while (!agenda_.empty()) {
-    QueueElement *top = agenda_.top();
-    agenda_.pop();
+    std::pop_heap(agenda_.begin(), agenda_.end(), QueueElementComp());
+    QueueElement *top = agenda_.back();
+    agenda_.pop_back();
     Node *rnode = top->node;
 
+    // the results so far stand; only the best path can be degraded.
+    // The first result, the best path, is always found.
+    const char *what = !found_ ? 0 :
+        max_candidates_ > 0 && pushed_ > max_candidates_ ?
+        "N-best search stopped: nbest-max-candidates" :
+        budget_.exceeded(0, 0);
+    if (what) {
+      lattice_->set_what(what);
+      agenda_.clear();
+      return false;
+    }
+
     if (rnode->stat == MECAB_BOS_NODE) {  // BOS
+      if (unique_ >= 0 && isDuplicated(top)) {
+        continue;
+      }
       for (QueueElement *n = top; n->next; n = n->next) {
         n->node->next = n->next->node;   // change next & prev
         n->next->node->prev = n->node;
         // TODO: rewrite costs;
       }
+      ++found_;
       return true;
     }
 
+    if (connector_) {
+      // left nodes end where |rnode| begins, including its white spaces.
+      const char *sentence = lattice_->sentence();
+      long pos = static_cast<long>(rnode->surface + rnode->length -
+                                   sentence) - rnode->rlength;
+      if (rnode->stat == MECAB_EOS_NODE) {
+        while (pos > 0 && !lattice_->end_nodes(pos)) {
+          --pos;
+        }
+      }
+      for (Node *lnode = lattice_->end_nodes(pos); lnode;
+           lnode = lnode->enext) {
+        if (lnode == rnode) {  // eos is linked into its own end list
+          continue;
+        }
+        const int lcost = connector_->cost(lnode, rnode);
+        QueueElement *n = newElement();
+        n->node = lnode;
+        n->gx = lcost + top->gx;
+        n->fx = lnode->cost + lcost + top->gx;
+        n->next = top;
+        push(n);
+      }
+      continue;
+    }
+
     for (Path *path = rnode->lpath; path; path = path->lnext) {
-      QueueElement *n = freelist_.alloc();
+      QueueElement *n = newElement();
       n->node = path->lnode;
       n->gx = path->cost + top->gx;
       n->fx = path->lnode->cost + path->cost + top->gx;
       n->next = top;
-      agenda_.push(n);
+      push(n);
     }
   }
 
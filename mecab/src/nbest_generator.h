@@ -6,12 +6,17 @@
 #ifndef MECAB_NBEST_GENERATOR_H_
 #define MECAB_NBEST_GENERATOR_H_
 
-#include <queue>
+#include <set>
+#include <string>
+#include <vector>
 #include "mecab.h"
+#include "budget.h"
 #include "freelist.h"
 
 namespace MeCab {
 
+class Connector;
+
 class NBestGenerator {
  private:
   struct QueueElement {
@@ -28,14 +33,45 @@ class NBestGenerator {
     }
   };
 
-  std::priority_queue<QueueElement *, std::vector<QueueElement *>,
-                      QueueElementComp> agenda_;
+  // binary heap ordered by QueueElementComp
+  std::vector<QueueElement *> agenda_;
+  std::vector<QueueElement *> spare_;
   FreeList <QueueElement> freelist_;
+  Lattice *lattice_;
+  const Connector *connector_;
+  size_t agenda_size_;
+  int unique_;
+  size_t max_candidates_;
+  std::set<std::string> results_;
+  WorkBudget budget_;
+  size_t pushed_;
+  size_t found_;
+
+  QueueElement *newElement();
+  void push(QueueElement *element);
+  void shrink();
+  bool isDuplicated(const QueueElement *bos);
 
  public:
-  explicit NBestGenerator() : freelist_(512) {}
+  explicit NBestGenerator()
+      : freelist_(512), lattice_(0), connector_(0),
+        agenda_size_(0), unique_(-1), max_candidates_(0), pushed_(0),
+        found_(0) {}
   virtual ~NBestGenerator() {}
-  bool set(Lattice *lattice);
+
+  // Left nodes are read from lpath unless |connector| is given, in which
+  // case they are taken from end_nodes() and costed on demand.
+  // |agenda_size| > 0 keeps only that many best candidates.
+  // |unique| >= 0 skips results whose segmentation and first |unique|
+  // feature columns have already been returned.
+  // After the first result, the search gives up, setting what() of the
+  // lattice, once it has queued more than |max_candidates| > 0 or run
+  // out of the time of |budget|; |budget| is started by the caller, so
+  // the search and the N-best share one deadline.
+  bool set(Lattice *lattice, const Connector *connector = 0,
+           size_t agenda_size = 0, int unique = -1,
+           size_t max_candidates = 0,
+           const WorkBudget &budget = WorkBudget());
   bool next();
 };
 }
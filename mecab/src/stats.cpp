@@ -0,0 +1,125 @@
+//  MeCab -- Yet Another Part-of-Speech and Morphological Analyzer
+//
+//
+//  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
+//  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include "stats.h"
+
+namespace MeCab {
+
+namespace {
+std::atomic<unsigned long long> g_thread_blocks_id(0);
+
+// The blocks of this thread by ThreadBlocks id. Ids are never reused,
+// so the entry of a deleted ThreadBlocks is never looked up again; it
+// expires with the blocks of its owner and is dropped by the next add.
+struct ThreadBlock {
+  unsigned long long  id;
+  void               *block;
+  std::weak_ptr<void> owned;
+};
+
+thread_local std::vector<ThreadBlock> g_thread_blocks;
+
+void print_phase(std::ostream *os, const char *name,
+                 unsigned long long cycles, const Stats &stats) {
+  const double sentences = static_cast<double>(
+      stats.sentences ? stats.sentences : 1);
+  const double total = static_cast<double>(
+      stats.analyze_cycles + stats.write_cycles ?
+      stats.analyze_cycles + stats.write_cycles : 1);
+  *os << std::left << std::setw(18) << name << std::right
+      << std::setw(16) << cycles
+      << std::setw(14) << std::fixed << std::setprecision(1)
+      << cycles / sentences
+      << std::setw(8) << 100.0 * cycles / total << "%\n";
+}
+}  // namespace
+
+void add_stats(Stats *to, const Stats &from) {
+  to->sentences              += from.sentences;
+  to->bytes                  += from.bytes;
+  to->lookups                += from.lookups;
+  to->dictionary_nodes       += from.dictionary_nodes;
+  to->unknown_nodes          += from.unknown_nodes;
+  to->paths                  += from.paths;
+  to->degraded               += from.degraded;
+  to->writes                 += from.writes;
+  to->written_bytes          += from.written_bytes;
+  to->analyze_cycles         += from.analyze_cycles;
+  to->lookup_cycles          += from.lookup_cycles;
+  to->connect_cycles         += from.connect_cycles;
+  to->forwardbackward_cycles += from.forwardbackward_cycles;
+  to->write_cycles           += from.write_cycles;
+}
+
+unsigned long long new_thread_blocks_id() {
+  return ++g_thread_blocks_id;
+}
+
+void *find_thread_block(unsigned long long id) {
+  for (size_t i = 0; i < g_thread_blocks.size(); ++i) {
+    if (g_thread_blocks[i].id == id) {
+      return g_thread_blocks[i].block;
+    }
+  }
+  return 0;
+}
+
+void add_thread_block(unsigned long long id,
+                      const std::shared_ptr<void> &block) {
+  size_t n = 0;
+  for (size_t i = 0; i < g_thread_blocks.size(); ++i) {
+    if (!g_thread_blocks[i].owned.expired()) {
+      g_thread_blocks[n++] = g_thread_blocks[i];
+    }
+  }
+  g_thread_blocks.resize(n);
+  ThreadBlock b = { id, block.get(), block };
+  g_thread_blocks.push_back(b);
+}
+
+void StatsCounter::add(const Stats &stats) {
+  Block *block = blocks_.local();
+  std::lock_guard<std::mutex> lock(block->mutex);
+  add_stats(&block->stats, stats);
+}
+
+void StatsCounter::read(Stats *stats) const {
+  std::memset(stats, 0, sizeof(*stats));
+  const std::vector<std::shared_ptr<Block> > blocks = blocks_.blocks();
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    std::lock_guard<std::mutex> lock(blocks[i]->mutex);
+    add_stats(stats, blocks[i]->stats);
+  }
+}
+
+void print_stats(const Stats &stats, std::ostream *os) {
+  const std::ios::fmtflags flags = os->flags();
+  const unsigned long long other = stats.analyze_cycles -
+      stats.lookup_cycles - stats.connect_cycles -
+      stats.forwardbackward_cycles;
+  *os << "sentences:        " << stats.sentences << "\n"
+      << "bytes:            " << stats.bytes << "\n"
+      << "lookups:          " << stats.lookups << "\n"
+      << "dictionary nodes: " << stats.dictionary_nodes << "\n"
+      << "unknown nodes:    " << stats.unknown_nodes << "\n"
+      << "paths:            " << stats.paths << "\n"
+      << "degraded:         " << stats.degraded << "\n"
+      << "written bytes:    " << stats.written_bytes << "\n"
+#ifdef MECAB_HAVE_RDTSC
+      << "phase                       cycles  per sentence   share\n";
+#else
+      << "phase                           ns  per sentence   share\n";
+#endif
+  print_phase(os, "lookup", stats.lookup_cycles, stats);
+  print_phase(os, "connect", stats.connect_cycles, stats);
+  print_phase(os, "forwardbackward", stats.forwardbackward_cycles, stats);
+  print_phase(os, "other analysis", other, stats);
+  print_phase(os, "write", stats.write_cycles, stats);
+  os->flags(flags);
+}
+}
@@ -0,0 +1,103 @@
+//  MeCab -- Yet Another Part-of-Speech and Morphological Analyzer
+//
+//
+//  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
+//  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#ifndef MECAB_STATS_H_
+#define MECAB_STATS_H_
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "mecab.h"
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define MECAB_HAVE_RDTSC 1
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <x86intrin.h>
+#define MECAB_HAVE_RDTSC 1
+#endif
+
+namespace MeCab {
+
+// Time stamp counter on x86, nanoseconds of the steady clock elsewhere.
+inline unsigned long long read_cycles() {
+#ifdef MECAB_HAVE_RDTSC
+  return __rdtsc();
+#else
+  return static_cast<unsigned long long>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+unsigned long long new_thread_blocks_id();
+void *find_thread_block(unsigned long long id);
+void add_thread_block(unsigned long long id,
+                      const std::shared_ptr<void> &block);
+
+// One T per thread that uses it. local() finds the block of the calling
+// thread without a lock once the thread has created it; blocks() lists
+// the blocks of all threads. The blocks live as long as this object;
+// a thread only keeps a weak reference to its own.
+template <class T>
+class ThreadBlocks {
+ public:
+  T *local() {
+    T *block = static_cast<T *>(find_thread_block(id_));
+    if (block) {
+      return block;
+    }
+    std::shared_ptr<T> new_block(new T);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      new_block->index = blocks_.size();
+      blocks_.push_back(new_block);
+    }
+    add_thread_block(id_, new_block);
+    return new_block.get();
+  }
+
+  std::vector<std::shared_ptr<T> > blocks() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return blocks_;
+  }
+
+  ThreadBlocks() : id_(new_thread_blocks_id()) {}
+
+ private:
+  const unsigned long long id_;
+  mutable std::mutex mutex_;
+  std::vector<std::shared_ptr<T> > blocks_;
+};
+
+void add_stats(Stats *to, const Stats &from);
+
+// Counters of a Model. The analysis accumulates the counters of a
+// sentence on the stack and adds them to a block owned by the calling
+// thread, so that threads never contend on a lock; read() merges the
+// blocks of all threads.
+class StatsCounter {
+ public:
+  void add(const Stats &stats);
+  void read(Stats *stats) const;
+
+ private:
+  struct Block {
+    std::mutex mutex;
+    Stats      stats;
+    size_t     index;
+    Block() : index(0) { std::memset(&stats, 0, sizeof(stats)); }
+  };
+
+  ThreadBlocks<Block> blocks_;
+};
+
+// Prints the counters as the summary of mecab --stats.
+void print_stats(const Stats &stats, std::ostream *os);
+}
+#endif  // MECAB_STATS_H_
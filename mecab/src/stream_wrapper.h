@@ -11,6 +11,11 @@
 #include <iostream>
 #include "utils.h"
 
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 namespace MeCab {
 
 class istream_wrapper {
@@ -38,9 +43,18 @@ class ostream_wrapper {
  public:
   std::ostream &operator*() const  { return *os_; }
   std::ostream *operator->() const { return os_;  }
-  explicit ostream_wrapper(const char* filename): os_(0) {
+  explicit ostream_wrapper(const char* filename, bool binary = false)
+      : os_(0) {
     if (std::strcmp(filename, "-") == 0) {
       os_ = &std::cout;
+#if defined(_WIN32) && !defined(__CYGWIN__)
+      if (binary) {
+        _setmode(_fileno(stdout), _O_BINARY);
+      }
+#endif
+    } else if (binary) {
+      os_ = new std::ofstream(WPATH(filename),
+                              std::ios::binary|std::ios::out);
     } else {
       os_ = new std::ofstream(WPATH(filename));
     }
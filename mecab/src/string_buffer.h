@@ -65,6 +65,7 @@ class StringBuffer {
   }
 
   void clear() { size_ = 0; }
+  size_t size() const { return size_; }
   const char *str() const {
     return error_ ?  0 : const_cast<const char*>(ptr_);
   }
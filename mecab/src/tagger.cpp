@@ -13,10 +13,13 @@
 #include "connector.h"
 #include "nbest_generator.h"
 #include "param.h"
+#include "stats.h"
 #include "stream_wrapper.h"
+#include "tracer.h"
 #include "string_buffer.h"
 #include "thread.h"
 #include "tokenizer.h"
+#include "utils.h"
 #include "viterbi.h"
 #include "writer.h"
 
@@ -44,12 +47,24 @@ const MeCab::Option long_options[] = {
   { "all-morphs",      'a', 0, 0,    "output all morphs(default false)" },
   { "nbest",              'N', "1",
     "INT", "output N best results (default 1)" },
+  { "nbest-agenda-size",  'A', "0",
+    "INT", "keep at most INT candidates in the N-best search (default 0, unlimited)" },
+  { "nbest-unique",       'Q', 0, "TYPE",
+    "skip N-best results with the same segmentation (segment) or the same first INT feature columns" },
+  { "nbest-max-candidates",  'W', "0",
+    "INT", "stop the N-best search beyond INT queued candidates (default 0, unlimited)" },
   { "partial",            'p',  0, 0,
     "partial parsing mode (default false)" },
   { "marginal",           'm',  0, 0,
     "output marginal probability (default false)" },
   { "max-grouping-size",  'M',  "24",
     "INT",  "maximum grouping size for unknown words (default 24)" },
+  { "max-nodes",  'K',  "0",  "INT",
+    "fall back to a character type split beyond INT lattice nodes (default 0, unlimited)" },
+  { "max-paths",  'J',  "0",  "INT",
+    "fall back to a character type split beyond INT connections (default 0, unlimited)" },
+  { "max-time",  'Y',  "0",  "FLOAT",
+    "fall back to a character type split, or stop N-best, after FLOAT milliseconds per sentence (default 0, unlimited)" },
   { "node-format",        'F',  "%m\\t%H\\n", "STR",
     "use STR as the user-defined node format" },
   { "unk-format",        'U',  "%m\\t%H\\n", "STR",
@@ -65,6 +80,14 @@ const MeCab::Option long_options[] = {
   { "input-buffer-size",  'b',  0, "INT",
     "set input buffer size (default 8192)" },
   { "dump-config", 'P', 0, 0, "dump MeCab parameters" },
+  { "stats",  's', 0, 0,
+    "collect counters of the analysis phases and print them at exit" },
+  { "trace",  'T', 0, "FILE",
+    "write Chrome trace events of the traced requests to FILE" },
+  { "trace-sample",  'G', "1", "INT",
+    "trace one of every INT requests per thread, 0 for none (default 1)" },
+  { "trace-threshold",  'L', "0", "FLOAT",
+    "also trace requests taking FLOAT microseconds or more (default 0, off)" },
   { "allocate-sentence",  'C', 0, 0,
     "allocate new memory for input sentence" },
   { "theta",        't',  "0.75",  "FLOAT",
@@ -88,6 +111,15 @@ class ModelImpl: public Model {
 
   bool swap(Model *model);
 
+  Stats stats() const {
+    Stats result;
+    std::memset(&result, 0, sizeof(result));
+    if (stats_.get()) {
+      stats_->read(&result);
+    }
+    return result;
+  }
+
   bool is_available() const {
     return (viterbi_ && writer_.get());
   }
@@ -110,8 +142,11 @@ class ModelImpl: public Model {
     return viterbi_->connector()->transition_cost(rcAttr, lcAttr);
   }
 
+  // |begin| need not be the sentence of |lattice|, so the characters and
+  // matches of an earlier parse must not be used.
   Node *lookup(const char *begin, const char *end,
                Lattice *lattice) const {
+    lattice->allocator()->clear_sentence();
     return viterbi_->tokenizer()->lookup<false>(
         begin, end,
         lattice->allocator(), lattice);
@@ -121,6 +156,10 @@ class ModelImpl: public Model {
 
   Lattice *createLattice() const;
 
+  FeaturePattern *createFeaturePattern(const char *feature) const {
+    return viterbi_->tokenizer()->createFeaturePattern(feature);
+  }
+
   const Viterbi *viterbi() const {
     return viterbi_;
   }
@@ -136,6 +175,10 @@ class ModelImpl: public Model {
     return writer_.get();
   }
 
+  Tracer *tracer() const {
+    return tracer_.get();
+  }
+
 #ifdef HAVE_ATOMIC_OPS
   read_write_mutex *mutex() const {
     return &mutex_;
@@ -146,6 +189,8 @@ class ModelImpl: public Model {
   macab_io_file_t *io_;
   Viterbi            *viterbi_;
   std::shared_ptr<Writer>  writer_;
+  std::shared_ptr<StatsCounter> stats_;
+  std::shared_ptr<Tracer>  tracer_;
   int                 request_type_;
   double              theta_;
 
@@ -252,6 +297,12 @@ class LatticeImpl : public Lattice {
   Node *begin_nodes(size_t pos) const { return begin_nodes_[pos]; }
   Node *end_nodes(size_t pos) const { return end_nodes_[pos]; }
 
+  const Span *best_path_spans(size_t *size) const {
+    const std::vector<Span> *spans = allocator_->mutable_spans();
+    *size = spans->size();
+    return spans->empty() ? 0 : &(*spans)[0];
+  }
+
   const char *sentence() const { return sentence_; }
   void set_sentence(const char *sentence);
   void set_sentence(const char *sentence, size_t len);
@@ -296,6 +347,10 @@ class LatticeImpl : public Lattice {
   void set_feature_constraint(size_t begin_pos, size_t end_pos,
                               const char *feature);
 
+  const FeaturePattern *feature_pattern(size_t begin_pos) const;
+  void set_feature_pattern(size_t begin_pos, size_t end_pos,
+                           const FeaturePattern *pattern);
+
   void set_result(const char *result);
 
   const char *what() const { return what_.c_str(); }
@@ -304,6 +359,9 @@ class LatticeImpl : public Lattice {
     what_.assign(str);
   }
 
+  bool is_degraded() const { return degraded_; }
+  void set_degraded(bool degraded) { degraded_ = degraded; }
+
   const char *toString();
   const char *toString(char *buf, size_t size);
   const char *toString(const Node *node);
@@ -318,10 +376,12 @@ class LatticeImpl : public Lattice {
   double                      theta_;
   double                      Z_;
   int                         request_type_;
+  bool                        degraded_;
   std::string                 what_;
   std::vector<Node *>         end_nodes_;
   std::vector<Node *>         begin_nodes_;
   std::vector<const char *>   feature_constraint_;
+  std::vector<const FeaturePattern *> feature_pattern_;
   std::vector<unsigned char>  boundary_constraint_;
   const Writer               *writer_;
   std::shared_ptr<StringBuffer>    ostrs_;
@@ -381,9 +441,40 @@ bool ModelImpl::open(const Param &param) {
     return false;
   }
 
+  // -Ojson copies the surfaces and features as they are, which is
+  // valid JSON only if the dictionary is in UTF-8.
+  if (param.get<std::string>("output-format-type") == "json") {
+    const char *charset =
+        viterbi_->tokenizer()->system_dictionary()->charset();
+    const int type = decode_charset(charset);
+    if (type != UTF8 && type != ASCII) {
+      const std::string error =
+          std::string("-Ojson needs a UTF-8 dictionary: ") + charset;
+      setGlobalError(error.c_str());
+      return false;
+    }
+  }
+
   request_type_ = load_request_type(param);
   theta_ = param.get<double>("theta");
 
+  if (param.get<bool>("stats")) {
+    stats_.reset(new StatsCounter);
+    viterbi_->set_stats(stats_.get());
+    writer_->set_stats(stats_.get());
+  }
+
+  if (!param.get<std::string>("trace").empty()) {
+    tracer_.reset(new Tracer);
+    if (!tracer_->open(param)) {
+      setGlobalError(tracer_->what());
+      tracer_.reset();
+      return false;
+    }
+    viterbi_->set_tracer(tracer_.get());
+    writer_->set_tracer(tracer_.get());
+  }
+
   return is_available();
 }
 
@@ -415,6 +506,9 @@ bool ModelImpl::swap(Model *model) {
     viterbi_      = m->take_viterbi();
     request_type_ = m->request_type();
     theta_        = m->theta();
+    // the counters and the trace stay with this model.
+    viterbi_->set_stats(stats_.get());
+    viterbi_->set_tracer(tracer_.get());
   }
 
   delete current_viterbi;
@@ -562,6 +656,7 @@ bool TaggerImpl::parse(Lattice *lattice) const {
   scoped_reader_lock l(model()->mutex());
 #endif
 
+  scoped_trace_request trace(model()->tracer(), lattice->size());
   return model()->viterbi()->analyze(lattice);
 }
 
@@ -570,9 +665,12 @@ const char *TaggerImpl::parse(const char *str) {
 }
 
 const char *TaggerImpl::parse(const char *str, size_t len) {
+  scoped_trace_request trace(model()->tracer(), len);
   Lattice *lattice = mutable_lattice();
   initRequestType();
+  const unsigned long long start = trace.now();
   lattice->set_sentence(str, len);
+  trace.span("set_sentence", start);
   if (!parse(lattice)) {
     set_what(lattice->what());
     return 0;
@@ -587,9 +685,12 @@ const char *TaggerImpl::parse(const char *str, size_t len) {
 
 const char *TaggerImpl::parse(const char *str, size_t len,
                               char *out, size_t len2) {
+  scoped_trace_request trace(model()->tracer(), len);
   Lattice *lattice = mutable_lattice();
   initRequestType();
+  const unsigned long long start = trace.now();
   lattice->set_sentence(str, len);
+  trace.span("set_sentence", start);
   if (!parse(lattice)) {
     set_what(lattice->what());
     return 0;
@@ -607,9 +708,12 @@ const Node *TaggerImpl::parseToNode(const char *str) {
 }
 
 const Node *TaggerImpl::parseToNode(const char *str, size_t len) {
+  scoped_trace_request trace(model()->tracer(), len);
   Lattice *lattice = mutable_lattice();
   initRequestType();
+  const unsigned long long start = trace.now();
   lattice->set_sentence(str, len);
+  trace.span("set_sentence", start);
   if (!parse(lattice)) {
     set_what(lattice->what());
     return 0;
@@ -622,10 +726,13 @@ bool TaggerImpl::parseNBestInit(const char *str) {
 }
 
 bool TaggerImpl::parseNBestInit(const char *str, size_t len) {
+  scoped_trace_request trace(model()->tracer(), len);
   Lattice *lattice = mutable_lattice();
   initRequestType();
   lattice->add_request_type(MECAB_NBEST);
+  const unsigned long long start = trace.now();
   lattice->set_sentence(str, len);
+  trace.span("set_sentence", start);
   if (!parse(lattice)) {
     set_what(lattice->what());
     return false;
@@ -676,10 +783,13 @@ const char* TaggerImpl::parseNBest(size_t N, const char* str) {
 
 const char* TaggerImpl::parseNBest(size_t N,
                                    const char* str, size_t len) {
+  scoped_trace_request trace(model()->tracer(), len);
   Lattice *lattice = mutable_lattice();
   initRequestType();
   lattice->add_request_type(MECAB_NBEST);
+  const unsigned long long start = trace.now();
   lattice->set_sentence(str, len);
+  trace.span("set_sentence", start);
 
   if (!parse(lattice)) {
     set_what(lattice->what());
@@ -696,10 +806,13 @@ const char* TaggerImpl::parseNBest(size_t N,
 
 const char* TaggerImpl::parseNBest(size_t N, const char* str, size_t len,
                                    char *out, size_t len2) {
+  scoped_trace_request trace(model()->tracer(), len);
   Lattice *lattice = mutable_lattice();
   initRequestType();
   lattice->add_request_type(MECAB_NBEST);
+  const unsigned long long start = trace.now();
   lattice->set_sentence(str, len);
+  trace.span("set_sentence", start);
 
   if (!parse(lattice)) {
     set_what(lattice->what());
@@ -740,6 +853,7 @@ const DictionaryInfo *TaggerImpl::dictionary_info() const {
 LatticeImpl::LatticeImpl(const Writer *writer)
     : sentence_(0), size_(0), theta_(kDefaultTheta), Z_(0.0),
       request_type_(MECAB_ONE_BEST),
+      degraded_(false),
       writer_(writer),
       ostrs_(0),
       allocator_(new Allocator<Node, Path>) {
@@ -757,11 +871,13 @@ void LatticeImpl::clear() {
   begin_nodes_.clear();
   end_nodes_.clear();
   feature_constraint_.clear();
+  feature_pattern_.clear();
   boundary_constraint_.clear();
   size_ = 0;
   theta_ = kDefaultTheta;
   Z_ = 0.0;
   sentence_ = 0;
+  degraded_ = false;
 }
 
 void LatticeImpl::set_sentence(const char *sentence) {
@@ -1038,6 +1154,31 @@ void LatticeImpl::set_feature_constraint(size_t begin_pos, size_t end_pos,
   }
 
   feature_constraint_[begin_pos] = feature;
+
+  // split once per constraint string; the tokenizer resolves the
+  // column ids of the cached pattern on its first lookup.
+  if (feature_pattern_.empty()) {
+    feature_pattern_.resize(size() + 4, 0);
+  }
+  feature_pattern_[begin_pos] = allocator_->feature_pattern(feature);
+}
+
+const FeaturePattern *LatticeImpl::feature_pattern(size_t begin_pos) const {
+  if (!feature_pattern_.empty()) {
+    return feature_pattern_[begin_pos];
+  }
+  return 0;
+}
+
+void LatticeImpl::set_feature_pattern(size_t begin_pos, size_t end_pos,
+                                      const FeaturePattern *pattern) {
+  if (begin_pos >= end_pos || !pattern) {
+    return;
+  }
+
+  // the pattern text remains the feature of unknown fallback nodes.
+  set_feature_constraint(begin_pos, end_pos, pattern->feature());
+  feature_pattern_[begin_pos] = pattern;
 }
 }  // namespace
 
@@ -1107,6 +1248,10 @@ void deleteModel(Model *model) {
   delete model;
 }
 
+void deleteFeaturePattern(FeaturePattern *pattern) {
+  delete pattern;
+}
+
 Model *Model::create(int argc, char **argv) {
   return createModel(argc, argv);
 }
@@ -1128,6 +1273,13 @@ Lattice *Lattice::create() {
   return createLattice();
 }
 
+void Lattice::set_feature_pattern(size_t begin_pos, size_t end_pos,
+                                  const FeaturePattern *pattern) {
+  if (pattern) {
+    set_feature_constraint(begin_pos, end_pos, pattern->feature());
+  }
+}
+
 Lattice *createLattice() {
   return new LatticeImpl;
 }
@@ -1137,6 +1289,22 @@ void deleteLattice(Lattice *lattice) {
 }
 }  // MeCab
 
+namespace {
+// Prints the counters of |model| to stderr when mecab exits.
+class scoped_stats_printer {
+ public:
+  explicit scoped_stats_printer(const MeCab::Model *model) : model_(model) {}
+  ~scoped_stats_printer() {
+    if (model_) {
+      MeCab::print_stats(model_->stats(), &std::cerr);
+    }
+  }
+
+ private:
+  const MeCab::Model *model_;
+};
+}  // namespace
+
 int mecab_do(int argc, char **argv) {
 #define WHAT_ERROR(msg) do {                    \
     std::cout << msg << std::endl;              \
@@ -1175,6 +1343,9 @@ int mecab_do(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
+  scoped_stats_printer stats_printer(
+      param.get<bool>("stats") ? model.get() : 0);
+
   std::string ofilename = param.get<std::string>("output");
   if (ofilename.empty()) {
     ofilename = "-";
@@ -1185,7 +1356,11 @@ int mecab_do(int argc, char **argv) {
     WHAT_ERROR("invalid N value");
   }
 
-  MeCab::ostream_wrapper ofs(ofilename.c_str());
+  // binary records may contain NUL bytes and are written by size.
+  const bool binary =
+      param.get<std::string>("output-format-type") == "binary";
+
+  MeCab::ostream_wrapper ofs(ofilename.c_str(), binary);
   if (!*ofs) {
     WHAT_ERROR("no such file or directory: " << ofilename);
   }
@@ -1236,6 +1411,9 @@ int mecab_do(int argc, char **argv) {
     WHAT_ERROR("cannot create tagger");
   }
 
+  std::shared_ptr<MeCab::Lattice> lattice(model->createLattice());
+  MeCab::StringBuffer os;
+
   for (size_t i = 0; i < rest.size(); ++i) {
     MeCab::istream_wrapper ifs(rest[i].c_str());
     if (!*ifs) {
@@ -1268,6 +1446,27 @@ int mecab_do(int argc, char **argv) {
         std::cerr << "input-buffer overflow. " << "The line is split. use -b #SIZE option." << std::endl;
         ifs->clear();
       }
+      if (binary) {
+        lattice->set_request_type(model->request_type());
+        if (nbest >= 2) {
+          lattice->add_request_type(MECAB_NBEST);
+        }
+        lattice->set_sentence(ibuf);
+        if (!tagger->parse(lattice.get())) {
+          WHAT_ERROR(lattice->what());
+        }
+        os.clear();
+        if (nbest >= 2) {
+          for (int n = 0; n < nbest && lattice->next(); ++n) {
+            model->writer()->write(lattice.get(), &os);
+          }
+        } else {
+          model->writer()->write(lattice.get(), &os);
+        }
+        ofs->write(os.str(), os.size());
+        ofs->flush();
+        continue;
+      }
       const char *r = (nbest >= 2) ? tagger->parseNBest(nbest, ibuf) :
           tagger->parse(ibuf);
       if (!r)  {
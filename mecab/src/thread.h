@@ -6,6 +6,8 @@
 #ifndef MECAB_THREAD_H
 #define MECAB_THREAD_H
 
+#include <vector>
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -185,5 +187,36 @@ class thread {
 
   virtual ~thread() {}
 };
+
+template <class Job>
+class job_thread: public thread {
+ public:
+  Job *job;
+  size_t id;
+  size_t size;
+  void run() { job->run(id, size); }
+};
+
+// Calls job->run(id, size) for id = 0 .. size - 1 on |size| threads and
+// waits for all of them.
+template <class Job>
+void run_jobs(Job *job, size_t size) {
+#ifdef MECAB_USE_THREAD
+  if (size > 1) {
+    std::vector<job_thread<Job> > threads(size);
+    for (size_t i = 0; i < size; ++i) {
+      threads[i].job = job;
+      threads[i].id = i;
+      threads[i].size = size;
+      threads[i].start();
+    }
+    for (size_t i = 0; i < size; ++i) {
+      threads[i].join();
+    }
+    return;
+  }
+#endif
+  job->run(0, 1);
+}
 }
 #endif
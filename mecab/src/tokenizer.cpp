@@ -4,6 +4,8 @@
 //  Copyright(C) 2001-2011 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
 #include <array>
+#include <atomic>
+#include <memory>
 #include "mecab.h"
 #include "common.h"
 #include "file.h"
@@ -37,6 +39,13 @@ void inline read_node_info(const Dictionary &dic,
   (*node)->wcost   = token.wcost;
   (*node)->feature = dic.feature(token);
 }
+
+// distinguishes the dictionaries of each Tokenizer::open() for the
+// patterns cached by the lattices. 0 is never used.
+size_t next_serial() {
+  static std::atomic<size_t> serial(0);
+  return ++serial;
+}
 }  // namespace
 
 template class Tokenizer<Node, Path>;
@@ -79,7 +88,8 @@ Tokenizer<N, P>::Tokenizer(macab_io_file_t *io)
 	, dictionary_info_freelist_(4)
     , dictionary_info_(0)
 	, property_(io)
-    , max_grouping_size_(0) {}
+    , max_grouping_size_(0)
+    , serial_(0) {}
 
 template <typename N, typename P>
 N *Tokenizer<N, P>::getBOSNode(Allocator<N, P> *allocator) const {
@@ -113,6 +123,13 @@ bool Tokenizer<N, P>::open(const Param &param) {
 
   property_.set_charset(sysdic->charset());
   dic_.push_back(sysdic);
+  serial_ = next_serial();
+
+  const std::string index = create_filename(prefix, AHO_CORASICK_FILE);
+  if (file_exists(index.c_str())) {
+    scanner_.reset(new AhoCorasick(io_));
+    CHECK_FALSE(scanner_->open(index.c_str(), *sysdic)) << scanner_->what();
+  }
 
   const std::string userdic = param.template get<std::string>("userdic");
   if (!userdic.empty()) {
@@ -204,8 +221,12 @@ inline bool partial_match(const char *f1, const char *f2) {
   return true;
 }
 
+// |pattern| is the feature constraint at the beginning of |node|,
+// resolved by lookup().
 template <typename N>
-bool is_valid_node(const Lattice *lattice,  N *node) {
+bool is_valid_node(const Lattice *lattice,  N *node,
+                   const FeaturePatternImpl *pattern,
+                   const Dictionary *dic = 0, const Token *token = 0) {
   const size_t end_pos = node->surface - lattice->sentence() + node->length;
   if (lattice->boundary_constraint(end_pos) == MECAB_INSIDE_TOKEN) {
     return false;
@@ -216,15 +237,109 @@ bool is_valid_node(const Lattice *lattice,  N *node) {
   if (!feature) {
     return true;
   }
-  if (lattice->boundary_constraint(begin_pos) == MECAB_TOKEN_BOUNDARY &&
-      lattice->boundary_constraint(end_pos) == MECAB_TOKEN_BOUNDARY &&
-      partial_match(feature, node->feature)) {
-    return true;
+  if (lattice->boundary_constraint(begin_pos) != MECAB_TOKEN_BOUNDARY ||
+      lattice->boundary_constraint(end_pos) != MECAB_TOKEN_BOUNDARY) {
+    return false;
   }
-  return false;
+  return (dic ? pattern->match(*dic, *token) :
+          pattern->match(node->feature));
 }
 }  // namespace
 
+FeaturePatternImpl::FeaturePatternImpl(const char *feature)
+    : feature_(feature), any_(std::strcmp(feature, "*") == 0), serial_(0) {
+  std::array<char, BUF_SIZE> buf;
+  std::array<char *, 64> col;
+  std::strncpy(buf.data(), feature, buf.size() - 1);
+  buf.back() = '\0';
+  const size_t n = tokenizeCSV(buf.data(), col.data(), col.size());
+  for (size_t i = 0; i < n; ++i) {
+    if (std::strcmp(col[i], "*") != 0) {
+      index_.push_back(i);
+      value_.push_back(col[i]);
+    }
+  }
+}
+
+void FeaturePatternImpl::compile(const Dictionary *dic) {
+  if (!dic->column_size()) {
+    return;
+  }
+  std::vector<unsigned int> ids(index_.size());
+  for (size_t k = 0; k < index_.size(); ++k) {
+    // kNoColumn never equals the id of an existing column.
+    ids[k] = dic->find_column_id(index_[k], value_[k].c_str());
+  }
+  id_.push_back(std::make_pair(dic, ids));
+}
+
+bool FeaturePatternImpl::match(const char *feature) const {
+  if (any_) {
+    return true;
+  }
+  if (std::strpbrk(feature, "\" \t")) {
+    return partial_match(feature_.c_str(), feature);
+  }
+
+  // same splitting as tokenizeCSV()
+  const char *begin = feature;
+  size_t k = 0;
+  for (size_t column = 0; k < index_.size(); ++column) {
+    const char *end = std::strchr(begin, ',');
+    const size_t length = end ? end - begin : std::strlen(begin);
+    if (index_[k] == column) {
+      if (value_[k].size() != length ||
+          std::memcmp(value_[k].data(), begin, length) != 0) {
+        return false;
+      }
+      ++k;
+    }
+    if (!end) {
+      break;
+    }
+    begin = end + 1;
+  }
+  return true;
+}
+
+bool FeaturePatternImpl::match(const Dictionary &dic,
+                               const Token &token) const {
+  if (any_) {
+    return true;
+  }
+  for (size_t i = 0; i < id_.size(); ++i) {
+    if (id_[i].first != &dic) {
+      continue;
+    }
+    const std::vector<unsigned int> &ids = id_[i].second;
+    for (size_t k = 0; k < index_.size(); ++k) {
+      const unsigned int id = dic.column_id(token, index_[k]);
+      if (id != kNoColumn && id != ids[k]) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return match(dic.feature(token));
+}
+
+template <typename N, typename P>
+FeaturePattern *Tokenizer<N, P>::createFeaturePattern(
+    const char *feature) const {
+  FeaturePatternImpl *pattern = new FeaturePatternImpl(feature);
+  compile(pattern);
+  return pattern;
+}
+
+template <typename N, typename P>
+void Tokenizer<N, P>::compile(FeaturePatternImpl *pattern) const {
+  pattern->reset(serial_);
+  for (std::vector<Dictionary *>::const_iterator it = dic_.begin();
+       it != dic_.end(); ++it) {
+    pattern->compile(*it);
+  }
+}
+
 #define ADDUNKNWON do {                                                  \
     const Token *token = unk_tokens_[cinfo.default_type].first;          \
     size_t size  = unk_tokens_[cinfo.default_type].second;               \
@@ -238,7 +353,9 @@ bool is_valid_node(const Lattice *lattice,  N *node) {
       new_node->stat = MECAB_UNK_NODE;                                   \
       new_node->bnext = result_node;                                     \
       if (unk_feature_.data()) new_node->feature = unk_feature_.data();    \
-      if (isPartial && !is_valid_node(lattice, new_node)) { continue; }  \
+      if (isPartial && !is_valid_node(lattice, new_node, pattern)) {     \
+        continue;                                                        \
+      }                                                                  \
       result_node = new_node; } } while (0)
 
 template <typename N, typename P>
@@ -252,6 +369,9 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
 
   end = static_cast<size_t>(end - begin) >= 65535 ? begin + 65535 : end;
 
+  // the feature constraint of the nodes beginning here, resolved to
+  // column ids once rather than split for every node.
+  const FeaturePatternImpl *pattern = 0;
   if (isPartial) {
     const size_t begin_pos = begin - lattice->sentence();
     for (size_t n = begin_pos + 1; n < lattice->size(); ++n) {
@@ -260,32 +380,69 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
         break;
       }
     }
+    pattern = static_cast<const FeaturePatternImpl *>(
+        lattice->feature_pattern(begin_pos));
+    const char *feature = lattice->feature_constraint(begin_pos);
+    // the column ids of a pattern resolved for other dictionaries may
+    // be stale; resolve the lattice's own copy for ours instead.
+    if (feature && (!pattern || pattern->serial() != serial_)) {
+      FeaturePatternImpl *cached = allocator->feature_pattern(feature);
+      if (cached->serial() != serial_) {
+        compile(cached);
+      }
+      pattern = cached;
+    }
   }
 
-  const char *begin2 = property_.seekToOtherType(begin, end, space_,
+  const SentenceChars *chars = allocator->sentence_chars();
+  if (chars && !chars->covers(begin, end)) {
+    chars = 0;
+  }
+
+  const char *begin2 = property_.seekToOtherType(chars, begin, end, space_,
                                                  &cinfo, &mblen, &clen);
 
   Dictionary::result_type *daresults = allocator->mutable_results();
   const size_t results_size = allocator->results_size();
+  const SentenceMatches *matches = allocator->sentence_matches();
+  if (matches && (begin2 < matches->sentence ||
+                  begin2 > matches->sentence + matches->size)) {
+    matches = 0;
+  }
 
   for (std::vector<Dictionary *>::const_iterator it = dic_.begin();
        it != dic_.end(); ++it) {
-    const size_t n = (*it)->commonPrefixSearch(
-        begin2,
-        static_cast<size_t>(end - begin2),
-        daresults, results_size);
+    const Dictionary::result_type *results = daresults;
+    size_t n = 0;
+    if (matches && it == dic_.begin()) {
+      // the words found by scan(), up to |end|
+      const size_t pos = begin2 - matches->sentence;
+      results = matches->match.data() + matches->begin[pos];
+      n = std::min<size_t>(matches->begin[pos + 1] - matches->begin[pos],
+                           results_size);
+      while (n > 0 &&
+             results[n - 1].length > static_cast<size_t>(end - begin2)) {
+        --n;
+      }
+    } else {
+      n = std::min((*it)->commonPrefixSearch(
+          begin2,
+          static_cast<size_t>(end - begin2),
+          daresults, results_size), results_size);
+    }
     for (size_t i = 0; i < n; ++i) {
-      size_t size = (*it)->token_size(daresults[i]);
-      const Token *token = (*it)->token(daresults[i]);
+      size_t size = (*it)->token_size(results[i]);
+      const Token *token = (*it)->token(results[i]);
       for (size_t j = 0; j < size; ++j) {
         N *new_node = allocator->newNode();
         read_node_info(**it, *(token + j), &new_node);
-        new_node->length = unsigned short(daresults[i].length);
+        new_node->length = unsigned short(results[i].length);
         new_node->rlength = unsigned short(begin2 - begin + new_node->length);
         new_node->surface = begin2;
         new_node->stat = MECAB_NOR_NODE;
         new_node->char_type = cinfo.default_type;
-        if (isPartial && !is_valid_node(lattice, new_node)) {
+        if (isPartial &&
+            !is_valid_node(lattice, new_node, pattern, *it, token + j)) {
           continue;
         }
         new_node->bnext = result_node;
@@ -311,7 +468,7 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
   if (cinfo.group) {
     const char *tmp = begin3;
     CharInfo fail;
-    begin3 = property_.seekToOtherType(begin3, end, cinfo,
+    begin3 = property_.seekToOtherType(chars, begin3, end, cinfo,
                                        &fail, &mblen, &clen);
     if (clen <= max_grouping_size_) {
       ADDUNKNWON;
@@ -329,7 +486,8 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
     }
     clen = i;
     ADDUNKNWON;
-    if (!cinfo.isKindOf(property_.getCharInfo(begin3, end, &mblen))) {
+    if (!cinfo.isKindOf(property_.getCharInfo(chars, begin3, end,
+                                              &mblen))) {
       break;
     }
     begin3 += mblen;
@@ -342,7 +500,7 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
   if (isPartial && !result_node) {
     begin3 = begin2;
     while (true) {
-      cinfo = property_.getCharInfo(begin3, end, &mblen);
+      cinfo = property_.getCharInfo(chars, begin3, end, &mblen);
       begin3 += mblen;
       if (begin3 > end ||
           lattice->boundary_constraint(begin3 - lattice->sentence())
@@ -372,6 +530,92 @@ N *Tokenizer<N, P>::lookup(const char *begin, const char *end,
 
 #undef ADDUNKNWON
 
+template <typename N, typename P>
+void Tokenizer<N, P>::classify(const char *begin, const char *end,
+                               Allocator<N, P> *allocator) const {
+  property_.classify(begin, end, allocator->mutable_sentence_chars());
+}
+
+template <typename N, typename P>
+bool Tokenizer<N, P>::scan(const char *begin, const char *end,
+                           Allocator<N, P> *allocator) const {
+  if (!scanner_.get()) {
+    return false;
+  }
+  scanner_->scan(begin, end, allocator->mutable_sentence_matches());
+  return true;
+}
+
+template <typename N, typename P>
+N *Tokenizer<N, P>::lookupRun(const char *begin, const char *end,
+                              Allocator<N, P> *allocator,
+                              const Lattice *lattice) const {
+  CharInfo cinfo;
+  CharInfo fail;
+  size_t mblen = 0;
+  size_t clen = 0;
+
+  end = static_cast<size_t>(end - begin) >= 65535 ? begin + 65535 : end;
+
+  const SentenceChars *chars = allocator->sentence_chars();
+  if (chars && !chars->covers(begin, end)) {
+    chars = 0;
+  }
+
+  const char *begin2 = property_.seekToOtherType(chars, begin, end, space_,
+                                                 &cinfo, &mblen, &clen);
+  if (begin2 >= end) {
+    return 0;
+  }
+
+  // the run stops at the next token boundary after the white spaces, and
+  // a constrained token is taken whole.
+  const char *feature = 0;
+  if (lattice && lattice->has_constraint()) {
+    const size_t begin_pos = begin - lattice->sentence();
+    const size_t begin2_pos = begin2 - lattice->sentence();
+    for (size_t n = begin2_pos + 1; n < lattice->size(); ++n) {
+      if (lattice->boundary_constraint(n) == MECAB_TOKEN_BOUNDARY) {
+        end = std::min(end, lattice->sentence() + n);
+        break;
+      }
+    }
+    feature = lattice->feature_constraint(begin_pos);
+    if (!feature) {
+      feature = lattice->feature_constraint(begin2_pos);
+    }
+  }
+
+  const char *begin3 = property_.seekToOtherType(chars, begin2 + mblen, end,
+                                                 cinfo, &fail, &mblen, &clen);
+
+  if (feature) {
+    // as the fallback node of lookup()
+    begin3 = end;
+  } else if (lattice && lattice->has_constraint()) {
+    while (begin3 < end &&
+           lattice->boundary_constraint(begin3 - lattice->sentence()) ==
+           MECAB_INSIDE_TOKEN) {
+      property_.getCharInfo(chars, begin3, end, &mblen);
+      begin3 += mblen;
+    }
+  }
+
+  N *node = allocator->newNode();
+  read_node_info(unkdic_, *unk_tokens_[cinfo.default_type].first, &node);
+  node->char_type = cinfo.default_type;
+  node->surface = begin2;
+  node->length = static_cast<unsigned short>(begin3 - begin2);
+  node->rlength = static_cast<unsigned short>(begin3 - begin);
+  node->stat = MECAB_UNK_NODE;
+  if (feature) {
+    node->feature = feature;
+  } else if (!unk_feature_.empty()) {
+    node->feature = unk_feature_.data();
+  }
+  return node;
+}
+
 template <typename N, typename P>
 const DictionaryInfo *Tokenizer<N, P>::dictionary_info() const {
   return const_cast<const DictionaryInfo *>(dictionary_info_);
@@ -379,6 +623,7 @@ const DictionaryInfo *Tokenizer<N, P>::dictionary_info() const {
 
 template <typename N, typename P>
 void Tokenizer<N, P>::close() {
+  scanner_.reset();
   for (std::vector<Dictionary *>::iterator it = dic_.begin();
        it != dic_.end(); ++it) {
     delete *it;
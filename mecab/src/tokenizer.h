@@ -6,8 +6,11 @@
 #ifndef MECAB_TOKENIZER_H_
 #define MECAB_TOKENIZER_H_
 
+#include <map>
+#include <string>
 #include "mecab.h"
 #include "freelist.h"
+#include "aho_corasick.h"
 #include "dictionary.h"
 #include "char_property.h"
 #include "nbest_generator.h"
@@ -17,6 +20,39 @@ namespace MeCab {
 class Param;
 class NBestGenerator;
 
+// Feature constraint split into columns once. Columns are compared by
+// interned id against dictionaries built with the columnar store.
+class FeaturePatternImpl : public FeaturePattern {
+ public:
+  explicit FeaturePatternImpl(const char *feature);
+
+  const char *feature() const { return feature_.c_str(); }
+
+  // forgets the column ids resolved for another tokenizer.
+  void reset(size_t serial) {
+    id_.clear();
+    serial_ = serial;
+  }
+
+  // the tokenizer the column ids were resolved for, 0 if none.
+  size_t serial() const { return serial_; }
+
+  // resolves the column ids of |dic|.
+  void compile(const Dictionary *dic);
+
+  bool match(const char *feature) const;
+  bool match(const Dictionary &dic, const Token &token) const;
+
+ private:
+  std::string feature_;
+  bool any_;
+  size_t serial_;
+  std::vector<size_t> index_;         // columns other than "*"
+  std::vector<std::string> value_;
+  std::vector<std::pair<const Dictionary *,
+                        std::vector<unsigned int> > > id_;
+};
+
 template <typename N, typename P>
 class Allocator {
  public:
@@ -58,6 +94,46 @@ class Allocator {
     return nbest_generator_.get();
   }
 
+  std::vector<Span> *mutable_spans() {
+    return &spans_;
+  }
+
+  // the pattern of the feature constraint |feature|, split once for
+  // all the constraints of the same string.
+  FeaturePatternImpl *feature_pattern(const char *feature) {
+    std::shared_ptr<FeaturePatternImpl> &pattern = feature_patterns_[feature];
+    if (!pattern.get()) {
+      pattern.reset(new FeaturePatternImpl(feature));
+    }
+    return pattern.get();
+  }
+
+  SentenceChars *mutable_sentence_chars() {
+    if (!sentence_chars_.get()) {
+      sentence_chars_.reset(new SentenceChars);
+    }
+    return sentence_chars_.get();
+  }
+
+  // the characters of the sentence if it has been classified, or 0
+  const SentenceChars *sentence_chars() const {
+    return sentence_chars_.get() && sentence_chars_->sentence ?
+        sentence_chars_.get() : 0;
+  }
+
+  SentenceMatches *mutable_sentence_matches() {
+    if (!sentence_matches_.get()) {
+      sentence_matches_.reset(new SentenceMatches);
+    }
+    return sentence_matches_.get();
+  }
+
+  // the matches of the sentence if it has been scanned, or 0
+  const SentenceMatches *sentence_matches() const {
+    return sentence_matches_.get() && sentence_matches_->sentence ?
+        sentence_matches_.get() : 0;
+  }
+
   char *partial_buffer(size_t size) {
     partial_buffer_.resize(size);
     return &partial_buffer_[0];
@@ -67,8 +143,25 @@ class Allocator {
     return kResultsSize;
   }
 
+  // nodes allocated since the last free()
+  size_t node_size() const {
+    return id_;
+  }
+
+  // forgets classify() and scan() so that lookup() works from the
+  // dictionaries alone
+  void clear_sentence() {
+    if (sentence_chars_.get()) {
+      sentence_chars_->sentence = 0;
+    }
+    if (sentence_matches_.get()) {
+      sentence_matches_->sentence = 0;
+    }
+  }
+
   void free() {
     id_ = 0;
+    spans_.clear();
     node_freelist_->free();
     if (path_freelist_.get()) {
       path_freelist_->free();
@@ -76,6 +169,10 @@ class Allocator {
     if (char_freelist_.get()) {
       char_freelist_->free();
     }
+    if (feature_patterns_.size() > kFeaturePatternsSize) {
+      feature_patterns_.clear();
+    }
+    clear_sentence();
   }
 
   Allocator()
@@ -84,18 +181,25 @@ class Allocator {
         path_freelist_(0),
         char_freelist_(0),
         nbest_generator_(0),
+        sentence_chars_(0),
+        sentence_matches_(0),
         results_(kResultsSize) {}
   virtual ~Allocator() {}
 
  private:
   static const size_t kResultsSize = 512;
+  static const size_t kFeaturePatternsSize = 1024;
   size_t id_;
   std::shared_ptr<FreeList<N>> node_freelist_;
   std::shared_ptr<FreeList<P>> path_freelist_;
   std::shared_ptr<ChunkFreeList<char>>  char_freelist_;
   std::shared_ptr<NBestGenerator> nbest_generator_;
+  std::shared_ptr<SentenceChars> sentence_chars_;
+  std::shared_ptr<SentenceMatches> sentence_matches_;
   std::vector<char> partial_buffer_;
+  std::vector<Span> spans_;
   std::vector<Dictionary::result_type> results_;
+  std::map<std::string, std::shared_ptr<FeaturePatternImpl> > feature_patterns_;
 };
 
 template <typename N, typename P>
@@ -103,6 +207,7 @@ class Tokenizer {
  private:
   macab_io_file_t *io_;
   std::vector<Dictionary *>              dic_;
+  std::shared_ptr<AhoCorasick>           scanner_;
   Dictionary                             unkdic_;
   std::string                          bos_feature_;
   std::string                          unk_feature_;
@@ -112,19 +217,45 @@ class Tokenizer {
   CharInfo                               space_;
   CharProperty                           property_;
   size_t                                 max_grouping_size_;
+  size_t                                 serial_;
   whatlog                                what_;
 
+  void compile(FeaturePatternImpl *pattern) const;
+
  public:
   N *getBOSNode(Allocator<N, P> *allocator) const;
   N *getEOSNode(Allocator<N, P> *allocator) const;
   template <bool IsPartial> N *lookup(const char *begin, const char *end,
                                       Allocator<N, P> *allocator,
                                       Lattice *lattice) const;
+  // Classifies the characters of the whole sentence once for the
+  // following lookup() calls.
+  void classify(const char *begin, const char *end,
+                Allocator<N, P> *allocator) const;
+  // Finds the words of the system dictionary in the whole sentence for
+  // the following lookup() calls, if the dictionary has the index of
+  // mecab-dict-index --aho-corasick. Returns false otherwise.
+  bool scan(const char *begin, const char *end,
+            Allocator<N, P> *allocator) const;
+  bool has_scanner() const { return scanner_.get() != 0; }
+  // One unknown word node for the run of characters of the same type
+  // at |begin|, after white spaces, or 0 at the end of the sentence.
+  // The run keeps to the boundary and feature constraints of |lattice|.
+  N *lookupRun(const char *begin, const char *end,
+               Allocator<N, P> *allocator,
+               const Lattice *lattice = 0) const;
   bool open(const Param &param);
   void close();
 
   const DictionaryInfo *dictionary_info() const;
 
+  const Dictionary *system_dictionary() const {
+    return dic_.empty() ? 0 : dic_[0];
+  }
+  const CharProperty *property() const { return &property_; }
+
+  FeaturePattern *createFeaturePattern(const char *feature) const;
+
   const char *what() { return what_.str(); }
 
   explicit Tokenizer(macab_io_file_t *io);
@@ -0,0 +1,121 @@
+//  MeCab -- Yet Another Part-of-Speech and Morphological Analyzer
+//
+//
+//  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
+//  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <fstream>
+#include <iomanip>
+#include "mecab.h"
+#include "param.h"
+#include "tracer.h"
+#include "utils.h"
+
+namespace MeCab {
+
+namespace {
+// events kept per thread
+const size_t kTraceBufferSize = 65536;
+
+void write_event(std::ostream *os, const TraceEvent &event, size_t tid) {
+  *os << "{\"name\":\"" << event.name << "\",\"cat\":\"mecab\",\"ph\":\"X\""
+      << ",\"pid\":1,\"tid\":" << tid
+      << ",\"ts\":" << event.begin / 1000.0
+      << ",\"dur\":" << (event.end - event.begin) / 1000.0;
+  if (event.arg_name) {
+    *os << ",\"args\":{\"" << event.arg_name << "\":" << event.arg << "}";
+  }
+  *os << "}";
+}
+}  // namespace
+
+Tracer::Tracer() : sample_(1), threshold_(0), capacity_(kTraceBufferSize),
+                   origin_(std::chrono::steady_clock::now()) {}
+
+Tracer::~Tracer() {
+  if (filename_.empty()) {
+    return;
+  }
+  std::ofstream ofs(WPATH(filename_.c_str()));
+  if (!ofs || !write(&ofs)) {
+    std::cerr << "cannot write the trace: " << filename_ << std::endl;
+  }
+}
+
+bool Tracer::open(const Param &param) {
+  const std::string filename = param.get<std::string>("trace");
+  CHECK_FALSE(!filename.empty()) << "no trace file is given";
+  std::ofstream ofs(WPATH(filename.c_str()));
+  CHECK_FALSE(ofs) << "permission denied: " << filename;
+  filename_ = filename;
+  sample_ = param.get<size_t>("trace-sample");
+  threshold_ = static_cast<unsigned long long>(
+      1000.0 * param.get<double>("trace-threshold"));
+  origin_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+void Tracer::begin() {
+  TraceBuffer *buffer = buffers_.local();
+  if (buffer->depth++ > 0) {
+    return;
+  }
+  buffer->sampled = sample_ > 0 && buffer->requests++ % sample_ == 0;
+  buffer->recording = buffer->sampled || threshold_ > 0;
+  if (buffer->recording) {
+    buffer->request.clear();
+    buffer->request_begin = now();
+  }
+}
+
+void Tracer::end(size_t bytes) {
+  TraceBuffer *buffer = buffers_.local();
+  if (--buffer->depth > 0 || !buffer->recording) {
+    return;
+  }
+  buffer->recording = false;
+  const unsigned long long end = now();
+  if (buffer->sampled || end - buffer->request_begin >= threshold_) {
+    buffer->add("parse", buffer->request_begin, end, "bytes", bytes);
+    keep(buffer);
+  }
+}
+
+void Tracer::keep(TraceBuffer *buffer) {
+  std::lock_guard<std::mutex> lock(buffer->mutex);
+  if (buffer->ring.empty()) {
+    buffer->ring.resize(capacity_);
+  }
+  // the oldest events are overwritten.
+  for (size_t i = 0; i < buffer->request.size(); ++i) {
+    buffer->ring[(buffer->head + buffer->size) % capacity_] =
+        buffer->request[i];
+    if (buffer->size < capacity_) {
+      ++buffer->size;
+    } else {
+      buffer->head = (buffer->head + 1) % capacity_;
+    }
+  }
+  buffer->request.clear();
+}
+
+bool Tracer::write(std::ostream *os) const {
+  const std::vector<std::shared_ptr<TraceBuffer> > buffers =
+      buffers_.blocks();
+  const std::ios::fmtflags flags = os->flags();
+  *os << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+  bool first = true;
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    TraceBuffer *buffer = buffers[i].get();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    for (size_t j = 0; j < buffer->size; ++j) {
+      *os << (first ? "\n" : ",\n");
+      write_event(os, buffer->ring[(buffer->head + j) % capacity_],
+                  buffer->index);
+      first = false;
+    }
+  }
+  *os << "\n],\"displayTimeUnit\":\"ns\"}" << std::endl;
+  os->flags(flags);
+  return !os->fail();
+}
+}
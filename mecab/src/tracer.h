@@ -0,0 +1,177 @@
+//  MeCab -- Yet Another Part-of-Speech and Morphological Analyzer
+//
+//
+//  Copyright(C) 2001-2006 Taku Kudo <taku@chasen.org>
+//  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#ifndef MECAB_TRACER_H_
+#define MECAB_TRACER_H_
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "stats.h"
+
+namespace MeCab {
+
+class Param;
+
+struct TraceEvent {
+  const char         *name;      // string literal
+  const char         *arg_name;  // string literal or 0
+  unsigned long long  begin;     // ns since the Tracer was opened
+  unsigned long long  end;
+  size_t              arg;
+};
+
+// Events of the calling thread. The events of the running request are
+// collected in |request| and moved to the ring buffer when the request
+// is kept.
+struct TraceBuffer {
+  std::mutex               mutex;  // guards ring, head and size
+  std::vector<TraceEvent>  ring;
+  size_t                   head;
+  size_t                   size;
+  std::vector<TraceEvent>  request;
+  size_t                   depth;
+  unsigned long long       request_begin;
+  bool                     recording;
+  bool                     sampled;
+  unsigned long long       requests;
+  size_t                   index;  // tid in the trace
+
+  void add(const char *name, unsigned long long begin,
+           unsigned long long end, const char *arg_name = 0,
+           size_t arg = 0) {
+    TraceEvent event = { name, arg_name, begin, end, arg };
+    request.push_back(event);
+  }
+
+  TraceBuffer() : head(0), size(0), depth(0), request_begin(0),
+                  recording(false), sampled(false), requests(0),
+                  index(0) {}
+};
+
+// Records the phases of Tagger::parse as Chrome trace events
+// (chrome://tracing, Perfetto). Every --trace-sample'th request and
+// every request that takes --trace-threshold microseconds or more is
+// kept in a ring buffer of the thread that parsed it, and the buffers
+// are written to the --trace file when the Tracer is deleted.
+class Tracer {
+ public:
+  bool open(const Param &param);
+
+  // Starts a request on the calling thread unless one is running.
+  void begin();
+  // Ends the request started by the matching begin().
+  void end(size_t bytes);
+
+  // The buffer of the calling thread if it records a request, or 0.
+  TraceBuffer *recording() {
+    TraceBuffer *buffer = buffers_.local();
+    return buffer->recording ? buffer : 0;
+  }
+
+  unsigned long long now() const {
+    return static_cast<unsigned long long>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - origin_).count());
+  }
+
+  bool write(std::ostream *os) const;
+
+  const char *what() { return what_.str(); }
+
+  Tracer();
+  virtual ~Tracer();
+
+ private:
+  void keep(TraceBuffer *buffer);
+
+  std::string filename_;
+  unsigned long long sample_;
+  unsigned long long threshold_;  // ns
+  size_t capacity_;
+  std::chrono::steady_clock::time_point origin_;
+  ThreadBlocks<TraceBuffer> buffers_;
+  whatlog what_;
+};
+
+// Times the phases of a sentence for the counters and, if |trace| is
+// not null, the trace. lap() ends the phase begun by start() or by the
+// previous lap().
+class PhaseTimer {
+ public:
+  Stats stats;
+
+  void start() {
+    cycles_ = read_cycles();
+    if (trace_) {
+      ns_ = tracer_->now();
+    }
+  }
+
+  void lap(unsigned long long *cycles, const char *name,
+           const char *arg_name = 0, size_t arg = 0) {
+    const unsigned long long now = read_cycles();
+    if (cycles) {
+      *cycles += now - cycles_;
+    }
+    cycles_ = now;
+    if (trace_) {
+      const unsigned long long ns = tracer_->now();
+      trace_->add(name, ns_, ns, arg_name, arg);
+      ns_ = ns;
+    }
+  }
+
+  PhaseTimer(Tracer *tracer, TraceBuffer *trace)
+      : tracer_(tracer), trace_(trace), cycles_(0), ns_(0) {
+    std::memset(&stats, 0, sizeof(stats));
+  }
+
+ private:
+  Tracer      *tracer_;
+  TraceBuffer *trace_;
+  unsigned long long cycles_;
+  unsigned long long ns_;
+};
+
+// Traces a request from construction to destruction, if |tracer| is
+// not null.
+class scoped_trace_request {
+ public:
+  scoped_trace_request(Tracer *tracer, size_t bytes)
+      : tracer_(tracer), bytes_(bytes) {
+    if (tracer_) {
+      tracer_->begin();
+    }
+  }
+
+  ~scoped_trace_request() {
+    if (tracer_) {
+      tracer_->end(bytes_);
+    }
+  }
+
+  // The clock of the trace, or 0 when nothing is recorded.
+  unsigned long long now() const {
+    return tracer_ && tracer_->recording() ? tracer_->now() : 0;
+  }
+
+  // Records a span from |begin| taken by now() to this moment.
+  void span(const char *name, unsigned long long begin) {
+    TraceBuffer *buffer = tracer_ ? tracer_->recording() : 0;
+    if (buffer) {
+      buffer->add(name, begin, tracer_->now(), "bytes", bytes_);
+    }
+  }
+
+ private:
+  Tracer *tracer_;
+  size_t  bytes_;
+};
+}
+#endif  // MECAB_TRACER_H_
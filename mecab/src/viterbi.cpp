@@ -18,6 +18,8 @@
 #include "tokenizer.h"
 #include "nbest_generator.h"
 #include "connector.h"
+#include "stats.h"
+#include "tracer.h"
 #include "viterbi.h"
 
 namespace MeCab {
@@ -40,13 +42,57 @@ void calc_beta(Node *n, double beta) {
                         path == n->rpath);
   }
 }
+
+// Copies the path linked from bos_node into the span array, if it is
+// requested.
+void buildBestPathSpans(Lattice *lattice) {
+  std::vector<Span> *spans = lattice->allocator()->mutable_spans();
+  spans->clear();
+  if (!lattice->has_request_type(MECAB_BEST_PATH_SPANS)) {
+    return;
+  }
+  const char *sentence = lattice->sentence();
+  for (const Node *node = lattice->bos_node()->next;
+       node->next; node = node->next) {
+    Span span;
+    span.begin = static_cast<unsigned int>(node->surface - sentence);
+    span.length = node->length;
+    span.rlength = node->rlength;
+    span.posid = node->posid;
+    span.lcAttr = node->lcAttr;
+    span.rcAttr = node->rcAttr;
+    span.char_type = node->char_type;
+    span.stat = node->stat;
+    span.wcost = node->wcost;
+    span.cost = static_cast<int>(node->cost);
+    span.feature = node->feature;
+    spans->push_back(span);
+  }
+}
+
+// Counts the nodes looked up at a position.
+void count_nodes(const Node *rnode, Stats *stats) {
+  for (; rnode; rnode = rnode->bnext) {
+    if (rnode->stat == MECAB_UNK_NODE) {
+      ++stats->unknown_nodes;
+    } else {
+      ++stats->dictionary_nodes;
+    }
+  }
+  ++stats->lookups;
+}
 }  // namespace
 
 Viterbi::Viterbi(macab_io_file_t *io)
     : io_(io)
 	, tokenizer_(0)
 	, connector_(0)
-	, cost_factor_(0) {}
+	, cost_factor_(0)
+	, nbest_agenda_size_(0)
+	, nbest_unique_(-1)
+	, nbest_max_candidates_(0)
+	, stats_(0)
+	, tracer_(0) {}
 
 Viterbi::~Viterbi() {}
 
@@ -69,6 +115,22 @@ bool Viterbi::open(const Param &param) {
     cost_factor_ = 800;
   }
 
+  nbest_agenda_size_ = param.get<size_t>("nbest-agenda-size");
+  nbest_max_candidates_ = param.get<size_t>("nbest-max-candidates");
+  const std::string unique = param.get<std::string>("nbest-unique");
+  nbest_unique_ = -1;
+  if (unique == "segment") {
+    nbest_unique_ = 0;
+  } else if (!unique.empty()) {
+    nbest_unique_ = std::atoi(unique.c_str());
+    CHECK_FALSE(nbest_unique_ > 0)
+        << "nbest-unique must be segment or a number of columns: " << unique;
+  }
+
+  budget_ = WorkBudget(param.get<size_t>("max-nodes"),
+                       param.get<size_t>("max-paths"),
+                       param.get<double>("max-time"));
+
   return true;
 }
 
@@ -77,36 +139,68 @@ bool Viterbi::analyze(Lattice *lattice) const {
     return false;
   }
 
+  // a search that runs out of its budget leaves a degraded lattice,
+  // which is rebuilt by split(). The N-best search goes on under the
+  // same budget, i.e. the same deadline.
+  WorkBudget budget(budget_);
+  WorkBudget *bounded = 0;
+  if (budget.bounded()) {
+    budget.start();
+    bounded = &budget;
+  }
+
+  // the search without counters and trace is instantiated without any
+  // timing.
+  TraceBuffer *trace = tracer_ ? tracer_->recording() : 0;
+  if (!stats_ && !trace) {
+    return initPartial(lattice) &&
+        (search<false>(lattice, 0, bounded) || split(lattice)) &&
+        forwardbackward(lattice) &&
+        buildResult(lattice, budget);
+  }
+
+  PhaseTimer timer(tracer_, trace);
+  const unsigned long long start = read_cycles();
+
   if (!initPartial(lattice)) {
     return false;
   }
 
-  bool result = false;
-  if (lattice->has_request_type(MECAB_NBEST) ||
-      lattice->has_request_type(MECAB_MARGINAL_PROB)) {
-    // IsAllPath=true
-    if (lattice->has_constraint()) {
-      result = viterbi<true, true>(lattice);
-    } else {
-      result = viterbi<true, false>(lattice);
-    }
-  } else {
-    // IsAllPath=false
-    if (lattice->has_constraint()) {
-      result = viterbi<false, true>(lattice);
-    } else {
-      result = viterbi<false, false>(lattice);
+  if (!search<true>(lattice, &timer, bounded)) {
+    timer.start();
+    if (!split(lattice)) {
+      return false;
     }
+    timer.lap(0, "split");
+    timer.stats.degraded = 1;
   }
 
-  if (!result) {
+  timer.start();
+  if (!forwardbackward(lattice)) {
     return false;
   }
+  if (lattice->has_request_type(MECAB_MARGINAL_PROB)) {
+    timer.lap(&timer.stats.forwardbackward_cycles, "forwardbackward");
+  }
 
-  if (!forwardbackward(lattice)) {
+  timer.start();
+  if (!buildResult(lattice, budget)) {
     return false;
   }
+  timer.lap(0, "best_path");
+
+  if (stats_) {
+    timer.stats.sentences = 1;
+    timer.stats.bytes = lattice->size();
+    timer.stats.analyze_cycles = read_cycles() - start;
+    stats_->add(timer.stats);
+  }
+
+  return true;
+}
 
+bool Viterbi::buildResult(Lattice *lattice,
+                          const WorkBudget &budget) const {
   if (!buildBestLattice(lattice)) {
     return false;
   }
@@ -115,13 +209,42 @@ bool Viterbi::analyze(Lattice *lattice) const {
     return false;
   }
 
-  if (!initNBest(lattice)) {
+  if (!initNBest(lattice, budget)) {
     return false;
   }
 
   return true;
 }
 
+bool Viterbi::isAllPath(const Lattice *lattice) const {
+  return (lattice->has_request_type(MECAB_NBEST) && !nbestOnDemand()) ||
+      lattice->has_request_type(MECAB_MARGINAL_PROB);
+}
+
+template <bool IsProfiled>
+bool Viterbi::search(Lattice *lattice, PhaseTimer *timer,
+                     WorkBudget *budget) const {
+  if (isAllPath(lattice)) {
+    // IsAllPath=true
+    if (lattice->has_constraint()) {
+      return viterbi<true, true, IsProfiled>(lattice, timer, budget);
+    }
+    return viterbi<true, false, IsProfiled>(lattice, timer, budget);
+  }
+  // IsAllPath=false
+  if (lattice->has_constraint()) {
+    return viterbi<false, true, IsProfiled>(lattice, timer, budget);
+  }
+  return viterbi<false, false, IsProfiled>(lattice, timer, budget);
+}
+
+bool Viterbi::split(Lattice *lattice) const {
+  if (!lattice->is_degraded()) {
+    return false;
+  }
+  return isAllPath(lattice) ? split<true>(lattice) : split<false>(lattice);
+}
+
 const Tokenizer<Node, Path> *Viterbi::tokenizer() const {
   return tokenizer_.get();
 }
@@ -175,6 +298,7 @@ bool Viterbi::forwardbackward(Lattice *lattice) {
 
 // static
 bool Viterbi::buildResultForNBest(Lattice *lattice) {
+  buildBestPathSpans(lattice);
   return buildAllLattice(lattice);
 }
 
@@ -238,15 +362,20 @@ bool Viterbi::buildBestLattice(Lattice *lattice) {
     node = prev_node;
   }
 
+  buildBestPathSpans(lattice);
   return true;
 }
 
-// static
-bool Viterbi::initNBest(Lattice *lattice) {
+bool Viterbi::initNBest(Lattice *lattice, const WorkBudget &budget) const {
   if (!lattice->has_request_type(MECAB_NBEST)) {
     return true;
   }
-  lattice->allocator()->nbest_generator()->set(lattice);
+  // the paths are built anyway when marginals are requested.
+  const bool on_demand = nbestOnDemand() &&
+      !lattice->has_request_type(MECAB_MARGINAL_PROB);
+  lattice->allocator()->nbest_generator()->set(
+      lattice, on_demand ? connector_.get() : 0,
+      nbest_agenda_size_, nbest_unique_, nbest_max_candidates_, budget);
   return true;
 }
 
@@ -317,15 +446,23 @@ bool Viterbi::initPartial(Lattice *lattice) {
 }
 
 namespace {
-template <bool IsAllPath> bool connect(size_t pos, Node *rnode,
-                                       Node **begin_node_list,
-                                       Node **end_node_list,
-                                       const Connector *connector,
-                                       Allocator<Node, Path> *allocator) {
+// |paths| counts the connections only if IsCounted, so that the search
+// without a budget or counters keeps its inner loop as it was.
+template <bool IsAllPath, bool IsCounted>
+bool connect(size_t pos, Node *rnode,
+             Node **begin_node_list,
+             Node **end_node_list,
+             const Connector *connector,
+             Allocator<Node, Path> *allocator,
+             size_t *paths) {
+  size_t n = 0;
   for (;rnode; rnode = rnode->bnext) {
     register long best_cost = 2147483647;
     Node* best_node = 0;
     for (Node *lnode = end_node_list[pos]; lnode; lnode = lnode->enext) {
+      if (IsCounted) {
+        ++n;
+      }
       register int lcost = connector->cost(lnode, rnode);  // local cost
       register long cost = lnode->cost + lcost;
 
@@ -359,36 +496,80 @@ template <bool IsAllPath> bool connect(size_t pos, Node *rnode,
     end_node_list[x] = rnode;
   }
 
+  if (IsCounted) {
+    *paths += n;
+  }
   return true;
 }
 }  // namespace
 
-template <bool IsAllPath, bool IsPartial>
-bool Viterbi::viterbi(Lattice *lattice) const {
+template <bool IsAllPath, bool IsPartial, bool IsProfiled>
+bool Viterbi::viterbi(Lattice *lattice, PhaseTimer *timer,
+                      WorkBudget *budget) const {
   Node **end_node_list   = lattice->end_nodes();
   Node **begin_node_list = lattice->begin_nodes();
   Allocator<Node, Path> *allocator = lattice->allocator();
   const size_t len = lattice->size();
   const char *begin = lattice->sentence();
   const char *end = begin + len;
+  size_t paths = 0;
+  const bool counted = IsProfiled || budget;
 
   Node *bos_node = tokenizer_->getBOSNode(lattice->allocator());
   bos_node->surface = lattice->sentence();
   end_node_list[0] = bos_node;
 
+  if (IsProfiled) {
+    timer->start();
+  }
+  tokenizer_->classify(begin, end, allocator);
+  if (IsProfiled) {
+    timer->lap(&timer->stats.lookup_cycles, "classify", "bytes", len);
+  }
+  if (tokenizer_->scan(begin, end, allocator) && IsProfiled) {
+    timer->lap(&timer->stats.lookup_cycles, "scan", "bytes", len);
+  }
+
   for (size_t pos = 0; pos < len; ++pos) {
     if (end_node_list[pos]) {
+      if (IsProfiled) {
+        timer->start();
+      }
       Node *right_node = tokenizer_->lookup<IsPartial>(begin + pos, end,
                                                        allocator, lattice);
       begin_node_list[pos] = right_node;
-      if (!connect<IsAllPath>(pos, right_node,
-                              begin_node_list,
-                              end_node_list,
-                              connector_.get(),
-                              allocator)) {
+      if (IsProfiled) {
+        timer->lap(&timer->stats.lookup_cycles, "lookup", "pos", pos);
+      }
+      if (!(counted ?
+            connect<IsAllPath, true>(pos, right_node,
+                                     begin_node_list,
+                                     end_node_list,
+                                     connector_.get(),
+                                     allocator, &paths) :
+            connect<IsAllPath, false>(pos, right_node,
+                                      begin_node_list,
+                                      end_node_list,
+                                      connector_.get(),
+                                      allocator, 0))) {
         lattice->set_what("too long sentence.");
         return false;
       }
+      if (IsProfiled) {
+        timer->lap(&timer->stats.connect_cycles, "connect", "pos", pos);
+        count_nodes(right_node, &timer->stats);
+      }
+      if (budget) {
+        const char *what = budget->exceeded(allocator->node_size(), paths);
+        if (what) {
+          if (IsProfiled) {
+            timer->stats.paths += paths;
+          }
+          lattice->set_what(what);
+          lattice->set_degraded(true);
+          return false;
+        }
+      }
     }
   }
 
@@ -398,14 +579,20 @@ bool Viterbi::viterbi(Lattice *lattice) const {
 
   for (long pos = (long)len; static_cast<long>(pos) >= 0; --pos) {
     if (end_node_list[pos]) {
-      if (!connect<IsAllPath>(pos, eos_node,
-                              begin_node_list,
-                              end_node_list,
-                              connector_.get(),
-                              allocator)) {
+      if (IsProfiled) {
+        timer->start();
+      }
+      if (!connect<IsAllPath, true>(pos, eos_node,
+                                    begin_node_list,
+                                    end_node_list,
+                                    connector_.get(),
+                                    allocator, &paths)) {
         lattice->set_what("too long sentence.");
         return false;
       }
+      if (IsProfiled) {
+        timer->lap(&timer->stats.connect_cycles, "connect", "pos", pos);
+      }
       break;
     }
   }
@@ -413,6 +600,52 @@ bool Viterbi::viterbi(Lattice *lattice) const {
   end_node_list[0] = bos_node;
   begin_node_list[lattice->size()] = eos_node;
 
+  if (IsProfiled) {
+    timer->stats.paths += paths;
+  }
+
+  return true;
+}
+
+template <bool IsAllPath>
+bool Viterbi::split(Lattice *lattice) const {
+  Node **end_node_list   = lattice->end_nodes();
+  Node **begin_node_list = lattice->begin_nodes();
+  Allocator<Node, Path> *allocator = lattice->allocator();
+  const size_t len = lattice->size();
+  const char *begin = lattice->sentence();
+  const char *end = begin + len;
+
+  // the nodes of the abandoned search stay in the allocator, unlinked.
+  std::fill(end_node_list, end_node_list + len + 1, static_cast<Node *>(0));
+  std::fill(begin_node_list, begin_node_list + len + 1,
+            static_cast<Node *>(0));
+
+  Node *bos_node = tokenizer_->getBOSNode(allocator);
+  bos_node->surface = begin;
+  end_node_list[0] = bos_node;
+
+  size_t pos = 0;
+  while (pos < len) {
+    Node *node = tokenizer_->lookupRun(begin + pos, end, allocator, lattice);
+    if (!node) {  // white spaces at the end
+      break;
+    }
+    begin_node_list[pos] = node;
+    connect<IsAllPath, false>(pos, node, begin_node_list, end_node_list,
+                              connector_.get(), allocator, 0);
+    pos += node->rlength;
+  }
+
+  Node *eos_node = tokenizer_->getEOSNode(allocator);
+  eos_node->surface = end;
+  begin_node_list[len] = eos_node;
+  connect<IsAllPath, false>(pos, eos_node, begin_node_list, end_node_list,
+                            connector_.get(), allocator, 0);
+
+  end_node_list[0] = bos_node;
+  begin_node_list[len] = eos_node;
+
   return true;
 }
 }  // Mecab
@@ -8,6 +8,7 @@
 
 #include <vector>
 #include "mecab.h"
+#include "budget.h"
 #include "thread.h"
 
 namespace MeCab {
@@ -15,6 +16,9 @@ namespace MeCab {
 class Lattice;
 class Param;
 class Connector;
+class StatsCounter;
+class Tracer;
+class PhaseTimer;
 template <typename N, typename P> class Tokenizer;
 
 class Viterbi {
@@ -27,6 +31,12 @@ class Viterbi {
 
   const Connector *connector() const;
 
+  // Counts the analysis into |stats| if not null.
+  void set_stats(StatsCounter *stats) { stats_ = stats; }
+
+  // Records the phases into the trace if not null.
+  void set_tracer(Tracer *tracer) { tracer_ = tracer; }
+
   const char *what() { return what_.str(); }
 
   static bool buildResultForNBest(Lattice *lattice);
@@ -35,19 +45,44 @@ class Viterbi {
   virtual ~Viterbi();
 
  private:
-  template <bool IsAllPath, bool IsPartial> bool viterbi(Lattice *lattice) const;
+  template <bool IsProfiled>
+  bool search(Lattice *lattice, PhaseTimer *timer, WorkBudget *budget) const;
+  template <bool IsAllPath, bool IsPartial, bool IsProfiled>
+  bool viterbi(Lattice *lattice, PhaseTimer *timer,
+               WorkBudget *budget) const;
+  bool isAllPath(const Lattice *lattice) const;
+  // Rebuilds a lattice whose search ran out of the budget as one path of
+  // character type runs, cut at the token boundaries of partial parsing
+  // and with the constrained tokens as they are. Returns false unless
+  // the lattice is degraded.
+  bool split(Lattice *lattice) const;
+  template <bool IsAllPath>
+  bool split(Lattice *lattice) const;
+  bool buildResult(Lattice *lattice, const WorkBudget &budget) const;
 
   static bool forwardbackward(Lattice *lattice);
   static bool initPartial(Lattice *lattice);
-  static bool initNBest(Lattice *lattice);
+  bool initNBest(Lattice *lattice, const WorkBudget &budget) const;
   static bool buildBestLattice(Lattice *lattice);
   static bool buildAllLattice(Lattice *lattice);
   static bool buildAlternative(Lattice *lattice);
 
+  // The bounded or deduplicating N-best search costs left nodes from
+  // the connector and does not need the Path graph.
+  bool nbestOnDemand() const {
+    return nbest_agenda_size_ > 0 || nbest_unique_ >= 0;
+  }
+
   macab_io_file_t *io_;
   std::shared_ptr<Tokenizer<Node, Path> > tokenizer_;
   std::shared_ptr<Connector> connector_;
   int                   cost_factor_;
+  size_t                nbest_agenda_size_;
+  int                   nbest_unique_;
+  size_t                nbest_max_candidates_;
+  WorkBudget            budget_;
+  StatsCounter         *stats_;
+  Tracer               *tracer_;
   whatlog               what_;
 };
 }
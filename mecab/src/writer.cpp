@@ -3,6 +3,7 @@
 //
 //  Copyright(C) 2001-2011 Taku Kudo <taku@chasen.org>
 //  Copyright(C) 2004-2006 Nippon Telegraph and Telephone Corporation
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
@@ -11,13 +12,149 @@
 #include "mecab.h"
 #include "common.h"
 #include "param.h"
+#include "stats.h"
+#include "tracer.h"
 #include "string_buffer.h"
 #include "utils.h"
 #include "writer.h"
 
 namespace MeCab {
+namespace {
 
-Writer::Writer() : write_(&Writer::writeLattice) {}
+enum {
+  FORMAT_LITERAL,
+  FORMAT_SENTENCE,
+  FORMAT_SENTENCE_LENGTH,
+  FORMAT_SURFACE,
+  FORMAT_SURFACE_WITH_SPACE,
+  FORMAT_POSID,
+  FORMAT_WCOST,
+  FORMAT_FEATURE,
+  FORMAT_CHAR_TYPE,
+  FORMAT_STAT,
+  FORMAT_PROB,
+  FORMAT_NODE_ID,
+  FORMAT_SPACE,
+  FORMAT_BEGIN,
+  FORMAT_END,
+  FORMAT_CONNECTION_COST,
+  FORMAT_WORD_COST,
+  FORMAT_COST,
+  FORMAT_NODE_COST,
+  FORMAT_IS_BEST,
+  FORMAT_ALPHA,
+  FORMAT_BETA,
+  FORMAT_LENGTH,
+  FORMAT_RLENGTH,
+  FORMAT_LCATTR,
+  FORMAT_RCATTR,
+  FORMAT_PATH,
+  FORMAT_COLUMN
+};
+
+// Columns of a feature CSV, split on first use. Plain features are
+// referenced in place; quoted or padded ones go through tokenizeCSV().
+class FeatureColumns {
+ public:
+  explicit FeatureColumns(const char *feature)
+      : feature_(feature), size_(0), parsed_(false) {}
+
+  void parse() {
+    if (parsed_) {
+      return;
+    }
+    parsed_ = true;
+
+    if (std::strpbrk(feature_, "\" \t")) {
+      std::array<char *, kMaxColumns> ptr;
+      std::strncpy(buf_.data(), feature_, buf_.size());
+      size_ = tokenizeCSV(buf_.data(), ptr.data(), ptr.size());
+      for (size_t i = 0; i < size_; ++i) {
+        begin_[i] = ptr[i];
+        length_[i] = std::strlen(ptr[i]);
+      }
+      return;
+    }
+
+    // same splitting as tokenizeCSV()
+    const char *str = feature_;
+    const char *eos = str + std::strlen(str);
+    size_t max = kMaxColumns;
+    for (; str < eos; ++str) {
+      const char *start = str;
+      str = std::find(str, eos, ',');
+      begin_[size_] = start;
+      length_[size_] = (max-- > 1 ? str : eos) - start;
+      ++size_;
+      if (max == 0) break;
+    }
+  }
+
+  size_t size() const { return size_; }
+  const char *begin(size_t i) const { return begin_[i]; }
+  size_t length(size_t i) const { return length_[i]; }
+
+ private:
+  static const size_t kMaxColumns = 64;
+  const char *feature_;
+  size_t size_;
+  bool parsed_;
+  std::array<const char *, kMaxColumns> begin_;
+  std::array<size_t, kMaxColumns> length_;
+  std::array<char, BUF_SIZE> buf_;
+};
+
+template <class T>
+void writeRaw(StringBuffer *os, const T &value) {
+  os->write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// Writes |str| as the body of a JSON string.
+void writeJSONString(StringBuffer *os, const char *str, size_t length) {
+  static const char kHex[] = "0123456789abcdef";
+  const char *begin = str;
+  const char *end = str + length;
+  for (const char *p = str; p < end; ++p) {
+    const unsigned char c = static_cast<unsigned char>(*p);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    os->write(begin, p - begin);
+    begin = p + 1;
+    switch (c) {
+      case '"':  *os << "\\\""; break;
+      case '\\': *os << "\\\\"; break;
+      case '\n': *os << "\\n"; break;
+      case '\r': *os << "\\r"; break;
+      case '\t': *os << "\\t"; break;
+      default:
+        *os << "\\u00" << kHex[c >> 4] << kHex[c & 0xf];
+        break;
+    }
+  }
+  os->write(begin, end - begin);
+}
+
+// Writes |value| as a JSON number, formatted from the last digit in a
+// buffer on the stack and appended in one write.
+void writeJSONInt(StringBuffer *os, long value) {
+  char buf[24];
+  char *p = buf + sizeof(buf);
+  unsigned long n = value < 0 ? 0UL - static_cast<unsigned long>(value) :
+      static_cast<unsigned long>(value);
+  do {
+    *--p = static_cast<char>('0' + n % 10);
+    n /= 10;
+  } while (n);
+  if (value < 0) {
+    *--p = '-';
+  }
+  os->write(p, buf + sizeof(buf) - p);
+}
+}  // namespace
+
+Writer::Writer() : write_(&Writer::writeLattice), stats_(0),
+                   tracer_(0) {}
 Writer::~Writer() {}
 
 void Writer::close() {
@@ -36,6 +173,10 @@ bool Writer::open(const Param &param) {
     write_ = &Writer::writeDump;
   } else if (ostyle == "em") {
     write_ = &Writer::writeEM;
+  } else if (ostyle == "binary") {
+    write_ = &Writer::writeBinary;
+  } else if (ostyle == "json") {
+    write_ = &Writer::writeJSON;
   } else {
     // default values
     std::string node_format = "%m\\t%H\\n";
@@ -98,11 +239,18 @@ bool Writer::open(const Param &param) {
       if (eon_format != eon_format2) {
         eon_format = eon_format2;
       }
-      node_format_ = node_format.c_str();
-      bos_format_ = bos_format.c_str();
-      eos_format_ = eos_format.c_str();
-      unk_format_ = unk_format.c_str();
-      eon_format_ = eon_format.c_str();
+
+      std::string error;
+      CHECK_FALSE(compileFormat(node_format.c_str(), &node_format_, &error))
+          << error << ": " << node_format_key;
+      CHECK_FALSE(compileFormat(bos_format.c_str(), &bos_format_, &error))
+          << error << ": " << bos_format_key;
+      CHECK_FALSE(compileFormat(eos_format.c_str(), &eos_format_, &error))
+          << error << ": " << eos_format_key;
+      CHECK_FALSE(compileFormat(unk_format.c_str(), &unk_format_, &error))
+          << error << ": " << unk_format_key;
+      CHECK_FALSE(compileFormat(eon_format.c_str(), &eon_format_, &error))
+          << error << ": " << eon_format_key;
     }
   }
 
@@ -113,7 +261,22 @@ bool Writer::write(Lattice *lattice, StringBuffer *os) const {
   if (!lattice || !lattice->is_available()) {
     return false;
   }
-  return (this->*write_)(lattice, os);
+  TraceBuffer *trace = tracer_ ? tracer_->recording() : 0;
+  if (!stats_ && !trace) {
+    return (this->*write_)(lattice, os);
+  }
+
+  PhaseTimer timer(tracer_, trace);
+  const size_t size = os->size();
+  timer.start();
+  const bool result = (this->*write_)(lattice, os);
+  timer.lap(&timer.stats.write_cycles, "format", "bytes", os->size() - size);
+  if (stats_) {
+    timer.stats.writes = 1;
+    timer.stats.written_bytes = os->size() - size;
+    stats_->add(timer.stats);
+  }
+  return result;
 }
 
 bool Writer::writeLattice(Lattice *lattice, StringBuffer *os) const {
@@ -200,19 +363,106 @@ bool Writer::writeDump(Lattice *lattice, StringBuffer *os) const {
   return true;
 }
 
+bool Writer::writeBinary(Lattice *lattice, StringBuffer *os) const {
+  const char *str = lattice->sentence();
+  const Node *bos = lattice->bos_node();
+
+  mecab_record_header_t header;
+  header.magic = MECAB_RECORD_MAGIC;
+  header.token_size = 0;
+  header.sentence_length = static_cast<unsigned int>(lattice->size());
+  header.feature_size = 0;
+  for (const Node *node = bos->next; node->next; node = node->next) {
+    ++header.token_size;
+    header.feature_size +=
+        static_cast<unsigned int>(std::strlen(node->feature)) + 1;
+  }
+  const size_t body = sizeof(header) +
+      header.token_size * sizeof(mecab_record_token_t) +
+      header.sentence_length + header.feature_size;
+  header.size = static_cast<unsigned int>((body + 3) & ~size_t(3));
+  writeRaw(os, header);
+
+  unsigned int feature_offset = 0;
+  for (const Node *node = bos->next; node->next; node = node->next) {
+    mecab_record_token_t token;
+    token.begin = static_cast<unsigned int>(node->surface - str);
+    token.length = node->length;
+    token.rlength = node->rlength;
+    token.posid = node->posid;
+    token.lcAttr = node->lcAttr;
+    token.rcAttr = node->rcAttr;
+    token.char_type = node->char_type;
+    token.stat = node->stat;
+    token.wcost = node->wcost;
+    token.reserved = 0;
+    token.cost = static_cast<int>(node->cost);
+    token.feature_offset = feature_offset;
+    token.feature_length = static_cast<unsigned int>(std::strlen(node->feature));
+    feature_offset += token.feature_length + 1;
+    writeRaw(os, token);
+  }
+
+  os->write(str, header.sentence_length);
+  for (const Node *node = bos->next; node->next; node = node->next) {
+    os->write(node->feature, std::strlen(node->feature) + 1);
+  }
+  for (size_t i = body; i < header.size; ++i) {
+    *os << '\0';
+  }
+  return true;
+}
+
+bool Writer::writeJSON(Lattice *lattice, StringBuffer *os) const {
+  const char *str = lattice->sentence();
+  *os << "{\"sentence\":\"";
+  writeJSONString(os, str, lattice->size());
+  *os << "\",\"tokens\":[";
+  const Node *bos = lattice->bos_node();
+  for (const Node *node = bos->next; node->next; node = node->next) {
+    if (node != bos->next) {
+      *os << ',';
+    }
+    const long begin = static_cast<long>(node->surface - str);
+    *os << "{\"surface\":\"";
+    writeJSONString(os, node->surface, node->length);
+    *os << "\",\"feature\":\"";
+    writeJSONString(os, node->feature, std::strlen(node->feature));
+    *os << "\",\"begin\":";
+    writeJSONInt(os, begin);
+    *os << ",\"end\":";
+    writeJSONInt(os, begin + static_cast<long>(node->length));
+    *os << ",\"posid\":";
+    writeJSONInt(os, node->posid);
+    *os << ",\"lcAttr\":";
+    writeJSONInt(os, node->lcAttr);
+    *os << ",\"rcAttr\":";
+    writeJSONInt(os, node->rcAttr);
+    *os << ",\"stat\":";
+    writeJSONInt(os, node->stat);
+    *os << ",\"wcost\":";
+    writeJSONInt(os, node->wcost);
+    *os << ",\"cost\":";
+    writeJSONInt(os, node->cost);
+    *os << '}';
+  }
+  *os << "]}\n";
+  return true;
+}
+
 bool Writer::writeUser(Lattice *lattice, StringBuffer *os) const {
-  if (!writeNode(lattice, bos_format_.data(), lattice->bos_node(), os)) {
+  if (!writeNode(lattice, bos_format_, lattice->bos_node(), os)) {
     return false;
   }
   const Node *node = 0;
   for (node = lattice->bos_node()->next; node->next; node = node->next) {
-    const char *fmt = (node->stat == MECAB_UNK_NODE ? unk_format_.data() :
-                       node_format_.data());
+    const Format &fmt = (node->stat == MECAB_UNK_NODE ? unk_format_ :
+                         node_format_);
     if (!writeNode(lattice, fmt, node, os)) {
       return false;
     }
   }
-  if (!writeNode(lattice, eos_format_.data(), node, os)) {
+  if (!writeNode(lattice, eos_format_, node, os)) {
     return false;
   }
   return true;
@@ -222,15 +472,15 @@ bool Writer::writeNode(Lattice *lattice, const Node *node,
                        StringBuffer *os) const {
   switch (node->stat) {
     case MECAB_BOS_NODE:
-      return writeNode(lattice, bos_format_.data(), node, os);
+      return writeNode(lattice, bos_format_, node, os);
     case MECAB_EOS_NODE:
-      return writeNode(lattice, eos_format_.data(), node, os);
+      return writeNode(lattice, eos_format_, node, os);
     case MECAB_UNK_NODE:
-      return writeNode(lattice, unk_format_.data(), node, os);
+      return writeNode(lattice, unk_format_, node, os);
     case MECAB_NOR_NODE:
-      return writeNode(lattice, node_format_.data(), node, os);
+      return writeNode(lattice, node_format_, node, os);
     case MECAB_EON_NODE:
-      return writeNode(lattice, eon_format_.data(), node, os);
+      return writeNode(lattice, eon_format_, node, os);
   }
   return true;
 }
@@ -239,174 +489,257 @@ bool Writer::writeNode(Lattice *lattice,
                        const char *p,
                        const Node *node,
                        StringBuffer *os) const {
-  std::array<char, BUF_SIZE> buf;
-  std::array<char *, 64> ptr;
-  size_t psize = 0;
+  Format format;
+  std::string error;
+  if (!compileFormat(p, &format, &error)) {
+    lattice->set_what(error.c_str());
+    return false;
+  }
+  return writeNode(lattice, format, node, os);
+}
+
+bool Writer::compileFormat(const char *p, Format *ops, std::string *error) {
+  ops->clear();
 
+  FormatOp op;
+  op.type = FORMAT_LITERAL;
+  op.mode = 0;
+  op.separator = 0;
+
+  std::string literal;
   for (; *p; p++) {
+    op.type = FORMAT_LITERAL;
+    op.text.clear();
+    op.column.clear();
+
     switch (*p) {
-      default: *os << *p; break;
+      default: literal += *p; continue;
 
-      case '\\': *os << getEscapedChar(*++p); break;
+      case '\\': literal += getEscapedChar(*++p); continue;
 
       case '%': {  // macros
         switch (*++p) {
-          default: {
-            const std::string error = "unknown meta char: " + *p;
-            lattice->set_what(error.c_str());
+          default:
+            *error = "unknown meta char: ";
+            *error += *p;
             return false;
-          }
-            // input sentence
-          case 'S': os->write(lattice->sentence(), lattice->size()); break;
-            // sentence length
-          case 'L': *os << (unsigned int)lattice->size(); break;
-            // morph
-          case 'm': os->write(node->surface, node->length); break;
-          case 'M': os->write(reinterpret_cast<const char *>
-                              (node->surface - node->rlength + node->length),
-                              node->rlength);
-            break;
-          case 'h': *os << node->posid; break;  // Part-Of-Speech ID
-          case '%': *os << '%'; break;         // %
-          case 'c': *os << static_cast<int>(node->wcost); break;  // word cost
-          case 'H': *os << node->feature; break;
-          case 't': *os << static_cast<unsigned int>(node->char_type); break;
-          case 's': *os << static_cast<unsigned int>(node->stat); break;
-          case 'P': *os << node->prob; break;
+          case '%': literal += '%'; continue;
+          case 'S': op.type = FORMAT_SENTENCE; break;
+          case 'L': op.type = FORMAT_SENTENCE_LENGTH; break;
+          case 'm': op.type = FORMAT_SURFACE; break;
+          case 'M': op.type = FORMAT_SURFACE_WITH_SPACE; break;
+          case 'h': op.type = FORMAT_POSID; break;
+          case 'c': op.type = FORMAT_WCOST; break;
+          case 'H': op.type = FORMAT_FEATURE; break;
+          case 't': op.type = FORMAT_CHAR_TYPE; break;
+          case 's': op.type = FORMAT_STAT; break;
+          case 'P': op.type = FORMAT_PROB; break;
           case 'p': {
             switch (*++p) {
               default:
-                lattice->set_what("[iseSCwcnblLh] is required after %p");
+                *error = "[iseSCwcnblLh] is required after %p";
                 return false;
-              case 'i': *os << node->id; break;  // node id
-              case 'S': os->write(reinterpret_cast<const char*>
-                                  (node->surface -
-                                   node->rlength + node->length),
-                                  node->rlength - node->length);
-                break;  // space
-                // start position
-              case 's': *os << static_cast<int>(
-                  node->surface - lattice->sentence());
-                break;
-                // end position
-              case 'e': *os << static_cast<int>
-                    (node->surface - lattice->sentence() + node->length);
-                break;
-                // connection cost
-              case 'C': *os << node->cost -
-                    node->prev->cost - node->wcost;
-                break;
-              case 'w': *os << node->wcost; break;  // word cost
-              case 'c': *os << node->cost; break;  // best cost
-              case 'n': *os << (node->cost - node->prev->cost); break;
-                // node cost
-                // * if best path, otherwise ' '
-              case 'b': *os << (node->isbest ? '*' : ' '); break;
-              case 'P': *os << node->prob; break;
-              case 'A': *os << node->alpha; break;
-              case 'B': *os << node->beta; break;
-              case 'l': *os << node->length; break;  // length of morph
-                // length of morph including the spaces
-              case 'L': *os << node->rlength;    break;
-              case 'h': {  // Hidden Layer ID
+              case 'i': op.type = FORMAT_NODE_ID; break;
+              case 'S': op.type = FORMAT_SPACE; break;
+              case 's': op.type = FORMAT_BEGIN; break;
+              case 'e': op.type = FORMAT_END; break;
+              case 'C': op.type = FORMAT_CONNECTION_COST; break;
+              case 'w': op.type = FORMAT_WORD_COST; break;
+              case 'c': op.type = FORMAT_COST; break;
+              case 'n': op.type = FORMAT_NODE_COST; break;
+              case 'b': op.type = FORMAT_IS_BEST; break;
+              case 'P': op.type = FORMAT_PROB; break;
+              case 'A': op.type = FORMAT_ALPHA; break;
+              case 'B': op.type = FORMAT_BETA; break;
+              case 'l': op.type = FORMAT_LENGTH; break;
+              case 'L': op.type = FORMAT_RLENGTH; break;
+              case 'h': {
                 switch (*++p) {
                   default:
-                    lattice->set_what("lr is required after %ph");
+                    *error = "lr is required after %ph";
                     return false;
-                  case 'l': *os << node->lcAttr; break;   // current
-                  case 'r': *os << node->rcAttr; break;   // prev
+                  case 'l': op.type = FORMAT_LCATTR; break;
+                  case 'r': op.type = FORMAT_RCATTR; break;
                 }
               } break;
-
               case 'p': {
-                char mode = *++p;
-                char sep = *++p;
-                if (sep == '\\') {
-                  sep = getEscapedChar(*++p);
-                }
-                if (!node->lpath) {
-                  lattice->set_what("no path information is available");
+                op.type = FORMAT_PATH;
+                op.mode = *++p;
+                if (op.mode != 'i' && op.mode != 'c' && op.mode != 'P') {
+                  *error = "[icP] is required after %pp";
                   return false;
                 }
-                for (Path *path = node->lpath; path; path = path->lnext) {
-                  if (path != node->lpath) *os << sep;
-                  switch (mode) {
-                    case 'i': *os << path->lnode->id; break;
-                    case 'c': *os << path->cost; break;
-                    case 'P': *os << path->prob; break;
-                    default:
-                      lattice->set_what("[icP] is required after %pp");
-                      return false;
-                  }
+                op.separator = *++p;
+                if (op.separator == '\\') {
+                  op.separator = getEscapedChar(*++p);
                 }
               } break;
-
             }
           } break;
 
           case 'F':
           case 'f': {
-            if (node->feature[0] == '\0') {
-              lattice->set_what("no feature information available");
-              return false;
-            }
-            if (!psize) {
-              std::strncpy(buf.data(), node->feature, buf.size());
-              psize = tokenizeCSV(buf.data(), ptr.data(), ptr.size());
-            }
-
-            // separator
-            char separator = '\t';  // default separator
+            op.type = FORMAT_COLUMN;
+            op.separator = '\t';  // default separator
             if (*p == 'F') {  // change separator
               if (*++p == '\\') {
-                separator = getEscapedChar(*++p);
+                op.separator = getEscapedChar(*++p);
               } else {
-                separator = *p;
+                op.separator = *p;
               }
             }
 
-            if (*++p !='[') {
-              lattice->set_what("cannot find '['");
+            if (*++p != '[') {
+              *error = "cannot find '['";
               return false;
             }
             size_t n = 0;
-            bool sep = false;
-            bool isfil = false;
-            p++;
-
-            for (;; ++p) {
+            for (++p; *p != ']'; ++p) {
               switch (*p) {
                 case '0': case '1': case '2': case '3': case '4':
                 case '5': case '6': case '7': case '8': case '9':
-                  n = 10 * n +(*p - '0');
+                  n = 10 * n + (*p - '0');
                   break;
-                case ',': case ']':
-                  if (n >= psize) {
-                    lattice->set_what("given index is out of range");
-                    return false;
-                  }
-                  isfil = (ptr[n][0] != '*');
-                  if (isfil) {
-                    if (sep) {
-                      *os << separator;
-                    }
-                    *os << ptr[n];
-                  }
-                  if (*p == ']') {
-                    goto last;
-                  }
-                  sep = isfil;
+                case ',':
+                  op.column.push_back(n);
                   n = 0;
                   break;
                 default:
-                  lattice->set_what("cannot find ']'");
+                  *error = "cannot find ']'";
                   return false;
               }
             }
-          } last: break;
-        }  // end switch
-      } break;  // end case '%'
-    }  // end switch
+            op.column.push_back(n);
+          } break;
+        }
+      } break;
+    }
+
+    if (!literal.empty()) {
+      FormatOp text;
+      text.type = FORMAT_LITERAL;
+      text.mode = text.separator = 0;
+      text.text.swap(literal);
+      ops->push_back(text);
+    }
+    ops->push_back(op);
+  }
+
+  if (!literal.empty()) {
+    op.type = FORMAT_LITERAL;
+    op.text.swap(literal);
+    op.column.clear();
+    ops->push_back(op);
+  }
+
+  return true;
+}
+
+bool Writer::writeNode(Lattice *lattice,
+                       const Format &format,
+                       const Node *node,
+                       StringBuffer *os) const {
+  FeatureColumns columns(node->feature);
+
+  for (Format::const_iterator op = format.begin(); op != format.end(); ++op) {
+    switch (op->type) {
+      case FORMAT_LITERAL: os->write(op->text.data(), op->text.size()); break;
+        // input sentence
+      case FORMAT_SENTENCE:
+        os->write(lattice->sentence(), lattice->size());
+        break;
+        // sentence length
+      case FORMAT_SENTENCE_LENGTH:
+        *os << (unsigned int)lattice->size();
+        break;
+        // morph
+      case FORMAT_SURFACE: os->write(node->surface, node->length); break;
+      case FORMAT_SURFACE_WITH_SPACE:
+        os->write(reinterpret_cast<const char *>
+                  (node->surface - node->rlength + node->length),
+                  node->rlength);
+        break;
+      case FORMAT_POSID: *os << node->posid; break;  // Part-Of-Speech ID
+      case FORMAT_WCOST: *os << static_cast<int>(node->wcost); break;
+      case FORMAT_FEATURE: *os << node->feature; break;
+      case FORMAT_CHAR_TYPE:
+        *os << static_cast<unsigned int>(node->char_type);
+        break;
+      case FORMAT_STAT: *os << static_cast<unsigned int>(node->stat); break;
+      case FORMAT_PROB: *os << node->prob; break;
+      case FORMAT_NODE_ID: *os << node->id; break;  // node id
+      case FORMAT_SPACE:
+        os->write(reinterpret_cast<const char*>
+                  (node->surface - node->rlength + node->length),
+                  node->rlength - node->length);
+        break;
+        // start position
+      case FORMAT_BEGIN:
+        *os << static_cast<int>(node->surface - lattice->sentence());
+        break;
+        // end position
+      case FORMAT_END:
+        *os << static_cast<int>
+            (node->surface - lattice->sentence() + node->length);
+        break;
+        // connection cost
+      case FORMAT_CONNECTION_COST:
+        *os << node->cost - node->prev->cost - node->wcost;
+        break;
+      case FORMAT_WORD_COST: *os << node->wcost; break;  // word cost
+      case FORMAT_COST: *os << node->cost; break;  // best cost
+        // node cost
+      case FORMAT_NODE_COST: *os << (node->cost - node->prev->cost); break;
+        // * if best path, otherwise ' '
+      case FORMAT_IS_BEST: *os << (node->isbest ? '*' : ' '); break;
+      case FORMAT_ALPHA: *os << node->alpha; break;
+      case FORMAT_BETA: *os << node->beta; break;
+      case FORMAT_LENGTH: *os << node->length; break;  // length of morph
+        // length of morph including the spaces
+      case FORMAT_RLENGTH: *os << node->rlength; break;
+      case FORMAT_LCATTR: *os << node->lcAttr; break;   // current
+      case FORMAT_RCATTR: *os << node->rcAttr; break;   // prev
+
+      case FORMAT_PATH: {
+        if (!node->lpath) {
+          lattice->set_what("no path information is available");
+          return false;
+        }
+        for (Path *path = node->lpath; path; path = path->lnext) {
+          if (path != node->lpath) *os << op->separator;
+          switch (op->mode) {
+            case 'i': *os << path->lnode->id; break;
+            case 'c': *os << path->cost; break;
+            case 'P': *os << path->prob; break;
+          }
+        }
+      } break;
+
+      case FORMAT_COLUMN: {
+        if (node->feature[0] == '\0') {
+          lattice->set_what("no feature information available");
+          return false;
+        }
+        columns.parse();
+        bool sep = false;
+        for (size_t i = 0; i < op->column.size(); ++i) {
+          const size_t n = op->column[i];
+          if (n >= columns.size()) {
+            lattice->set_what("given index is out of range");
+            return false;
+          }
+          const bool isfil = (columns.length(n) == 0 ||
+                              columns.begin(n)[0] != '*');
+          if (isfil) {
+            if (sep) {
+              *os << op->separator;
+            }
+            os->write(columns.begin(n), columns.length(n));
+          }
+          sep = isfil;
+        }
+      } break;
+    }
   }
 
   return true;
@@ -7,6 +7,7 @@
 #define MECAB_WRITER_H_
 
 #include <string>
+#include <vector>
 #include "common.h"
 #include "mecab.h"
 #include "utils.h"
@@ -15,6 +16,8 @@
 namespace MeCab {
 
 class Param;
+class StatsCounter;
+class Tracer;
 
 class Writer {
  public:
@@ -32,24 +35,49 @@ class Writer {
 
   bool write(Lattice *lattice, StringBuffer *node) const;
 
+  // Counts the calls of write() into |stats| if not null.
+  void set_stats(StatsCounter *stats) { stats_ = stats; }
+
+  // Records the calls of write() into the trace if not null.
+  void set_tracer(Tracer *tracer) { tracer_ = tracer; }
+
   const char *what() { return what_.str(); }
 
  private:
-  std::string node_format_;
-  std::string bos_format_;
-  std::string eos_format_;
-  std::string unk_format_;
-  std::string eon_format_;
+  // One instruction of a compiled node format.
+  struct FormatOp {
+    int                 type;
+    char                mode;       // %pp
+    char                separator;  // %pp, %F
+    std::string         text;       // literal
+    std::vector<size_t> column;     // %f[...]
+  };
+  typedef std::vector<FormatOp> Format;
+
+  Format node_format_;
+  Format bos_format_;
+  Format eos_format_;
+  Format unk_format_;
+  Format eon_format_;
   whatlog what_;
 
+  static bool compileFormat(const char *format, Format *ops,
+                            std::string *error);
+  bool writeNode(Lattice *lattice, const Format &format,
+                 const Node *node, StringBuffer *s) const;
+
   bool writeLattice(Lattice *lattice, StringBuffer *s) const;
   bool writeWakati(Lattice *lattice, StringBuffer *s) const;
   bool writeNone(Lattice *lattice, StringBuffer *s) const;
   bool writeUser(Lattice *lattice, StringBuffer *s) const;
   bool writeDump(Lattice *lattice, StringBuffer *s) const;
   bool writeEM(Lattice *lattice, StringBuffer *s) const;
+  bool writeBinary(Lattice *lattice, StringBuffer *s) const;
+  bool writeJSON(Lattice *lattice, StringBuffer *s) const;
 
   bool (Writer::*write_)(Lattice *lattice, StringBuffer *s) const;
+  StatsCounter *stats_;
+  Tracer       *tracer_;
 };
 }
 
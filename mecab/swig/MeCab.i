@@ -24,10 +24,15 @@
 %rename(Node) mecab_node_t;
 %rename(Path) mecab_path_t;
 %rename(DictionaryInfo) mecab_dictionary_info_t;
+%rename(Stats) mecab_stats_t;
+%rename(RecordToken) mecab_record_token_t;
 %ignore    mecab_model_t;
 %ignore    mecab_lattice_t;
+%ignore    mecab_record_header_t;
+%ignore    mecab_record_t;
 %nodefault mecab_path_t;
 %nodefault mecab_node_t;
+%nodefault mecab_record_token_t;
 
 %feature("notabstract") MeCab::Tagger;
 %feature("notabstract") MeCab::Lattice;
@@ -70,6 +75,23 @@
 %immutable mecab_node_t::cost;
 %immutable mecab_node_t::surface;
 
+%immutable mecab_record_token_t::begin;
+%immutable mecab_record_token_t::length;
+%immutable mecab_record_token_t::rlength;
+%immutable mecab_record_token_t::posid;
+%immutable mecab_record_token_t::lcAttr;
+%immutable mecab_record_token_t::rcAttr;
+%immutable mecab_record_token_t::char_type;
+%immutable mecab_record_token_t::stat;
+%immutable mecab_record_token_t::wcost;
+%immutable mecab_record_token_t::reserved;
+%immutable mecab_record_token_t::cost;
+%immutable mecab_record_token_t::feature_offset;
+%immutable mecab_record_token_t::feature_length;
+
+%apply (char *STRING, size_t LENGTH) { (const char *data, size_t size) };
+%newobject MeCab::Record::sentence;
+
 %extend mecab_node_t {
   char *surface;
 }
@@ -158,3 +180,71 @@ char* mecab_node_t_surface_get(mecab_node_t *n) {
 
 %include ../src/mecab.h
 %include version.h
+
+%inline %{
+namespace MeCab {
+// A binary record of output-format-type=binary, decoded with
+// mecab_record_parse(). The bytes of a script string live only for the
+// call and need not be aligned, so the first record of |data|, and
+// nothing after it, is copied to an aligned buffer.
+class Record {
+ public:
+  Record(const char *data, size_t size) : buf_(0), size_(0) {
+    mecab_record_header_t header;
+    if (size < sizeof(header)) throw "not a complete binary record";
+    memcpy(&header, data, sizeof(header));
+    if (header.size < sizeof(header) || header.size > size) {
+      throw "not a complete binary record";
+    }
+    buf_ = new unsigned int [header.size / sizeof(unsigned int) + 1];
+    memcpy(buf_, data, header.size);
+    size_ = mecab_record_parse(buf_, header.size, &record_);
+    if (!size_) {
+      delete [] buf_;
+      throw "not a complete binary record";
+    }
+  }
+
+  ~Record() {
+    delete [] buf_;
+  }
+
+  // bytes of |data| taken by this record; the next one begins there
+  size_t size() const { return size_; }
+
+  size_t token_size() const { return record_.token_size; }
+
+  const mecab_record_token_t *token(size_t i) const {
+    if (i >= record_.token_size) throw "token index out of range";
+    return record_.tokens + i;
+  }
+
+  char *sentence() const {
+    char *s = new char [record_.sentence_length + 1];
+    memcpy(s, record_.sentence, record_.sentence_length);
+    s[record_.sentence_length] = '\0';
+    return s;
+  }
+
+  char *surface(size_t i) const {
+    const mecab_record_token_t *t = token(i);
+    char *s = new char [t->length + 1];
+    memcpy(s, record_.sentence + t->begin, t->length);
+    s[t->length] = '\0';
+    return s;
+  }
+
+  const char *feature(size_t i) const {
+    return record_.features + token(i)->feature_offset;
+  }
+
+ private:
+  Record(const Record &);
+  void operator=(const Record &);
+
+  unsigned int   *buf_;
+  size_t          size_;
+  mecab_record_t  record_;
+};
+}
+%}
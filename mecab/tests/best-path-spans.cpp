@@ -0,0 +1,110 @@
+//  MeCab -- Yet Another Part-of-Speech and Morphological Analyzer
+//
+//  Checks Lattice::best_path_spans(), through its C wrapper, against the
+//  nodes linked from bos_node, for the one best and the N-best results.
+//
+//  usage: best-path-spans [mecab options] < sentences
+#include <iostream>
+#include <string>
+#include "mecab.h"
+
+namespace {
+
+const size_t kNBest = 3;
+
+// Compares the spans of |lattice| with its best path, field by field.
+bool check(mecab_lattice_t *lattice, const std::string &line) {
+  size_t size = 0;
+  const mecab_span_t *spans =
+      mecab_lattice_get_best_path_spans(lattice, &size);
+  const char *sentence = mecab_lattice_get_sentence(lattice);
+  size_t i = 0;
+  for (const mecab_node_t *node = mecab_lattice_get_bos_node(lattice)->next;
+       node->next; node = node->next, ++i) {
+    if (i >= size) {
+      std::cerr << "fewer spans than nodes: " << line << std::endl;
+      return false;
+    }
+    const mecab_span_t &span = spans[i];
+    if (span.begin != static_cast<unsigned int>(node->surface - sentence) ||
+        span.length != node->length ||
+        span.rlength != node->rlength ||
+        span.posid != node->posid ||
+        span.lcAttr != node->lcAttr ||
+        span.rcAttr != node->rcAttr ||
+        span.char_type != node->char_type ||
+        span.stat != node->stat ||
+        span.wcost != node->wcost ||
+        span.cost != static_cast<int>(node->cost) ||
+        span.feature != node->feature) {
+      std::cerr << "span " << i << " differs from its node: "
+                << line << std::endl;
+      return false;
+    }
+  }
+  if (i != size) {
+    std::cerr << "more spans than nodes: " << line << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool parse(mecab_t *tagger, mecab_lattice_t *lattice,
+           const std::string &line, int request_type) {
+  mecab_lattice_clear(lattice);
+  mecab_lattice_set_request_type(lattice, request_type);
+  mecab_lattice_set_sentence2(lattice, line.data(), line.size());
+  if (!mecab_parse_lattice(tagger, lattice)) {
+    std::cerr << mecab_lattice_strerror(lattice) << std::endl;
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  mecab_model_t *model = mecab_model_new(argc, argv);
+  if (!model) {
+    std::cerr << mecab_strerror(0) << std::endl;
+    return -1;
+  }
+  mecab_t *tagger = mecab_model_new_tagger(model);
+  mecab_lattice_t *lattice = mecab_model_new_lattice(model);
+
+  int result = 0;
+  std::string line;
+  while (result == 0 && std::getline(std::cin, line)) {
+    // the spans are built only on request
+    size_t size = 0;
+    if (!parse(tagger, lattice, line, MECAB_ONE_BEST) ||
+        mecab_lattice_get_best_path_spans(lattice, &size) || size != 0) {
+      std::cerr << "spans without MECAB_BEST_PATH_SPANS: "
+                << line << std::endl;
+      result = -1;
+      break;
+    }
+
+    if (!parse(tagger, lattice, line,
+               MECAB_ONE_BEST | MECAB_BEST_PATH_SPANS) ||
+        !check(lattice, line)) {
+      result = -1;
+      break;
+    }
+
+    if (!parse(tagger, lattice, line, MECAB_NBEST | MECAB_BEST_PATH_SPANS)) {
+      result = -1;
+      break;
+    }
+    for (size_t n = 0; n < kNBest && mecab_lattice_next(lattice); ++n) {
+      if (!check(lattice, line)) {
+        result = -1;
+        break;
+      }
+    }
+  }
+
+  mecab_lattice_destroy(lattice);
+  mecab_destroy(tagger);
+  mecab_model_destroy(model);
+  return result;
+}
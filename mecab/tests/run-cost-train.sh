@@ -18,7 +18,16 @@ DICDIR=${RMODEL}.dic
 mkdir ${DICDIR}
 ${DIR}/mecab-dict-index -d ${SEEDDIR} -o ${SEEDDIR}
 ${DIR}/mecab-cost-train -c ${C} -d ${SEEDDIR} -f ${FREQ} ${CORPUS} ${RMODEL}.model
-${DIR}/mecab-dict-gen   -d ${SEEDDIR} -m ${RMODEL}.model -o ${DICDIR}
+${DIR}/mecab-dict-gen   -d ${SEEDDIR} -m ${RMODEL}.model -o ${DICDIR} -p 1
+mkdir ${DICDIR}.p4
+${DIR}/mecab-dict-gen   -d ${SEEDDIR} -m ${RMODEL}.model -o ${DICDIR}.p4 -p 4
+diff -r ${DICDIR} ${DICDIR}.p4
+if [ "$?" != "0" ]
+then
+  echo "runtests faild in cost-train: mecab-dict-gen -p 4"
+  exit -1
+fi
+rm -fr ${DICDIR}.p4
 ${DIR}/mecab-dict-index -d ${DICDIR} -o ${DICDIR}
 ${DIR}/mecab-test-gen < ${TEST} | ${DIR}/mecab -r /dev/null -d ${DICDIR}  > ${RMODEL}.result
 ${DIR}/mecab-system-eval -l "${EVAL}" ${RMODEL}.result ${TEST} | tee ${RMODEL}.score
@@ -0,0 +1,73 @@
+#!/bin/sh
+
+# mecab-dict-index builds the same files however they are built,
+# on the seed dictionary of cost-train.
+
+SEEDDIR=../cost-train/seed
+DIR=../../src
+FILES="sys.dic unk.dic matrix.bin char.bin"
+
+rm -fr tmp.index
+mkdir tmp.index
+cd tmp.index
+
+# compare() <dir> <baseline dir> <what>
+compare() {
+  for f in $FILES
+  do
+    cmp $2/$f $1/$f
+    if [ "$?" != "0" ]
+    then
+      echo "runtests faild in dict-index: $3"
+      exit -1
+    fi
+  done
+}
+
+mkdir base
+${DIR}/mecab-dict-index -d ${SEEDDIR} -o base > /dev/null
+
+for j in 1 4
+do
+  mkdir thread$j
+  ${DIR}/mecab-dict-index -d ${SEEDDIR} -o thread$j -j $j > /dev/null
+  compare thread$j base "-j $j"
+done
+
+# an --incremental rebuild after one of the CSVs changes
+mkdir seed
+cp ${SEEDDIR}/*.def ${SEEDDIR}/dicrc seed
+split -l 2000 ${SEEDDIR}/dic.csv seed/part
+for f in seed/part??
+do
+  mv $f $f.csv
+done
+
+mkdir incremental
+${DIR}/mecab-dict-index -d seed -o incremental --incremental > /dev/null
+
+touch seed/partab.csv
+${DIR}/mecab-dict-index -d seed -o incremental --incremental > index.log
+mkdir clean
+${DIR}/mecab-dict-index -d seed -o clean > /dev/null
+compare incremental clean "--incremental after touch"
+
+sed '1d' seed/partab.csv > seed/partab.tmp
+mv seed/partab.tmp seed/partab.csv
+${DIR}/mecab-dict-index -d seed -o incremental --incremental >> index.log
+rm -fr clean
+mkdir clean
+${DIR}/mecab-dict-index -d seed -o clean > /dev/null
+compare incremental clean "--incremental after edit"
+
+# the unchanged CSVs come from the cache
+if ! grep "(cached)" index.log > /dev/null
+then
+  echo "runtests faild in dict-index: --incremental does not cache"
+  exit -1
+fi
+
+cd ..
+rm -fr tmp.index
+
+exit 0
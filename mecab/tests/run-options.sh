@@ -0,0 +1,85 @@
+#!/bin/sh
+
+# Output formats and search options, on the dictionary in latin.
+# test.binary.gld is in little-endian byte order.
+
+cd latin
+
+../../src/mecab-dict-index -f euc-jp -c euc-jp
+
+input=test
+
+check() {
+  gld=$1
+  shift
+  ../../src/mecab -r /dev/null -d . "$@" $input > test.out
+  if [ "$gld" = "test.binary.gld" ]
+  then
+    cmp $gld test.out
+  else
+    diff -b $gld test.out
+  fi
+  if [ "$?" != "0" ]
+  then
+    echo "runtests faild in latin: $*"
+    exit -1
+  fi
+}
+
+check test.binary.gld -Obinary
+check test.nbest.gld -N 3 --nbest-unique=segment --nbest-agenda-size=16
+check test.max-nodes.gld --max-nodes=60
+# the best path at least, then as many results as found in the limit
+check test.nbest-max.gld -N 3 --nbest-max-candidates=60
+
+# the split of a degraded lattice keeps to the constraints
+input=test.partial
+check test.partial.gld -p --max-nodes=1 -O '' -F'%m\t%H\n' -U'%m\t%H\n'
+input=test
+
+# best_path_spans() walks the same path as bos_node, for N-best too
+if ! ../best-path-spans -r /dev/null -d . < test
+then
+  echo "runtests faild in latin: best-path-spans"
+  exit -1
+fi
+
+# -Ojson is valid JSON only for UTF-8 dictionaries
+if ../../src/mecab -r /dev/null -d . -Ojson test > /dev/null 2>&1
+then
+  echo "runtests faild in latin: -Ojson on euc-jp"
+  exit -1
+fi
+
+# the scan of sys.aho finds the same words as the lookups of sys.dic
+../../src/mecab-dict-index -f euc-jp -c euc-jp --aho-corasick
+check test.gld
+check test.nbest.gld -N 3 --nbest-unique=segment --nbest-agenda-size=16
+check test.max-nodes.gld --max-nodes=60
+
+# the hot token layout of -H only moves the tokens of the words in test
+../../src/mecab-dict-index -f euc-jp -c euc-jp -H test > test.log
+if ! grep "^hot tokens: [1-9]" test.log > /dev/null
+then
+  echo "runtests faild in latin: no hot tokens"
+  exit -1
+fi
+check test.gld
+check test.nbest.gld -N 3 --nbest-unique=segment --nbest-agenda-size=16
+
+# the columns of --columnar match the constraints as the CSV features do
+rm -f sys.aho
+../../src/mecab-dict-index -f euc-jp -c euc-jp
+input=test.columnar
+../../src/mecab -r /dev/null -d . -p -O '' -F'%m\t%H\n' -U'%m\t%H\n' \
+  $input > test.csv.out
+../../src/mecab-dict-index -f euc-jp -c euc-jp --columnar
+check test.csv.out -p -O '' -F'%m\t%H\n' -U'%m\t%H\n'
+input=test
+
+../../src/mecab-dict-index -f euc-jp -c utf-8
+check test.json.gld -Ojson
+
+rm -f *.bin *.dic *.aho test.out test.csv.out test.log
+
+exit 0